@@ -14,6 +14,7 @@ static const char kVersionInfo[] =
 
 #include "po.hpp"
 
+#include <algorithm>
 #include <array>
 #include <iomanip>
 #include <iostream>
@@ -103,6 +104,9 @@ enum class LockType
   kSpin,
   kSpinRecursive,
   kSpinShared,
+  kSpinTicket,
+  kSpinMcs,
+  kSpinDistributed,
   // timed (TODO)
   kMutexTimed,
   kRecursiveTimed,
@@ -130,6 +134,12 @@ operator>>(std::istream& is, LockType& lt)
     lt = LockType::kSpinRecursive;
   else if (s == "spin_shared" || s == "ss")
     lt = LockType::kSpinShared;
+  else if (s == "spin_ticket" || s == "sk")
+    lt = LockType::kSpinTicket;
+  else if (s == "spin_mcs" || s == "sq")
+    lt = LockType::kSpinMcs;
+  else if (s == "spin_distributed" || s == "sd")
+    lt = LockType::kSpinDistributed;
   else
     is.setstate(std::ios_base::failbit);
   return is;
@@ -151,10 +161,156 @@ operator<<(std::ostream& os, LockType lt)
       return os << "spin_recursive";
     case LockType::kSpinShared:
       return os << "spin_shared";
+    case LockType::kSpinTicket:
+      return os << "spin_ticket";
+    case LockType::kSpinMcs:
+      return os << "spin_mcs";
+    case LockType::kSpinDistributed:
+      return os << "spin_distributed";
   }
   return os;
 }
 
+enum class SpinType
+{
+  kNone,
+  kPause,
+  kBackoff,
+  kYield,
+  kPark,
+};
+
+std::istream&
+operator>>(std::istream& is, SpinType& st)
+{
+  std::string s;
+  is >> s;
+  if (s == "none" || s == "n")
+    st = SpinType::kNone;
+  else if (s == "pause" || s == "p")
+    st = SpinType::kPause;
+  else if (s == "backoff" || s == "b")
+    st = SpinType::kBackoff;
+  else if (s == "yield" || s == "y")
+    st = SpinType::kYield;
+  else if (s == "park" || s == "k")
+    st = SpinType::kPark;
+  else
+    is.setstate(std::ios_base::failbit);
+  return is;
+}
+
+std::ostream&
+operator<<(std::ostream& os, SpinType st)
+{
+  switch (st) {
+    case SpinType::kNone:
+      return os << "none";
+    case SpinType::kPause:
+      return os << "pause";
+    case SpinType::kBackoff:
+      return os << "backoff";
+    case SpinType::kYield:
+      return os << "yield";
+    case SpinType::kPark:
+      return os << "park";
+  }
+  return os;
+}
+
+/**
+ * @brief 加解锁一次的操作，shared 为真时对共享锁只加共享锁。
+ */
+template<typename P>
+std::function<void()>
+spin_work(LockType lt, bool shared)
+{
+  using SpinMutex = My::BasicSpinMutex<P>;
+
+  switch (lt) {
+    case LockType::kSpin: {
+      auto m = std::make_shared<SpinMutex>();
+      return [m] {
+        std::lock_guard<SpinMutex> lock(*m);
+        noop();
+      };
+    }
+
+    case LockType::kSpinRecursive: {
+      auto m = std::make_shared<typename SpinMutex::Recursive>();
+      return [m] {
+        std::lock_guard<typename SpinMutex::Recursive> lock(*m);
+        noop();
+      };
+    }
+
+    case LockType::kSpinShared: {
+      auto m = std::make_shared<typename SpinMutex::Shared>();
+      if (shared)
+        return [m] {
+          std::shared_lock<typename SpinMutex::Shared> lock(*m);
+          noop();
+        };
+      return [m] {
+        std::lock_guard<typename SpinMutex::Shared> lock(*m);
+        noop();
+      };
+    }
+
+    case LockType::kSpinTicket: {
+      auto m = std::make_shared<typename SpinMutex::Ticket>();
+      return [m] {
+        std::lock_guard<typename SpinMutex::Ticket> lock(*m);
+        noop();
+      };
+    }
+
+    case LockType::kSpinMcs: {
+      auto m = std::make_shared<typename SpinMutex::Mcs>();
+      return [m] {
+        std::lock_guard<typename SpinMutex::Mcs> lock(*m);
+        noop();
+      };
+    }
+
+    case LockType::kSpinDistributed: {
+      auto m = std::make_shared<typename SpinMutex::Distributed>();
+      if (shared)
+        return [m] {
+          std::shared_lock<typename SpinMutex::Distributed> lock(*m);
+          noop();
+        };
+      return [m] {
+        std::lock_guard<typename SpinMutex::Distributed> lock(*m);
+        noop();
+      };
+    }
+
+    default:
+      return noop;
+  }
+}
+
+std::function<void()>
+spin_work(LockType lt, SpinType st, bool shared = false)
+{
+  namespace sp = My::SpinPolicy;
+
+  switch (st) {
+    case SpinType::kNone:
+      return spin_work<sp::None>(lt, shared);
+    case SpinType::kPause:
+      return spin_work<sp::Pause>(lt, shared);
+    case SpinType::kBackoff:
+      return spin_work<sp::Backoff<>>(lt, shared);
+    case SpinType::kYield:
+      return spin_work<sp::Yield<>>(lt, shared);
+    case SpinType::kPark:
+      return spin_work<sp::Park<>>(lt, shared);
+  }
+  return noop;
+}
+
 int
 lock_mutex(int argc, char* argv[])
 {
@@ -162,6 +318,8 @@ lock_mutex(int argc, char* argv[])
   std::uint32_t n = 1000000;
   std::uint32_t tn = 1;
   LockType lt = LockType::kMutex;
+  SpinType sp = SpinType::kYield;
+  bool lat = false;
 
   po::options_description od("'lock_mutex' Options");
   od.add_options()                                           //
@@ -169,7 +327,9 @@ lock_mutex(int argc, char* argv[])
     ("t", povd(t), "test times")                             //
     ("n", povd(n), "number of mutex lock-unlock operations") //
     ("tn", povd(tn), "thread num, 0 - use all cpus")         //
-    ("lt", povd(lt), "lock type: [s]<m|r|s>[t]")             //
+    ("lt", povd(lt), "lock type: [s]<m|r|s|k|q|d>[t]")       //
+    ("sp", povd(sp), "spin policy: n|p|b|y|k")               //
+    ("lat", povd(lat, true), "measure latency percentiles")  //
     ;
   po::variables_map vmap;
   po::store(po::command_line_parser(argc, argv).options(od).run(), vmap);
@@ -208,43 +368,40 @@ lock_mutex(int argc, char* argv[])
       };
     } break;
 
-    case LockType::kSpin: {
-      auto m = std::make_shared<My::SpinMutex>();
-      work = [n, m] {
-        std::lock_guard<My::SpinMutex> lock(*m);
-        noop();
-      };
-    } break;
-
-    case LockType::kSpinRecursive: {
-      auto m = std::make_shared<My::SpinMutex::Recursive>();
-      work = [n, m] {
-        std::lock_guard<My::SpinMutex::Recursive> lock(*m);
-        noop();
-      };
+    default:
+      work = spin_work(lt, sp);
       break;
-    }
-
-    case LockType::kSpinShared: {
-      auto m = std::make_shared<My::SpinMutex::Shared>();
-      work = [n, m] {
-        std::lock_guard<My::SpinMutex::Shared> lock(*m);
-        noop();
-      };
-      break;
-    }
   }
 
-  std::cout << "lock " << lt << " for " << n << " * " << tn << " times."
-            << std::endl;
+  std::cout << "lock " << lt;
+  if (lt >= LockType::kSpin && lt < LockType::kMutexTimed)
+    std::cout << '<' << sp << '>';
+  std::cout << " for " << n << " * " << tn << " times." << std::endl;
+  if (lat)
+    std::cout << "throughput includes the overhead of reading the clock."
+              << std::endl;
   for (int _ = 0; _ < t; ++_) {
-    auto timingStart = HRC::now();
+    // 每个线程记录自己每次加解锁的耗时，用于统计尾延迟，在计时之前分配好
+    std::vector<std::vector<HRC::duration>> lats(lat ? tn : 0);
+    for (auto&& i : lats)
+      i.resize(n);
 
+    auto timingStart = HRC::now();
     std::vector<std::thread> threads;
     for (std::uint32_t i = 0; i < tn; ++i) {
-      threads.emplace_back([n, work] {
-        for (std::uint32_t i = 0; i < n; ++i)
+      if (!lat) {
+        threads.emplace_back([n, work] {
+          for (std::uint32_t i = 0; i < n; ++i)
+            work();
+        });
+        continue;
+      }
+      threads.emplace_back([n, work, &lats = lats[i]] {
+        for (std::uint32_t i = 0; i < n; ++i) {
+          auto begin = HRC::now();
           work();
+          lats[i] = HRC::now() - begin;
+        }
       });
     }
     for (auto&& t : threads)
@@ -259,6 +416,100 @@ lock_mutex(int argc, char* argv[])
     My::util::operator<<(std::cout, duration)
       << " (" << (double(n * tn) / seconds) << " /s, " << double(n) / seconds
       << " /s*tn)" << std::endl;
+
+    if (lat) {
+      std::vector<HRC::duration> all;
+      all.reserve(std::size_t(n) * tn);
+      for (auto&& i : lats)
+        all.insert(all.end(), i.begin(), i.end());
+      std::sort(all.begin(), all.end());
+      auto pct = [&](double p) {
+        return all[std::size_t(p * (all.size() - 1))];
+      };
+      std::cout << "\tp50 ";
+      My::util::operator<<(std::cout, pct(0.5)) << ", p99 ";
+      My::util::operator<<(std::cout, pct(0.99)) << ", p999 ";
+      My::util::operator<<(std::cout, pct(0.999)) << ", max ";
+      My::util::operator<<(std::cout, all.back()) << std::endl;
+    }
+  }
+
+  return 0;
+}
+
+int
+read_scaling(int argc, char* argv[])
+{
+  std::uint32_t t = 3;
+  std::uint32_t n = 1000000;
+  std::uint32_t tn = 0;
+  LockType lt = LockType::kSpinDistributed;
+  SpinType sp = SpinType::kYield;
+
+  po::options_description od("'read_scaling' Options");
+  od.add_options()                                          //
+    ("help,h", "print help info")                           //
+    ("t", povd(t), "test times, the best one is shown")     //
+    ("n", povd(n), "number of read lock-unlock per thread") //
+    ("tn", povd(tn), "max thread num, 0 - use all cpus")    //
+    ("lt", povd(lt), "lock type: s|ss|sd")                  //
+    ("sp", povd(sp), "spin policy: n|p|b|y|k")              //
+    ;
+  po::variables_map vmap;
+  po::store(po::command_line_parser(argc, argv).options(od).run(), vmap);
+  if (vmap.count("help")) {
+    std::cout << od << std::endl;
+    return 0;
+  }
+  po::notify(vmap);
+
+  if (lt != LockType::kShared && lt != LockType::kSpinShared &&
+      lt != LockType::kSpinDistributed) {
+    std::cout << "invalid lock type '" << lt << "', expected s|ss|sd."
+              << std::endl;
+    return 1;
+  }
+
+  if (tn == 0)
+    tn = std::thread::hardware_concurrency();
+
+  std::function<void()> work;
+  if (lt == LockType::kShared) {
+    auto m = std::make_shared<std::shared_mutex>();
+    work = [m] {
+      std::shared_lock<std::shared_mutex> lock(*m);
+      noop();
+    };
+  } else
+    work = spin_work(lt, sp, true);
+
+  std::cout << "read lock " << lt;
+  if (lt >= LockType::kSpin && lt < LockType::kMutexTimed)
+    std::cout << '<' << sp << '>';
+  std::cout << " for " << n << " times per thread, up to " << tn
+            << " threads." << std::endl;
+
+  // 线程数按 1, 2, 4, ... 递增，最后一次总是 tn
+  for (std::uint32_t k = 1;; k = std::min(k * 2, tn)) {
+    double best = 0;
+    for (int _ = 0; _ < t; ++_) {
+      auto timingStart = HRC::now();
+      std::vector<std::thread> threads;
+      for (std::uint32_t i = 0; i < k; ++i)
+        threads.emplace_back([n, &work] {
+          for (std::uint32_t i = 0; i < n; ++i)
+            work();
+        });
+      for (auto&& t : threads)
+        t.join();
+      auto seconds =
+        std::chrono::duration<double>(HRC::now() - timingStart).count();
+      best = std::max(best, double(n) * k / seconds);
+    }
+    std::cout << k << '\t' << best << " /s, " << best / k << " /s*tn"
+              << std::endl;
+    if (k == tn)
+      break;
   }
 
   return 0;
@@ -343,6 +594,7 @@ struct SubCmd
 const SubCmd kSubCmds[] = {
   { "create_threads", "", &create_threads },
   { "lock_mutex", "", &lock_mutex },
+  { "read_scaling", "", &read_scaling },
   // TODO
 };
 
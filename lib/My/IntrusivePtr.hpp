@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace My {
+
+/**
+ * @brief 侵入式引用计数的智能指针。
+ *
+ * 引用计数由对象自身维护，通过实参依赖查找调用下面两个函数：
+ *
+ * - `void intrusive_ptr_add_ref(T* p) noexcept`
+ * - `void intrusive_ptr_release(T* p) noexcept`，计数归零时销毁对象
+ *
+ * 与 std::shared_ptr 相比没有控制块，移动和解引用都不涉及额外的间接访问，
+ * 也可以随时从裸指针重新得到一个共享所有权的指针。
+ */
+template<typename T>
+class IntrusivePtr
+{
+  template<typename U>
+  friend class IntrusivePtr;
+
+public:
+  using element_type = T;
+
+  IntrusivePtr() noexcept = default;
+
+  IntrusivePtr(std::nullptr_t) noexcept {}
+
+  /**
+   * @param p 对象指针。
+   * @param addRef 为 false 时接管 p 已有的一个引用，而不是增加引用。
+   */
+  explicit IntrusivePtr(T* p, bool addRef = true) noexcept
+    : mP(p)
+  {
+    if (mP && addRef)
+      intrusive_ptr_add_ref(mP);
+  }
+
+  IntrusivePtr(const IntrusivePtr& other) noexcept
+    : IntrusivePtr(other.mP)
+  {
+  }
+
+  IntrusivePtr(IntrusivePtr&& other) noexcept
+    : mP(other.mP)
+  {
+    other.mP = nullptr;
+  }
+
+  template<typename U,
+           typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+  IntrusivePtr(const IntrusivePtr<U>& other) noexcept
+    : IntrusivePtr(other.mP)
+  {
+  }
+
+  template<typename U,
+           typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+  IntrusivePtr(IntrusivePtr<U>&& other) noexcept
+    : mP(other.mP)
+  {
+    other.mP = nullptr;
+  }
+
+  ~IntrusivePtr() noexcept
+  {
+    if (mP)
+      intrusive_ptr_release(mP);
+  }
+
+  IntrusivePtr& operator=(const IntrusivePtr& other) noexcept
+  {
+    IntrusivePtr(other).swap(*this);
+    return *this;
+  }
+
+  IntrusivePtr& operator=(IntrusivePtr&& other) noexcept
+  {
+    IntrusivePtr(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  void swap(IntrusivePtr& other) noexcept { std::swap(mP, other.mP); }
+
+  friend void swap(IntrusivePtr& lhs, IntrusivePtr& rhs) noexcept
+  {
+    lhs.swap(rhs);
+  }
+
+  void reset() noexcept { IntrusivePtr().swap(*this); }
+
+  /**
+   * @brief 放弃所有权但不减少引用，返回对象指针。
+   */
+  T* release() noexcept
+  {
+    auto p = mP;
+    mP = nullptr;
+    return p;
+  }
+
+  T* get() const noexcept { return mP; }
+  T& operator*() const noexcept { return *mP; }
+  T* operator->() const noexcept { return mP; }
+  explicit operator bool() const noexcept { return mP != nullptr; }
+
+  template<typename U>
+  bool operator==(const IntrusivePtr<U>& other) const noexcept
+  {
+    return mP == other.mP;
+  }
+
+  template<typename U>
+  bool operator!=(const IntrusivePtr<U>& other) const noexcept
+  {
+    return mP != other.mP;
+  }
+
+  bool operator==(std::nullptr_t) const noexcept { return !mP; }
+  bool operator!=(std::nullptr_t) const noexcept { return mP; }
+
+private:
+  T* mP{ nullptr };
+};
+
+/**
+ * @brief 创建一个对象并返回其侵入式指针。
+ */
+template<typename T, typename... Args>
+IntrusivePtr<T>
+make_intrusive(Args&&... args)
+{
+  return IntrusivePtr<T>(new T(std::forward<Args>(args)...));
+}
+
+/**
+ * @brief 静态转换指针类型，转移所有权而不改变引用计数。
+ */
+template<typename U, typename T>
+IntrusivePtr<U>
+static_pointer_cast(IntrusivePtr<T> p) noexcept
+{
+  return IntrusivePtr<U>(static_cast<U*>(p.release()), false);
+}
+
+} // namespace My
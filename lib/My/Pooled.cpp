@@ -1,65 +1,268 @@
 #include "Pooled.hpp"
 
+#include <algorithm>
+#include <boost/json.hpp>
+#include <thread>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace My::_Pooled {
 
-Iterator&
-Iterator::operator++() noexcept
+// ========================================================================== //
+// Counters
+// ========================================================================== //
+
+Counters&
+Counters::operator+=(const Counters& other) noexcept
+{
+  mTakes += other.mTakes;
+  mGives += other.mGives;
+  mMisses += other.mMisses;
+  mDrops += other.mDrops;
+  mLocks += other.mLocks;
+  mSpins += other.mSpins;
+  mSize += other.mSize;
+  mPeakSize += other.mPeakSize;
+  return *this;
+}
+
+bj::value
+Counters::to_jval() const noexcept(false)
+{
+  bj::object obj;
+  obj.emplace("Takes", mTakes);
+  obj.emplace("Gives", mGives);
+  obj.emplace("Misses", mMisses);
+  obj.emplace("Drops", mDrops);
+  obj.emplace("Locks", mLocks);
+  obj.emplace("Spins", mSpins);
+  obj.emplace("Size", mSize);
+  obj.emplace("PeakSize", mPeakSize);
+  return obj;
+}
+
+namespace {
+
+#if MY_POOLED_STATS
+
+template<typename N>
+Meter*
+meter_of(N& after) noexcept
+{
+  auto* stub = dynamic_cast<BasicStub<N>*>(&after);
+  return stub ? &stub->mMeter : nullptr;
+}
+
+#else
+
+/**
+ * @brief 未开启统计时的替身，meter_of 总是返回空指针，调用都会被优化掉。
+ */
+struct Meter
+{
+  void took(std::size_t) noexcept {}
+  void gave(std::size_t) noexcept {}
+  void missed() noexcept {}
+  void dropped(std::size_t) noexcept {}
+};
+
+template<typename N>
+constexpr Meter*
+meter_of(N&) noexcept
+{
+  return nullptr;
+}
+
+#endif
+
+/**
+ * @brief 锁定桩的头部，开启统计时计入等待的轮数。
+ */
+inline void
+lock(std::atomic<std::uintptr_t>& bit, Meter* m) noexcept
+{
+#if MY_POOLED_STATS
+  if (m) {
+    std::uint64_t spins = 0;
+    SpinBit::lock(bit, spins);
+    m->locked(spins);
+    return;
+  }
+#else
+  (void)m;
+#endif
+  SpinBit::lock(bit);
+}
+
+/**
+ * @brief 记录经由桩丢弃的资源，静态的 drop 不知道资源在哪条链上，由调用方
+ * 补记。
+ */
+template<typename N>
+inline void
+dropped(BasicStub<N>& stub, std::size_t n) noexcept
+{
+#if MY_POOLED_STATS
+  stub.mMeter.dropped(n);
+#else
+  (void)stub, (void)n;
+#endif
+}
+
+} // namespace
+
+#if MY_POOLED_STATS
+
+void
+Meter::took(std::size_t n) noexcept
+{
+  mTakes.fetch_add(n, std::memory_order_relaxed);
+  mSize.fetch_sub(n, std::memory_order_relaxed);
+}
+
+void
+Meter::gave(std::size_t n) noexcept
+{
+  mGives.fetch_add(n, std::memory_order_relaxed);
+  auto size = mSize.fetch_add(n, std::memory_order_relaxed) + n;
+  auto peak = mPeakSize.load(std::memory_order_relaxed);
+  while (peak < size && !mPeakSize.compare_exchange_weak(
+                          peak, size, std::memory_order_relaxed))
+    ;
+}
+
+void
+Meter::missed() noexcept
+{
+  mMisses.fetch_add(1, std::memory_order_relaxed);
+}
+
+void
+Meter::dropped(std::size_t n) noexcept
+{
+  mDrops.fetch_add(n, std::memory_order_relaxed);
+  mSize.fetch_sub(n, std::memory_order_relaxed);
+}
+
+void
+Meter::locked(std::uint64_t spins) noexcept
+{
+  mLocks.fetch_add(1, std::memory_order_relaxed);
+  if (spins)
+    mSpins.fetch_add(spins, std::memory_order_relaxed);
+}
+
+Counters
+Meter::snapshot() const noexcept
+{
+  Counters ret;
+  ret.mTakes = mTakes.load(std::memory_order_relaxed);
+  ret.mGives = mGives.load(std::memory_order_relaxed);
+  ret.mMisses = mMisses.load(std::memory_order_relaxed);
+  ret.mDrops = mDrops.load(std::memory_order_relaxed);
+  ret.mLocks = mLocks.load(std::memory_order_relaxed);
+  ret.mSpins = mSpins.load(std::memory_order_relaxed);
+  // 各计数器分别读取，并发时 mSize 可能短暂地“下溢”，按 0 报告
+  auto size = mSize.load(std::memory_order_relaxed);
+  ret.mSize = std::ptrdiff_t(size) < 0 ? 0 : size;
+  ret.mPeakSize = mPeakSize.load(std::memory_order_relaxed);
+  return ret;
+}
+
+#endif
+
+// ========================================================================== //
+// BasicStub
+// ========================================================================== //
+
+template<typename N>
+BasicIterator<N>&
+BasicIterator<N>::operator++() noexcept
 {
   auto prev = std::move(mNode);
   mNode = prev->mNext;
   SpinBit::unlock(prev->mPrev);
   if (mNode)
     SpinBit::lock(mNode->mPrev);
+  else
+    next_chain();
   return *this;
 }
 
-std::shared_ptr<Node>
-Stub::take(Node& after) noexcept
+template<typename N>
+void
+BasicIterator<N>::next_chain() noexcept
+{
+  while (!mNode && !mRest.empty()) {
+    auto stub = std::move(mRest.back());
+    mRest.pop_back();
+    SpinBit::lock(stub->mPrev);
+    mNode = stub->mNext;
+    if (mNode)
+      SpinBit::lock(mNode->mPrev);
+    SpinBit::unlock(stub->mPrev);
+  }
+}
+
+template<typename N>
+typename BasicStub<N>::Ptr
+BasicStub<N>::take(N& after) noexcept
 {
-  auto prev = after.shared_from_this();
-  SpinBit::lock(prev->mPrev);
+  auto* m = meter_of(after);
+  auto prev = N::pin(after);
+  lock(prev->mPrev, m);
 
   auto here = std::move(prev->mNext);
   if (!here) {
     SpinBit::unlock(prev->mPrev);
+    if (m)
+      m->missed();
     return nullptr;
   }
+  if (m)
+    m->took(1);
   SpinBit::lock(here->mPrev);
 
   auto next = std::move(here->mNext);
   if (!next) {
     // std::move 已经将 prev->mNext 置空
     SpinBit::unlock(prev->mPrev); // 尽可能早地释放锁
-    here->mPrev.store(0, std::memory_order_release);
-    // 上面这一步同时释放了 here 的锁
+    SpinBit::unlock(here->mPrev, 0);
+    // 上面这一步同时把 here 标记为不在池中
     return here;
   }
   SpinBit::lock(next->mPrev);
 
-  next->mPrev.store(reinterpret_cast<std::uintptr_t>(prev.get()),
-                    std::memory_order_release);
-  // 上面这一步同时释放了 next 的锁（&prev 的最低位一定为 0）
+  SpinBit::unlock(next->mPrev, reinterpret_cast<std::uintptr_t>(prev.get()));
+  // 上面这一步同时把 next 链接到了 prev 之后（&prev 的最低位一定为 0）
   prev->mNext = next;
   SpinBit::unlock(prev->mPrev);
 
   // std::move 已经将 here->mNext 置空
-  here->mPrev.store(0, std::memory_order_release);
-  // 上面这一步同时释放了 here 的锁
+  SpinBit::unlock(here->mPrev, 0);
+  // 上面这一步同时把 here 标记为不在池中
   return here;
 }
 
-std::shared_ptr<Node>
-Stub::take_if(Node& after, const std::type_info& type) noexcept
+template<typename N>
+typename BasicStub<N>::Ptr
+BasicStub<N>::take_if(N& after, const std::type_info& type) noexcept
 {
-  auto prev = after.shared_from_this();
-  SpinBit::lock(prev->mPrev);
+  auto* m = meter_of(after);
+  auto prev = N::pin(after);
+  lock(prev->mPrev, m);
 
   while (true) {
     if (!prev->mNext) {
       SpinBit::unlock(prev->mPrev);
+      if (m)
+        m->missed();
       return nullptr;
     }
-    auto here = std::move(prev->mNext);
+    // 跳过的资源要留在链上，所以这里复制而不是移动
+    auto here = prev->mNext;
     SpinBit::lock(here->mPrev);
 
     if (typeid(*here) != type) {
@@ -68,33 +271,36 @@ Stub::take_if(Node& after, const std::type_info& type) noexcept
       continue;
     }
 
+    if (m)
+      m->took(1);
     auto next = std::move(here->mNext);
     if (!next) {
-      // std::move 已经将 prev->mNext 置空
+      prev->mNext.reset();
       SpinBit::unlock(prev->mPrev); // 尽可能早地释放锁
-      here->mPrev.store(0, std::memory_order_release);
-      // 上面这一步同时释放了 here 的锁
+      SpinBit::unlock(here->mPrev, 0);
+      // 上面这一步同时把 here 标记为不在池中
       return here;
     }
     SpinBit::lock(next->mPrev);
 
-    next->mPrev.store(reinterpret_cast<std::uintptr_t>(prev.get()),
-                      std::memory_order_release);
-    // 上面这一步同时释放了 next 的锁（&prev 的最低位一定为 0）
+    SpinBit::unlock(next->mPrev, reinterpret_cast<std::uintptr_t>(prev.get()));
+    // 上面这一步同时把 next 链接到了 prev 之后（&prev 的最低位一定为 0）
     prev->mNext = next;
     SpinBit::unlock(prev->mPrev);
 
     // std::move 已经将 here->mNext 置空
-    here->mPrev.store(0, std::memory_order_release);
-    // 上面这一步同时释放了 here 的锁
+    SpinBit::unlock(here->mPrev, 0);
+    // 上面这一步同时把 here 标记为不在池中
     return here;
   }
 }
 
+template<typename N>
 void
-Stub::give(Node& after, std::shared_ptr<Node> here) noexcept
+BasicStub<N>::give(N& after, Ptr here) noexcept
 {
   assert(&after && here);
+  auto* m = meter_of(after);
   auto prev = &after;
 
   // 由于 here 不在链上，所以我们可以先锁定它
@@ -102,43 +308,180 @@ Stub::give(Node& after, std::shared_ptr<Node> here) noexcept
   // 在锁定之后再断言，尽量避免错误编程的影响
   assert(here->mNext == nullptr);
 
-  SpinBit::lock(prev->mPrev);
+  lock(prev->mPrev, m);
+  if (m)
+    m->gave(1);
   auto next = std::move(prev->mNext);
   if (!next) {
-    here->mPrev.store(reinterpret_cast<std::uintptr_t>(prev),
-                      std::memory_order_release);
-    // 上面这一步同时释放了 here 的锁（&prev 的最低位一定为 0）
+    SpinBit::unlock(here->mPrev, reinterpret_cast<std::uintptr_t>(prev));
+    // 上面这一步同时把 here 链接到了 prev 之后（&prev 的最低位一定为 0）
     prev->mNext = std::move(here);
     SpinBit::unlock(prev->mPrev);
     return;
   }
   SpinBit::lock(next->mPrev);
 
-  next->mPrev.store(reinterpret_cast<std::uintptr_t>(here.get()),
-                    std::memory_order_release);
-  // 上面这一步同时释放了 next 的锁（&here 的最低位一定为 0）
+  SpinBit::unlock(next->mPrev, reinterpret_cast<std::uintptr_t>(here.get()));
+  // 上面这一步同时把 next 链接到了 here 之后（&here 的最低位一定为 0）
   here->mNext = std::move(next);
-  here->mPrev.store(reinterpret_cast<std::uintptr_t>(prev),
-                    std::memory_order_release);
-  // 上面这一步同时释放了 here 的锁（&prev 的最低位一定为 0）
+  SpinBit::unlock(here->mPrev, reinterpret_cast<std::uintptr_t>(prev));
+  // 上面这一步同时把 here 链接到了 prev 之后（&prev 的最低位一定为 0）
 
   prev->mNext = std::move(here);
   SpinBit::unlock(prev->mPrev);
 }
 
+template<typename N>
+void
+BasicStub<N>::give_sorted(N& after, Ptr here, const Key& key) noexcept
+{
+  assert(&after && here);
+  auto k = key(*here);
+
+  // 由于 here 不在链上，所以我们可以先锁定它
+  SpinBit::lock(here->mPrev);
+  assert(here->mNext == nullptr);
+
+  auto* m = meter_of(after);
+  auto prev = N::pin(after);
+  lock(prev->mPrev, m);
+  if (m)
+    m->gave(1);
+  while (true) {
+    // 还不确定插入的位置，所以这里复制而不是移动
+    auto next = prev->mNext;
+    if (next)
+      SpinBit::lock(next->mPrev);
+
+    if (next && !(key(*next) < k)) {
+      SpinBit::unlock(prev->mPrev);
+      prev = std::move(next);
+      continue;
+    }
+
+    if (next) {
+      SpinBit::unlock(next->mPrev,
+                      reinterpret_cast<std::uintptr_t>(here.get()));
+      // 上面这一步同时把 next 链接到了 here 之后（&here 的最低位一定为 0）
+      here->mNext = std::move(next);
+    }
+    SpinBit::unlock(here->mPrev, reinterpret_cast<std::uintptr_t>(prev.get()));
+    // 上面这一步同时把 here 链接到了 prev 之后（&prev 的最低位一定为 0）
+
+    prev->mNext = std::move(here);
+    SpinBit::unlock(prev->mPrev);
+    return;
+  }
+}
+
+template<typename N>
 void
-Stub::drop(Node& node) noexcept
+BasicStub<N>::give_n(N& after, Ptr* first, Ptr* last) noexcept
+{
+  assert(&after);
+  if (first == last)
+    return;
+
+  // 这些资源都不在链上，所以我们可以先锁定它们
+  for (auto* i = first; i != last; ++i) {
+    SpinBit::lock((*i)->mPrev);
+    assert((*i)->mNext == nullptr);
+  }
+
+  auto* m = meter_of(after);
+  auto prev = &after;
+  lock(prev->mPrev, m);
+  if (m)
+    m->gave(last - first);
+  auto next = std::move(prev->mNext);
+  if (next) {
+    SpinBit::lock(next->mPrev);
+    SpinBit::unlock(next->mPrev,
+                    reinterpret_cast<std::uintptr_t>(first->get()));
+    // 上面这一步同时把 next 链接到了最先放入的资源之后
+    (*first)->mNext = std::move(next);
+  }
+
+  // 后放入的资源在前，于是 i + 1 是 i 的前驱
+  for (auto* i = first; i + 1 != last; ++i) {
+    auto* here = i->get();
+    auto* up = (i + 1)->get();
+    up->mNext = std::move(*i);
+    SpinBit::unlock(here->mPrev, reinterpret_cast<std::uintptr_t>(up));
+  }
+  auto* head = (last - 1)->get();
+  SpinBit::unlock(head->mPrev, reinterpret_cast<std::uintptr_t>(prev));
+  // 上面这一步同时把最后放入的资源链接到了 prev 之后
+
+  prev->mNext = std::move(*(last - 1));
+  SpinBit::unlock(prev->mPrev);
+}
+
+template<typename N>
+std::size_t
+BasicStub<N>::take_n(N& after, std::size_t n, Ptr* out) noexcept
+{
+  if (!n)
+    return 0;
+
+  auto* m = meter_of(after);
+  auto prev = N::pin(after);
+  lock(prev->mPrev, m);
+
+  auto here = std::move(prev->mNext);
+  if (!here) {
+    SpinBit::unlock(prev->mPrev);
+    if (m)
+      m->missed();
+    return 0;
+  }
+  SpinBit::lock(here->mPrev);
+
+  std::size_t cnt = 0;
+  while (true) {
+    auto next = std::move(here->mNext);
+    if (next)
+      SpinBit::lock(next->mPrev);
+    SpinBit::unlock(here->mPrev, 0);
+    // 上面这一步同时把 here 标记为不在池中
+    out[cnt++] = std::move(here);
+
+    if (!next) {
+      // std::move 已经将 prev->mNext 置空
+      SpinBit::unlock(prev->mPrev);
+      if (m)
+        m->took(cnt);
+      return cnt;
+    }
+
+    if (cnt == n) {
+      SpinBit::unlock(next->mPrev,
+                      reinterpret_cast<std::uintptr_t>(prev.get()));
+      // 上面这一步同时把 next 链接到了 prev 之后（&prev 的最低位一定为 0）
+      prev->mNext = std::move(next);
+      SpinBit::unlock(prev->mPrev);
+      if (m)
+        m->took(cnt);
+      return cnt;
+    }
+    here = std::move(next);
+  }
+}
+
+template<typename N>
+bool
+BasicStub<N>::drop(N& node) noexcept
 {
   assert(&node);
-  auto here = node.shared_from_this();
+  auto here = N::pin(node);
   while (true) {
     SpinBit::lock(here->mPrev);
     auto masked = SpinBit::masked(here->mPrev);
     if (!masked) {
       SpinBit::unlock(here->mPrev);
-      return;
+      return false;
     }
-    auto prev = reinterpret_cast<Node*>(masked)->shared_from_this();
+    auto prev = N::pin(*reinterpret_cast<N*>(masked));
     assert(prev);
 
     // 先释放 hereBit，等 prevBit 锁定后再重新锁定，避免死锁
@@ -154,112 +497,1137 @@ Stub::drop(Node& node) noexcept
     if (!next) {
       prev->mNext.reset();
       SpinBit::unlock(prev->mPrev); // 尽可能早地释放锁
-      here->mPrev.store(0, std::memory_order_release);
-      // 上面这一步同时释放了 here 的锁
-      return;
+      SpinBit::unlock(here->mPrev, 0);
+      // 上面这一步同时把 here 标记为不在池中
+      return true;
     }
 
     SpinBit::lock(next->mPrev);
-    next->mPrev.store(reinterpret_cast<std::uintptr_t>(prev.get()),
-                      std::memory_order_release);
-    // 上面这一步同时释放了 next 的锁（&prev 的最低位一定为 0）
+    SpinBit::unlock(next->mPrev, reinterpret_cast<std::uintptr_t>(prev.get()));
+    // 上面这一步同时把 next 链接到了 prev 之后（&prev 的最低位一定为 0）
     prev->mNext = std::move(next);
     SpinBit::unlock(prev->mPrev); // 尽可能早地释放锁
 
-    here->mPrev.store(0, std::memory_order_release);
-    // 上面这一步同时释放了 here 的锁
-    break;
+    SpinBit::unlock(here->mPrev, 0);
+    // 上面这一步同时把 here 标记为不在池中
+    return true;
   }
 }
 
+template<typename N>
 void
-Stub::clear(Node& after) noexcept
+BasicStub<N>::clear(N& after) noexcept
 {
-  auto prev = after.shared_from_this();
-  SpinBit::lock(prev->mPrev);
+  auto* m = meter_of(after);
+  auto prev = N::pin(after);
+  lock(prev->mPrev, m);
 
   auto here = std::move(prev->mNext);
   SpinBit::unlock(prev->mPrev);
+  std::size_t cnt = 0;
   while (here) {
     SpinBit::lock(here->mPrev);
     auto next = std::move(here->mNext);
-    here->mPrev.store(0, std::memory_order_release);
-    // 上面这一步同时释放了 here 的锁
+    SpinBit::unlock(here->mPrev, 0);
+    // 上面这一步同时把 here 标记为不在池中
     here = std::move(next);
     // here 指向的对象会直到在引用计数为 0 才被销毁
+    ++cnt;
   }
+  if (m)
+    m->dropped(cnt);
 }
 
+template<typename N>
 std::size_t
-Stub::count(Node& node) noexcept
+BasicStub<N>::count(N& node) noexcept
 {
   std::size_t cnt = 0;
-  for (auto it = begin(node), end = Stub::end(); it != end; ++it)
+  for (auto it = begin(node), end = BasicStub::end(); it != end; ++it)
     ++cnt;
   return cnt;
 }
 
-} // namespace My::_Pooled
+template class BasicIterator<Node>;
+template class BasicIterator<RcNode>;
+template class BasicStub<Node>;
+template class BasicStub<RcNode>;
+
+// ========================================================================== //
+// Cache
+// ========================================================================== //
 
 /**
- * 一些设计思考：
- *
- * 1. shared_from_this 必要吗？
- *
- *    似乎是不必要的，因为：
- *    - 资源上的锁总保证其只会被单个线程占用，不存在多线程间析构的问题
- *    - 所以，资源的所有权要么是资源池，要么是单个线程，不存在多线程间共享的问题
- *
- *    如果不用智能指针呢？当线程移交资源到池时，谁持有资源的所有权？所以必须要用。
- *
- *    如果使用 unique_ptr 呢？那么如果资源要在多线程间共享，它岂不是会同时拥有
- *    shared_ptr 和 unique_ptr 两种所有权？这是肯定不对的。
- *    - 除非：unique_ptr<shared_ptr<T>>，这样就可以保证资源只有一个所有权
- *    - 得这么考虑：一般使用这个类的资源都不是线程间共享（所有权）的，所以不会有
- *      这个问题
- *
- *    主要是在 drop 操作中，由于要按序锁定，在从 here 找到 prev 时，需要放弃
- *    here 的锁， 而从锁被放弃到找到 prev 之间，prev 就可能被释放了，因此必须
- *    要有一种办法来保证 prev 到下次锁定前不会被释放，这就是 shared_from_this
- *    的作用。
- *
- *    结论：有必要，就是为了 drop 操作服务的
- *
- * 2. 要不要有哨兵？
- *
- *    哨兵的问题是：
- *    - 类型不安全，shared_ptr/unique_ptr 在转换时可能会发生切片
- *
- *    没有哨兵的问题是：
- *    - 当池中仅剩的一个资源被丢弃时，怎么更新资源池的头指针？
- *
- *    结论：有必要，否则无法实现资源池的头指针更新
- *
- *    那要不要有尾哨兵？
- *    - 有尾哨兵的问题是：尾哨兵的存在会对遍历带来问题，因为遍历器要持有节点上
- *      的锁 —— 那么 end() 返回的尾哨兵要不要持有锁呢？如果持有锁，那么多线程
- *      遍历就是不可能的：尾哨兵上会互斥。
- *
- *    结论：不能有尾哨兵，因为遍历器不能持有尾哨兵上的锁
- *
- * 3. 要不要用 virtual 析构函数？
- *
- *    设想这样一种情况：一个线程正在执行 drop，它通过 prev 给前一个结点刚刚
- *    创建了一个 shared_ptr<Node> 的指针，这个结点就被另一个线程 drop 掉了，
- *    但因为这个线程持有了 shared_ptr，所以这个结点没有在另一个线程 drop
- *    时被销毁，而是在 shared_ptr 被销毁时被销毁，这时结点会被切片（以 Node
- *    析构，而非 T），这问题就大了。
- *
- *    此外，virtual 析构函数可以避免模板导致的代码膨胀，因为大部分对象头处理
- *    的代码都可以放到内部命名空间中。
- *
- *    结论：要，因为有哨兵后可能会发生切片。
- *
- * 4. 要不要区分 next 和 prev 锁？
- *
- *    没必要，因为争用主要发生在申请资源时，仅仅隔离申请和释放不会减轻争用。
- *
- * 5. 因为有了析构函数，可以考虑搞成一个 RAII 的资源池，每个结点可以是不同类
- *    型的资源。需要增加额外的方法：取出下一个指定类型的资源。当然，可以再用
- *    模板提供一个类型安全的类，它使用静态类型转换避免运行时类型检查。
+ * @brief 线程本地的弹匣，线程退出时把剩余的资源退回全局链。
+ */
+struct Cache::Local
+{
+  std::uint64_t mId;
+  std::weak_ptr<Cache> mCache;
+  std::shared_ptr<Stub> mStub{ std::make_shared<Stub>() };
+  std::size_t mSize{ 0 }; ///< 弹匣中资源数的上界，别的线程 drop 时不会更新
+  std::vector<std::shared_ptr<Node>> mBuffer; ///< 成批补充和退回时的暂存区
+
+  Local(Cache& cache)
+    : mId(cache.mId)
+    , mCache(cache.weak_from_this())
+    , mBuffer(cache.mCapacity + 1)
+  {
+  }
+
+  Local(Local&&) = default;
+  Local& operator=(Local&&) = default;
+
+  ~Local() noexcept
+  {
+    if (!mStub)
+      return; // 已被移动
+
+    // 池已析构时弹匣已被清空，无需处理
+    if (auto cache = mCache.lock()) {
+      while (auto here = Stub::take(*mStub)) {
+        auto& type = typeid(*here);
+        cache->put(cache->chain(type), std::move(here));
+      }
+
+      std::lock_guard<SpinMutex> lock(cache->mMutex);
+      auto& locals = cache->mLocals;
+      locals.erase(std::find(locals.begin(), locals.end(), mStub));
+    }
+  }
+};
+
+namespace {
+
+std::atomic<std::uint64_t> gCacheId{ 0 };
+
+/**
+ * @brief 本线程用过的所有弹匣，一个线程通常只会用到很少几个池。
+ */
+thread_local std::vector<Cache::Local> gtLocals;
+
+} // namespace
+
+Cache::Cache(std::size_t capacity,
+             const std::type_info& base,
+             Order order,
+             Stub::Key key)
+  : mOrder(order)
+  , mKey(std::move(key))
+  , mCapacity(order == Order::kLifo ? capacity : 0)
+  , mId(gCacheId.fetch_add(1, std::memory_order_relaxed))
+  , mChains(make_chain(base))
+{
+  assert(mOrder != Order::kPriority || mKey);
+}
+
+Cache::~Cache() noexcept
+{
+  clear();
+  for (auto* c = mChains.load(std::memory_order_relaxed); c;) {
+    auto* next = c->mNext;
+    delete c;
+    c = next;
+  }
+}
+
+Cache::Local*
+Cache::local() noexcept
+{
+  if (!mCapacity)
+    return nullptr;
+
+  for (auto& i : gtLocals)
+    if (i.mId == mId)
+      return &i;
+
+  try {
+    // 顺便清理已经析构的池留下的弹匣
+    gtLocals.erase(std::remove_if(gtLocals.begin(),
+                                  gtLocals.end(),
+                                  [](auto& i) { return i.mCache.expired(); }),
+                   gtLocals.end());
+
+    Local local(*this);
+    std::lock_guard<SpinMutex> lock(mMutex);
+    mLocals.emplace_back(local.mStub);
+    try {
+      gtLocals.emplace_back(std::move(local));
+    } catch (...) {
+      mLocals.pop_back();
+      throw;
+    }
+    return &gtLocals.back();
+  } catch (...) {
+    return nullptr; // 退化为直接存取全局链
+  }
+}
+
+Cache::Chain*
+Cache::find(const std::type_info& type) const noexcept
+{
+  for (auto* c = mChains.load(std::memory_order_acquire); c; c = c->mNext)
+    if (c->mType == type)
+      return c;
+  return nullptr;
+}
+
+Cache::Chain&
+Cache::chain(const std::type_info& type) noexcept
+{
+  if (auto* c = find(type))
+    return *c;
+
+  std::lock_guard<SpinMutex> lock(mMutex);
+  if (auto* c = find(type)) // 可能别的线程刚刚建立了这条链
+    return *c;
+
+  auto* head = mChains.load(std::memory_order_relaxed);
+  try {
+    auto* c = make_chain(type);
+    c->mNext = head;
+    mChains.store(c, std::memory_order_release);
+    return *c;
+  } catch (...) {
+    // 基础类型的链总在最后
+    while (head->mNext)
+      head = head->mNext;
+    return *head;
+  }
+}
+
+Cache::Chain*
+Cache::make_chain(const std::type_info& type)
+{
+  std::unique_ptr<Chain> c(new Chain(type));
+  if (mOrder == Order::kFifo)
+    c->mIn = std::make_shared<Stub>();
+  return c.release();
+}
+
+void
+Cache::put(Chain& c, std::shared_ptr<Node> here) noexcept
+{
+  switch (mOrder) {
+    case Order::kFifo:
+      Stub::give(*c.mIn, std::move(here));
+      break;
+    case Order::kPriority:
+      Stub::give_sorted(*c.mStub, std::move(here), mKey);
+      break;
+    default:
+      Stub::give(*c.mStub, std::move(here));
+  }
+}
+
+std::shared_ptr<Node>
+Cache::get(Chain& c) noexcept
+{
+  if (auto here = Stub::take(*c.mStub))
+    return here;
+  if (mOrder != Order::kFifo)
+    return nullptr;
+
+  std::lock_guard<SpinMutex> lock(c.mShift);
+  if (auto here = Stub::take(*c.mStub)) // 可能别的线程刚刚搬运过
+    return here;
+  shift(c);
+  return Stub::take(*c.mStub);
+}
+
+void
+Cache::put_n(Chain& c,
+             std::shared_ptr<Node>* first,
+             std::shared_ptr<Node>* last) noexcept
+{
+  switch (mOrder) {
+    case Order::kFifo:
+      Stub::give_n(*c.mIn, first, last);
+      break;
+    case Order::kPriority:
+      // 插入的位置各不相同，没法整段拼接
+      for (; first != last; ++first)
+        Stub::give_sorted(*c.mStub, std::move(*first), mKey);
+      break;
+    default:
+      Stub::give_n(*c.mStub, first, last);
+  }
+}
+
+std::size_t
+Cache::get_n(Chain& c, std::size_t n, std::shared_ptr<Node>* out) noexcept
+{
+  auto cnt = Stub::take_n(*c.mStub, n, out);
+  if (cnt == n || mOrder != Order::kFifo)
+    return cnt;
+
+  std::lock_guard<SpinMutex> lock(c.mShift);
+  cnt += Stub::take_n(*c.mStub, n - cnt, out + cnt);
+  if (cnt == n)
+    return cnt;
+  shift(c);
+  return cnt + Stub::take_n(*c.mStub, n - cnt, out + cnt);
+}
+
+void
+Cache::shift(Chain& c) noexcept
+{
+  // 入口是后进先出的，逐个搬到出口的头部之后顺序正好倒过来，最早放入的在最前
+  while (auto here = Stub::take(*c.mIn))
+    Stub::give(*c.mStub, std::move(here));
+}
+
+std::shared_ptr<Node>
+Cache::take_any() noexcept
+{
+  for (auto* c = mChains.load(std::memory_order_acquire); c; c = c->mNext)
+    if (auto here = get(*c))
+      return here;
+  return nullptr;
+}
+
+std::size_t
+Cache::take_any_n(std::size_t n, std::shared_ptr<Node>* out) noexcept
+{
+  std::size_t cnt = 0;
+  for (auto* c = mChains.load(std::memory_order_acquire); c && cnt < n;
+       c = c->mNext)
+    cnt += get_n(*c, n - cnt, out + cnt);
+  return cnt;
+}
+
+void
+Cache::spill(Local& l) noexcept
+{
+  auto n = l.mSize - mCapacity / 2;
+  auto cnt = Stub::take_n(*l.mStub, n, l.mBuffer.data());
+  l.mSize = cnt < n ? 0 : l.mSize - cnt;
+  give_n(l.mBuffer.data(), l.mBuffer.data() + cnt);
+}
+
+std::shared_ptr<Node>
+Cache::refill(Local& l) noexcept
+{
+  auto n = std::max<std::size_t>(mCapacity / 2, 1);
+  auto cnt = take_any_n(n, l.mBuffer.data());
+  l.mSize = 0;
+  if (!cnt)
+    return nullptr;
+  Stub::give_n(*l.mStub, l.mBuffer.data() + 1, l.mBuffer.data() + cnt);
+  l.mSize = cnt - 1;
+  return std::move(l.mBuffer[0]);
+}
+
+std::shared_ptr<Node>
+Cache::take() noexcept
+{
+  auto* l = local();
+  if (!l)
+    return take_any();
+
+  if (auto here = Stub::take(*l->mStub)) {
+    if (l->mSize)
+      --l->mSize;
+    return here;
+  }
+  return refill(*l);
+}
+
+std::shared_ptr<Node>
+Cache::take_if(const std::type_info& type) noexcept
+{
+  // 弹匣的容量很小，逐个比较的代价有上界
+  if (auto* l = local())
+    if (auto here = Stub::take_if(*l->mStub, type)) {
+      if (l->mSize)
+        --l->mSize;
+      return here;
+    }
+
+  auto* c = find(type);
+  return c ? get(*c) : nullptr;
+}
+
+void
+Cache::give(std::shared_ptr<Node> here) noexcept
+{
+  auto* l = local();
+  if (!l) {
+    auto& type = typeid(*here);
+    put(chain(type), std::move(here));
+    return;
+  }
+
+  Stub::give(*l->mStub, std::move(here));
+  if (++l->mSize > mCapacity)
+    spill(*l);
+}
+
+void
+Cache::give_n(std::shared_ptr<Node>* first,
+              std::shared_ptr<Node>* last) noexcept
+{
+  while (first != last) {
+    auto& type = typeid(**first);
+    auto* end = first + 1;
+    while (end != last && typeid(**end) == type)
+      ++end;
+    put_n(chain(type), first, end);
+    first = end;
+  }
+}
+
+std::size_t
+Cache::take_n(std::size_t n, std::shared_ptr<Node>* out) noexcept
+{
+  std::size_t cnt = 0;
+  if (auto* l = local()) {
+    cnt = Stub::take_n(*l->mStub, n, out);
+    l->mSize = cnt < l->mSize ? l->mSize - cnt : 0;
+  }
+  return cnt + take_any_n(n - cnt, out + cnt);
+}
+
+void
+Cache::clear() noexcept
+{
+  for (auto* c = mChains.load(std::memory_order_acquire); c; c = c->mNext) {
+    Stub::clear(*c->mStub);
+    if (c->mIn)
+      Stub::clear(*c->mIn);
+  }
+  std::lock_guard<SpinMutex> lock(mMutex);
+  for (auto& i : mLocals)
+    Stub::clear(*i);
+}
+
+Iterator
+Cache::begin() noexcept
+{
+  std::vector<std::shared_ptr<Node>> stubs;
+  {
+    std::lock_guard<SpinMutex> lock(mMutex);
+    stubs.assign(mLocals.rbegin(), mLocals.rend());
+  }
+  // 遍历器从尾部取链，因此全局的各条类型链逆序放在最后，最先被遍历
+  auto locals = stubs.size();
+  for (auto* c = mChains.load(std::memory_order_acquire); c; c = c->mNext) {
+    stubs.emplace_back(c->mStub);
+    if (c->mIn)
+      stubs.emplace_back(c->mIn);
+  }
+  std::reverse(stubs.begin() + locals, stubs.end());
+  return { std::move(stubs) };
+}
+
+std::size_t
+Cache::count() noexcept
+{
+  std::size_t cnt = 0;
+  for (auto it = begin(), end = Stub::end(); it != end; ++it)
+    ++cnt;
+  return cnt;
+}
+
+Counters
+Cache::counters() noexcept
+{
+  Counters ret;
+  {
+    std::lock_guard<SpinMutex> lock(mMutex);
+    for (auto& i : mLocals)
+      ret += i->counters();
+  }
+  for (auto* c = mChains.load(std::memory_order_acquire); c; c = c->mNext) {
+    ret += c->mStub->counters();
+    if (c->mIn)
+      ret += c->mIn->counters();
+  }
+  return ret;
+}
+
+// ========================================================================== //
+// Stack
+// ========================================================================== //
+
+namespace {
+
+enum : std::uint32_t
+{
+  kFree,    ///< 单元空闲，或在栈中但其资源已被认领走
+  kFull,    ///< 单元在栈中且持有资源
+  kBusy,    ///< 资源正在被认领
+  kDropped, ///< 单元仍在栈中，但资源已被认领走，等待 take 回收
+};
+
+std::uint32_t
+log2(std::uint32_t x) noexcept
+{
+#ifdef _MSC_VER
+  unsigned long r;
+  _BitScanReverse(&r, x);
+  return r;
+#else
+  return 31 - __builtin_clz(x);
+#endif
+}
+
+constexpr std::uint64_t
+pack(std::uint64_t tagged, std::uint32_t index) noexcept
+{
+  return ((tagged >> 32) + 1) << 32 | index;
+}
+
+} // namespace
+
+struct Stack::Cell
+{
+  std::atomic<std::uint32_t> mNext{ 0 }; ///< 栈中下一个单元的下标 + 1
+  std::atomic<std::uint32_t> mState{ kFree };
+  std::uint32_t mIndex{ 0 };
+  std::shared_ptr<Node> mNode; ///< 只由将单元置为 kBusy 的线程访问
+
+  /**
+   * @brief 认领单元中的资源，成功时单元处于 kBusy 状态。
+   *
+   * @param wait 为真时等待其它线程的认领结束。
+   */
+  bool claim(bool wait) noexcept
+  {
+    while (true) {
+      std::uint32_t expected = kFull;
+      // 失败时也要 acquire：看到 kDropped 后单元会被回收，须与 seize 同步
+      if (mState.compare_exchange_weak(expected,
+                                       kBusy,
+                                       std::memory_order_acquire,
+                                       std::memory_order_acquire))
+        return true;
+      if (expected != kBusy && expected != kFull)
+        return false;
+      if (expected == kBusy) {
+        if (!wait)
+          return false;
+        SpinPolicy::pause();
+      }
+    }
+  }
+
+  /**
+   * @brief 认领走单元中的资源，并把资源标记为不在池中。
+   */
+  std::shared_ptr<Node> seize(std::uint32_t state) noexcept
+  {
+    auto node = std::move(mNode);
+    node->mPrev.store(0, std::memory_order_relaxed);
+    mState.store(state, std::memory_order_release);
+    return node;
+  }
+};
+
+Stack::~Stack() noexcept
+{
+  clear();
+  for (std::uint32_t k = 0; k < kChunks; ++k)
+    delete[] mChunks[k].load(std::memory_order_relaxed);
+}
+
+Stack::Cell&
+Stack::cell(std::uint32_t index) const noexcept
+{
+  auto k = log2(index / kChunkBase + 1);
+  auto offset = index - kChunkBase * ((std::uint32_t(1) << k) - 1);
+  return mChunks[k].load(std::memory_order_acquire)[offset];
+}
+
+Stack::Cell*
+Stack::pop(std::atomic<std::uint64_t>& head) noexcept
+{
+  auto tagged = head.load(std::memory_order_acquire);
+  while (true) {
+    auto index = std::uint32_t(tagged);
+    if (!index)
+      return nullptr;
+    auto& c = cell(index - 1);
+    // 单元不会被释放，即使它已被别的线程弹出，读到的 mNext 也只会让下面的
+    // CAS 因版本号不同而失败
+    auto next = c.mNext.load(std::memory_order_relaxed);
+    if (head.compare_exchange_weak(tagged,
+                                   pack(tagged, next),
+                                   std::memory_order_acquire,
+                                   std::memory_order_acquire))
+      return &c;
+  }
+}
+
+void
+Stack::push(std::atomic<std::uint64_t>& head, Cell& cell) noexcept
+{
+  auto tagged = head.load(std::memory_order_relaxed);
+  do
+    cell.mNext.store(std::uint32_t(tagged), std::memory_order_relaxed);
+  while (!head.compare_exchange_weak(tagged,
+                                     pack(tagged, cell.mIndex + 1),
+                                     std::memory_order_release,
+                                     std::memory_order_relaxed));
+}
+
+Stack::Cell&
+Stack::acquire()
+{
+  if (auto* c = pop(mFree))
+    return *c;
+
+  std::lock_guard<SpinMutex> lock(mGrow);
+  if (auto* c = pop(mFree)) // 可能别的线程刚刚分配了新块
+    return *c;
+
+  auto begin = mCells.load(std::memory_order_relaxed);
+  auto k = log2(begin / kChunkBase + 1);
+  auto size = kChunkBase << k;
+  auto* chunk = new Cell[size];
+  for (std::uint32_t i = 0; i < size; ++i)
+    chunk[i].mIndex = begin + i;
+  mChunks[k].store(chunk, std::memory_order_release);
+  mCells.store(begin + size, std::memory_order_relaxed);
+
+  for (std::uint32_t i = 1; i < size; ++i)
+    push(mFree, chunk[i]);
+  return chunk[0];
+}
+
+void
+Stack::release(Cell& cell) noexcept
+{
+  cell.mState.store(kFree, std::memory_order_relaxed);
+  push(mFree, cell);
+}
+
+std::shared_ptr<Node>
+Stack::take() noexcept
+{
+  while (auto* c = pop(mHead)) {
+    // 单元已不在栈中，只可能有 drop 等正在认领它，等待其结束即可
+    if (c->claim(true)) {
+      auto node = c->seize(kFree);
+      release(*c);
+      return node;
+    }
+    release(*c); // 资源已被丢弃，回收单元后继续
+  }
+  return nullptr;
+}
+
+std::shared_ptr<Node>
+Stack::take_if(const std::type_info& type) noexcept
+{
+  // 不弹出单元，而是像 drop 一样就地认领走资源，避免打乱其它资源的顺序
+  auto steps = mCells.load(std::memory_order_relaxed);
+  auto index = std::uint32_t(mHead.load(std::memory_order_acquire));
+  for (; index && steps; --steps) {
+    auto& c = cell(index - 1);
+    if (c.claim(false)) {
+      if (typeid(*c.mNode) == type)
+        return c.seize(kDropped);
+      c.mState.store(kFull, std::memory_order_release);
+    }
+    index = c.mNext.load(std::memory_order_relaxed);
+  }
+  return nullptr;
+}
+
+void
+Stack::give(std::shared_ptr<Node> here)
+{
+  assert(here && !Stub::is_in(*here));
+  auto& c = acquire();
+  // drop 会经由 mPrev 找到单元，单元可能是刚刚分配的
+  here->mPrev.store(reinterpret_cast<std::uintptr_t>(&c),
+                    std::memory_order_release);
+  c.mNode = std::move(here);
+  // 遍历者可能经由过时的 mNext 提前看到这个单元，因此也要以 release 发布
+  c.mState.store(kFull, std::memory_order_release);
+  push(mHead, c);
+}
+
+void
+Stack::drop(Node& here) noexcept
+{
+  auto* c = reinterpret_cast<Cell*>(here.mPrev.load(std::memory_order_acquire));
+  if (!c || !c->claim(true))
+    return;
+  // 单元可能已经被回收并放入了别的资源
+  if (c->mNode.get() != &here) {
+    c->mState.store(kFull, std::memory_order_release);
+    return;
+  }
+  c->seize(kDropped);
+}
+
+void
+Stack::clear() noexcept
+{
+  while (take())
+    ;
+}
+
+std::vector<std::shared_ptr<Node>>
+Stack::snapshot()
+{
+  std::vector<std::shared_ptr<Node>> ret;
+  // 遍历时栈可能被并发修改，链上甚至可能出现环，因此限定步数
+  auto steps = mCells.load(std::memory_order_relaxed);
+  auto index = std::uint32_t(mHead.load(std::memory_order_acquire));
+  for (; index && steps; --steps) {
+    auto& c = cell(index - 1);
+    if (c.claim(false)) {
+      auto node = c.mNode;
+      c.mState.store(kFull, std::memory_order_release);
+      ret.emplace_back(std::move(node));
+    }
+    index = c.mNext.load(std::memory_order_relaxed);
+  }
+  return ret;
+}
+
+std::size_t
+Stack::count() noexcept
+{
+  std::size_t cnt = 0;
+  auto steps = mCells.load(std::memory_order_relaxed);
+  auto index = std::uint32_t(mHead.load(std::memory_order_acquire));
+  for (; index && steps; --steps) {
+    auto& c = cell(index - 1);
+    if (c.mState.load(std::memory_order_relaxed) != kDropped)
+      ++cnt;
+    index = c.mNext.load(std::memory_order_relaxed);
+  }
+  return cnt;
+}
+
+// ========================================================================== //
+// Shards
+// ========================================================================== //
+
+namespace {
+
+std::atomic<unsigned> gShardNext{ 0 };
+
+/**
+ * @brief 线程的分片序号，线程第一次使用时依次分配，各线程尽量落在不同分片上。
+ */
+thread_local const unsigned gtShard =
+  gShardNext.fetch_add(1, std::memory_order_relaxed);
+
+/**
+ * @brief 线程本地的 xorshift 状态，用于选择窃取的起点。
+ */
+thread_local std::uint32_t gtStealSeed = (gtShard + 1) * 0x9e3779b9u | 1;
+
+std::size_t
+shard_mask(std::size_t shards) noexcept
+{
+  std::size_t n = 1;
+  while (n < shards)
+    n <<= 1;
+  return n - 1;
+}
+
+} // namespace
+
+Shards::Shards(std::size_t shards)
+  : mMask(shard_mask(shards ? shards : std::thread::hardware_concurrency()))
+{
+  mShards.reserve(mMask + 1);
+  for (std::size_t i = 0; i <= mMask; ++i)
+    mShards.emplace_back(std::make_shared<Shard>());
+}
+
+template<typename F>
+std::shared_ptr<Node>
+Shards::steal(F&& f) noexcept
+{
+  auto home = gtShard & mMask;
+  if (auto here = f(*mShards[home]))
+    return here;
+
+  auto& x = gtStealSeed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  for (std::size_t i = 0, start = x; i <= mMask; ++i) {
+    auto shard = (start + i) & mMask;
+    if (shard == home)
+      continue;
+    if (auto here = f(*mShards[shard]))
+      return here;
+  }
+  return nullptr;
+}
+
+std::shared_ptr<Node>
+Shards::take() noexcept
+{
+  return steal([](Stub& stub) { return Stub::take(stub); });
+}
+
+std::shared_ptr<Node>
+Shards::take_if(const std::type_info& type) noexcept
+{
+  return steal([&](Stub& stub) { return Stub::take_if(stub, type); });
+}
+
+void
+Shards::give(std::shared_ptr<Node> here) noexcept
+{
+  Stub::give(*mShards[gtShard & mMask], std::move(here));
+}
+
+void
+Shards::clear() noexcept
+{
+  for (auto& i : mShards)
+    Stub::clear(*i);
+}
+
+Iterator
+Shards::begin() noexcept
+{
+  return { std::vector<std::shared_ptr<Node>>(mShards.begin(), mShards.end()) };
+}
+
+std::size_t
+Shards::count() noexcept
+{
+  std::size_t cnt = 0;
+  for (auto it = begin(), end = Stub::end(); it != end; ++it)
+    ++cnt;
+  return cnt;
+}
+
+Counters
+Shards::counters() const noexcept
+{
+  Counters ret;
+  for (auto& i : mShards)
+    ret += i->counters();
+  return ret;
+}
+
+// ========================================================================== //
+// Bounded
+// ========================================================================== //
+
+namespace {
+
+void
+raise_peak(std::atomic<std::size_t>& peak, std::size_t value) noexcept
+{
+  auto old = peak.load(std::memory_order_relaxed);
+  while (old < value &&
+         !peak.compare_exchange_weak(old, value, std::memory_order_relaxed))
+    ;
+}
+
+} // namespace
+
+Bounded::Bounded(std::size_t maxIdle, std::size_t maxTotal)
+  : mMaxIdle(maxIdle)
+  , mMaxTotal(maxTotal)
+{
+}
+
+Bounded::~Bounded() noexcept
+{
+  // 没有人再能归还资源了，让排队的回调都结束等待
+  for (auto& handler : mHandlers)
+    handler(nullptr);
+  clear();
+}
+
+bool
+Bounded::reserve() noexcept
+{
+  auto total = mTotal.load(std::memory_order_relaxed);
+  do {
+    if (total >= mMaxTotal) {
+      mRejects.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+  } while (!mTotal.compare_exchange_weak(
+    total, total + 1, std::memory_order_relaxed));
+  raise_peak(mPeakTotal, total + 1);
+  return true;
+}
+
+void
+Bounded::unreserve() noexcept
+{
+  mTotal.fetch_sub(1, std::memory_order_relaxed);
+  wake();
+}
+
+std::shared_ptr<Node>
+Bounded::take() noexcept
+{
+  auto here = Stub::take(*mStub);
+  if (here)
+    mIdle.fetch_sub(1, std::memory_order_relaxed);
+  return here;
+}
+
+std::shared_ptr<Node>
+Bounded::take_if(const std::type_info& type) noexcept
+{
+  auto here = Stub::take_if(*mStub, type);
+  if (here)
+    mIdle.fetch_sub(1, std::memory_order_relaxed);
+  return here;
+}
+
+std::shared_ptr<Node>
+Bounded::take_until(Clock::time_point deadline) noexcept
+{
+  if (auto here = take())
+    return here;
+
+  std::unique_lock lock(mMutex);
+  wait_begin();
+  std::shared_ptr<Node> here;
+  while (!(here = take()) &&
+         mTotal.load(std::memory_order_relaxed) >= mMaxTotal) {
+    if (mCond.wait_until(lock, deadline) == std::cv_status::timeout) {
+      if (!(here = take()))
+        mTimeouts.fetch_add(1, std::memory_order_relaxed);
+      break;
+    }
+  }
+  mWaiting.fetch_sub(1, std::memory_order_relaxed);
+  return here;
+}
+
+void
+Bounded::async_take(Handler handler)
+{
+  if (auto here = take()) {
+    handler(std::move(here));
+    return;
+  }
+
+  std::unique_lock lock(mMutex);
+  wait_begin();
+  auto here = take();
+  if (here || mTotal.load(std::memory_order_relaxed) < mMaxTotal) {
+    mWaiting.fetch_sub(1, std::memory_order_relaxed);
+    lock.unlock();
+    handler(std::move(here));
+    return;
+  }
+  mHandlers.emplace_back(std::move(handler));
+}
+
+void
+Bounded::give(std::shared_ptr<Node> here) noexcept
+{
+  auto idle = mIdle.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (idle > mMaxIdle && !mWaiting.load(std::memory_order_relaxed)) {
+    mIdle.fetch_sub(1, std::memory_order_relaxed);
+    mDiscards.fetch_add(1, std::memory_order_relaxed);
+    return; // here 析构时经由 unreserve 归还名额
+  }
+  raise_peak(mPeakIdle, idle);
+  here->mStamp = Clock::now().time_since_epoch().count();
+  Stub::give(*mStub, std::move(here));
+  wake();
+}
+
+void
+Bounded::drop(Node& here) noexcept
+{
+  if (Stub::drop(here)) {
+    mIdle.fetch_sub(1, std::memory_order_relaxed);
+    dropped(*mStub, 1);
+  }
+}
+
+std::size_t
+Bounded::sweep(Clock::duration ttl, const Check& check, std::size_t checks)
+{
+  auto deadline = (Clock::now() - ttl).time_since_epoch().count();
+  if (!check)
+    checks = 0;
+
+  // 遍历器持有当前资源的锁，不能在遍历中 drop，先固定住再说
+  std::vector<std::shared_ptr<Node>> stale, oldest(checks);
+  std::size_t seen = 0;
+  for (auto it = mStub->begin(); it; ++it) {
+    if (it->mStamp < deadline)
+      stale.emplace_back(Node::pin(*it));
+    else if (checks)
+      oldest[seen++ % checks] = Node::pin(*it);
+  }
+
+  static const Stub::Key stamp = [](const Node& n) { return n.mStamp; };
+  std::size_t evicts = 0;
+  for (auto& here : stale) {
+    if (Stub::drop(*here)) {
+      mIdle.fetch_sub(1, std::memory_order_relaxed);
+      dropped(*mStub, 1);
+      ++evicts;
+    }
+  }
+
+  for (auto& here : oldest) {
+    // 被别人取走了就不用检查了
+    if (!here || !Stub::drop(*here))
+      continue;
+    mIdle.fetch_sub(1, std::memory_order_relaxed);
+    dropped(*mStub, 1);
+    if (!check(*here)) {
+      ++evicts;
+      continue;
+    }
+    // 插回按时刻排好的位置而不是链头，保持链从新到老的顺序
+    mIdle.fetch_add(1, std::memory_order_relaxed);
+    Stub::give_sorted(*mStub, std::move(here), stamp);
+    wake();
+  }
+
+  // 逐出的资源在 stale 和 oldest 析构时释放，经由删除器归还名额
+  mEvicts.fetch_add(evicts, std::memory_order_relaxed);
+  return evicts;
+}
+
+void
+Bounded::clear() noexcept
+{
+  while (take())
+    ;
+}
+
+Bounded::Stats
+Bounded::stats() const noexcept
+{
+  Stats ret;
+  ret.mIdle = mIdle.load(std::memory_order_relaxed);
+  ret.mTotal = mTotal.load(std::memory_order_relaxed);
+  ret.mWaiting = mWaiting.load(std::memory_order_relaxed);
+  ret.mPeakIdle = mPeakIdle.load(std::memory_order_relaxed);
+  ret.mPeakTotal = mPeakTotal.load(std::memory_order_relaxed);
+  ret.mPeakWaiting = mPeakWaiting.load(std::memory_order_relaxed);
+  ret.mWaits = mWaits.load(std::memory_order_relaxed);
+  ret.mTimeouts = mTimeouts.load(std::memory_order_relaxed);
+  ret.mRejects = mRejects.load(std::memory_order_relaxed);
+  ret.mDiscards = mDiscards.load(std::memory_order_relaxed);
+  ret.mEvicts = mEvicts.load(std::memory_order_relaxed);
+  return ret;
+}
+
+void
+Bounded::wait_begin() noexcept
+{
+  auto waiting = mWaiting.fetch_add(1, std::memory_order_relaxed) + 1;
+  mWaits.fetch_add(1, std::memory_order_relaxed);
+  raise_peak(mPeakWaiting, waiting);
+  // 与 wake 中的屏障配对：要么我们之后的 take 看到了归还的资源，要么归还者
+  // 看到了我们的登记，从而来加锁唤醒我们
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void
+Bounded::wake() noexcept
+{
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!mWaiting.load(std::memory_order_relaxed))
+    return;
+
+  std::unique_lock lock(mMutex);
+  mCond.notify_all();
+  while (!mHandlers.empty()) {
+    auto here = take();
+    if (!here && mTotal.load(std::memory_order_relaxed) >= mMaxTotal)
+      break;
+    auto handler = std::move(mHandlers.front());
+    mHandlers.pop_front();
+    mWaiting.fetch_sub(1, std::memory_order_relaxed);
+    lock.unlock();
+    bool got = bool(here);
+    handler(std::move(here));
+    if (!got)
+      return; // 一个空出的名额只通知一个回调
+    lock.lock();
+  }
+}
+
+} // namespace My::_Pooled
+
+/**
+ * 一些设计思考：
+ *
+ * 1. shared_from_this 必要吗？
+ *
+ *    似乎是不必要的，因为：
+ *    - 资源上的锁总保证其只会被单个线程占用，不存在多线程间析构的问题
+ *    - 所以，资源的所有权要么是资源池，要么是单个线程，不存在多线程间共享的问题
+ *
+ *    如果不用智能指针呢？当线程移交资源到池时，谁持有资源的所有权？所以必须要用。
+ *
+ *    如果使用 unique_ptr 呢？那么如果资源要在多线程间共享，它岂不是会同时拥有
+ *    shared_ptr 和 unique_ptr 两种所有权？这是肯定不对的。
+ *    - 除非：unique_ptr<shared_ptr<T>>，这样就可以保证资源只有一个所有权
+ *    - 得这么考虑：一般使用这个类的资源都不是线程间共享（所有权）的，所以不会有
+ *      这个问题
+ *
+ *    主要是在 drop 操作中，由于要按序锁定，在从 here 找到 prev 时，需要放弃
+ *    here 的锁， 而从锁被放弃到找到 prev 之间，prev 就可能被释放了，因此必须
+ *    要有一种办法来保证 prev 到下次锁定前不会被释放，这就是 shared_from_this
+ *    的作用。
+ *
+ *    结论：有必要，就是为了 drop 操作服务的
+ *
+ * 2. 要不要有哨兵？
+ *
+ *    哨兵的问题是：
+ *    - 类型不安全，shared_ptr/unique_ptr 在转换时可能会发生切片
+ *
+ *    没有哨兵的问题是：
+ *    - 当池中仅剩的一个资源被丢弃时，怎么更新资源池的头指针？
+ *
+ *    结论：有必要，否则无法实现资源池的头指针更新
+ *
+ *    那要不要有尾哨兵？
+ *    - 有尾哨兵的问题是：尾哨兵的存在会对遍历带来问题，因为遍历器要持有节点上
+ *      的锁 —— 那么 end() 返回的尾哨兵要不要持有锁呢？如果持有锁，那么多线程
+ *      遍历就是不可能的：尾哨兵上会互斥。
+ *
+ *    结论：不能有尾哨兵，因为遍历器不能持有尾哨兵上的锁
+ *
+ * 3. 要不要用 virtual 析构函数？
+ *
+ *    设想这样一种情况：一个线程正在执行 drop，它通过 prev 给前一个结点刚刚
+ *    创建了一个 shared_ptr<Node> 的指针，这个结点就被另一个线程 drop 掉了，
+ *    但因为这个线程持有了 shared_ptr，所以这个结点没有在另一个线程 drop
+ *    时被销毁，而是在 shared_ptr 被销毁时被销毁，这时结点会被切片（以 Node
+ *    析构，而非 T），这问题就大了。
+ *
+ *    此外，virtual 析构函数可以避免模板导致的代码膨胀，因为大部分对象头处理
+ *    的代码都可以放到内部命名空间中。
+ *
+ *    结论：要，因为有哨兵后可能会发生切片。
+ *
+ * 4. 要不要区分 next 和 prev 锁？
+ *
+ *    没必要，因为争用主要发生在申请资源时，仅仅隔离申请和释放不会减轻争用。
+ *
+ * 5. 因为有了析构函数，可以考虑搞成一个 RAII 的资源池，每个结点可以是不同类
+ *    型的资源。需要增加额外的方法：取出下一个指定类型的资源。当然，可以再用
+ *    模板提供一个类型安全的类，它使用静态类型转换避免运行时类型检查。
+ *
+ * 6. 既然 shared_ptr 只是为了 drop，能不能换成更便宜的引用计数？
+ *
+ *    shared_from_this 要经过弱引用：先读再 CAS 增加计数，争用时还要重试；
+ *    释放最后一个引用时还要再减一次弱引用计数。而 drop 所需的只是“固定住
+ *    prev 直到再次锁定”，侵入式计数的一次 fetch_add 就够了。
+ *
+ *    结论：链上的算法与指针类型无关，做成模板，同时提供 Node（shared_ptr）
+ *    和 RcNode（IntrusivePtr）两种节点，后者见 RcPooled。
  */
@@ -1,24 +1,59 @@
 #pragma once
 
+#include "IntrusivePtr.hpp"
 #include "SpinMutex.hpp"
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <mutex>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+/**
+ * @brief 为 1 时在链的桩上统计操作次数、资源数和锁的等待轮数，为 0 时这些
+ * 统计完全不编译，热路径上没有任何额外开销。
+ *
+ * 它改变了桩的布局，整个程序必须一致，通常由 CMake 选项 MY_POOLED_STATS 设置。
+ */
+#ifndef MY_POOLED_STATS
+#define MY_POOLED_STATS 0
+#endif
+
+namespace boost::json {
+class value;
+};
 
 namespace My {
 
+namespace bj = boost::json;
+
 namespace _Pooled {
 
-class Iterator;
-class Stub;
+template<typename N>
+class BasicIterator;
+template<typename N>
+class BasicStub;
+class Stack;
+class Cache;
 
 class Node : public std::enable_shared_from_this<Node>
 {
-  friend class Iterator;
-  friend class Stub;
+  template<typename>
+  friend class BasicIterator;
+  template<typename>
+  friend class BasicStub;
+  friend class Stack;
+  friend class Bounded;
 
 public:
+  using Ptr = std::shared_ptr<Node>;
+
   virtual ~Node() = default; // 为了在共享指针释放时区分节点和桩。
 
   // 所有方法都放到 Stub 类中，避免污染子类的命名空间。
@@ -27,68 +62,218 @@ private:
   // 所有节点和桩串成一个双向的链
   std::shared_ptr<Node> mNext{ nullptr }; // 共享指针是单向的，没有循环引用。
   std::atomic<std::uintptr_t> mPrev{ 0 }; // 最低位用作自旋锁。
+  // 归还到有界池的时刻，在池中时只在持有 mPrev 锁时读取。
+  std::int64_t mStamp{ 0 };
+
+  static Ptr pin(Node& node) noexcept { return node.shared_from_this(); }
+};
+
+/**
+ * @brief 使用侵入式引用计数的节点，引用计数与 mPrev 放在一起。
+ *
+ * 链上的 mNext 持有后继节点的一个引用，取出资源时这个引用直接转交给调用者，
+ * 不像 Node 那样经过控制块，也不需要 shared_from_this 的弱引用检查。
+ */
+class RcNode
+{
+  template<typename>
+  friend class BasicIterator;
+  template<typename>
+  friend class BasicStub;
+
+public:
+  using Ptr = IntrusivePtr<RcNode>;
+
+  RcNode() noexcept = default;
+  RcNode(const RcNode&) noexcept {} // 引用计数和链接都不复制
+  RcNode& operator=(const RcNode&) noexcept { return *this; }
+  virtual ~RcNode() = default;
+
+  friend void intrusive_ptr_add_ref(const RcNode* p) noexcept
+  {
+    p->mRefs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  friend void intrusive_ptr_release(const RcNode* p) noexcept
+  {
+    if (p->mRefs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      delete p;
+  }
+
+  /**
+   * @brief 当前的引用数，只用于调试。
+   */
+  std::size_t use_count() const noexcept
+  {
+    return mRefs.load(std::memory_order_relaxed);
+  }
+
+private:
+  mutable std::atomic<std::size_t> mRefs{ 0 };
+  std::atomic<std::uintptr_t> mPrev{ 0 }; // 最低位用作自旋锁。
+  Ptr mNext;
+
+  static Ptr pin(RcNode& node) noexcept { return Ptr(&node); }
 };
 
-static_assert(alignof(Node) >= 2);
+static_assert(alignof(Node) >= 2 && alignof(RcNode) >= 2);
 using SpinBit = SpinMutex::Bit<std::uintptr_t, 0>;
 
-class Iterator
+/**
+ * @brief 链上操作的统计快照，只有以 MY_POOLED_STATS 编译时才有数据。
+ *
+ * 只统计以桩为起点的操作，从资源出发的静态操作（如 Pool::drop）无从知道
+ * 资源在哪条链上，不计入。
+ */
+struct Counters
+{
+  static constexpr bool kEnabled = MY_POOLED_STATS;
+
+  std::uint64_t mTakes{ 0 };  ///< 取出的资源数
+  std::uint64_t mGives{ 0 };  ///< 放入的资源数
+  std::uint64_t mMisses{ 0 }; ///< 池空而没有取到资源的次数
+  std::uint64_t mDrops{ 0 };  ///< 丢弃的资源数
+  std::uint64_t mLocks{ 0 };  ///< 加锁的次数
+  std::uint64_t mSpins{ 0 };  ///< 加锁时等待的总轮数
+  std::size_t mSize{ 0 };     ///< 当前的资源数
+  std::size_t mPeakSize{ 0 }; ///< 资源数的峰值，合并时是各条链的峰值之和
+
+  /**
+   * @brief 合并另一条链的统计。
+   */
+  Counters& operator+=(const Counters& other) noexcept;
+
+  /**
+   * @brief 平均每次加锁等待的轮数，锁的争用程度主要看它。
+   */
+  double spins_per_lock() const noexcept
+  {
+    return mLocks ? double(mSpins) / mLocks : 0;
+  }
+
+  /**
+   * @brief 导出到 JSON 值对象。
+   */
+  bj::value to_jval() const noexcept(false);
+};
+
+#if MY_POOLED_STATS
+/**
+ * @brief 桩上的计数器，都是宽松的原子量。
+ */
+struct Meter
+{
+  std::atomic<std::uint64_t> mTakes{ 0 };
+  std::atomic<std::uint64_t> mGives{ 0 };
+  std::atomic<std::uint64_t> mMisses{ 0 };
+  std::atomic<std::uint64_t> mDrops{ 0 };
+  std::atomic<std::uint64_t> mLocks{ 0 };
+  std::atomic<std::uint64_t> mSpins{ 0 };
+  std::atomic<std::size_t> mSize{ 0 };
+  std::atomic<std::size_t> mPeakSize{ 0 };
+
+  void took(std::size_t n) noexcept;
+  void gave(std::size_t n) noexcept;
+  void missed() noexcept;
+  void dropped(std::size_t n) noexcept;
+  void locked(std::uint64_t spins) noexcept;
+  Counters snapshot() const noexcept;
+};
+#endif
+
+/**
+ * @brief 链上资源的遍历器，持有当前资源的锁。
+ *
+ * @tparam N 节点类型，Node 或 RcNode。
+ */
+template<typename N>
+class BasicIterator
 {
 public:
-  Iterator() = default;
+  using Ptr = typename N::Ptr;
+
+  BasicIterator() = default;
 
   /**
    * @param p 资源指针，必须未被锁定，遍历器构造完成后会被锁定。
    */
-  Iterator(std::shared_ptr<Node> p) noexcept
+  BasicIterator(Ptr p) noexcept
     : mNode(std::move(p))
   {
     if (mNode)
       SpinBit::lock(mNode->mPrev);
   }
 
-  Iterator(const Iterator&) = delete;
-  Iterator(Iterator&& other)
+  /**
+   * @brief 依次遍历多条链。
+   *
+   * @param stubs 各条链的桩，它们自身不会被遍历到。
+   */
+  BasicIterator(std::vector<Ptr> stubs) noexcept
+    : mRest(std::move(stubs))
+  {
+    next_chain();
+  }
+
+  BasicIterator(const BasicIterator&) = delete;
+  BasicIterator(BasicIterator&& other)
     : mNode()
   {
     swap(*this, other);
   }
 
-  Iterator& operator=(const Iterator&) = delete;
-  Iterator& operator=(Iterator&& other)
+  BasicIterator& operator=(const BasicIterator&) = delete;
+  BasicIterator& operator=(BasicIterator&& other)
   {
     swap(*this, other);
     return *this;
   }
 
-  ~Iterator() noexcept
+  ~BasicIterator() noexcept
   {
     if (mNode)
       SpinBit::unlock(mNode->mPrev);
   }
 
-  friend void swap(Iterator& lhs, Iterator& rhs) noexcept
+  friend void swap(BasicIterator& lhs, BasicIterator& rhs) noexcept
   {
     using std::swap;
     swap(lhs.mNode, rhs.mNode);
+    swap(lhs.mRest, rhs.mRest);
   }
 
   operator bool() const noexcept { return bool(mNode); }
-  Node* operator->() const noexcept { return mNode.get(); }
-  Node& operator*() const noexcept { return *mNode; }
-  Iterator& operator++() noexcept;
+  N* operator->() const noexcept { return mNode.get(); }
+  N& operator*() const noexcept { return *mNode; }
+  BasicIterator& operator++() noexcept;
 
 private:
-  std::shared_ptr<Node> mNode;
+  Ptr mNode;
+  std::vector<Ptr> mRest; ///< 尚未遍历的链的桩，逆序
+
+  /**
+   * @brief 当前链遍历完后，锁定下一条非空链的第一个资源。
+   */
+  void next_chain() noexcept;
 };
 
-class Stub : public Node
+/**
+ * @brief 链的桩，链上的所有操作都是它的静态方法。
+ *
+ * @tparam N 节点类型，Node 或 RcNode。
+ */
+template<typename N>
+class BasicStub : public N
 {
 public:
+  using Ptr = typename N::Ptr;
+  using Iterator = BasicIterator<N>;
+  using Key = std::function<std::int64_t(const N&)>;
+
   /**
    * @brief 检查 here 是否在池中。
    */
-  static bool is_in(const Node& here) noexcept
+  static bool is_in(const N& here) noexcept
   {
     return SpinBit::masked(here.mPrev);
   }
@@ -96,7 +281,7 @@ public:
   /**
    * @brief 检查 here 是否被锁定。
    */
-  static bool is_locked(const Node& here) noexcept
+  static bool is_locked(const N& here) noexcept
   {
     return SpinBit::locked(here.mPrev);
   }
@@ -105,37 +290,55 @@ public:
    * @brief 从池中取出 after 之后的下一个资源，如果池空则返回空指针，
    * 返回的资源未被锁定。
    */
-  static std::shared_ptr<Node> take(Node& after) noexcept;
+  static Ptr take(N& after) noexcept;
 
   /**
    * @brief 从池中取出下一个指定类型的资源，如果没有则返回空指针，
    * 返回的资源未被锁定。
    */
-  static std::shared_ptr<Node> take_if(Node& after,
-                                       const std::type_info& type) noexcept;
+  static Ptr take_if(N& after, const std::type_info& type) noexcept;
 
   /**
    * @brief 向池中放入资源：将 here 插入到 after 之后，here 必须未被锁定。
    */
-  static void give(Node& after, std::shared_ptr<Node> here) noexcept;
+  static void give(N& after, Ptr here) noexcept;
+
+  /**
+   * @brief 按键从大到小的顺序放入资源，键相同的按放入的先后，here 必须未被
+   * 锁定。这需要从 after 开始逐个锁定比较，键应该在资源留在池中期间不变。
+   */
+  static void give_sorted(N& after, Ptr here, const Key& key) noexcept;
+
+  /**
+   * @brief 成批放入资源，等价于依次 give 范围中的每个资源，但只锁定一次
+   * after。范围中的资源都必须不在池中且未被锁定，放入后范围中的指针被移走。
+   */
+  static void give_n(N& after, Ptr* first, Ptr* last) noexcept;
 
   /**
-   * @brief 从池中丢弃一个资源 here，here 必须在池中且未被锁定。
+   * @brief 成批取出 after 之后的至多 n 个资源，只锁定一次 after。
+   *
+   * @param out 至少能容纳 n 个指针。
+   * @return 实际取出的资源数。
+   */
+  static std::size_t take_n(N& after, std::size_t n, Ptr* out) noexcept;
+
+  /**
+   * @brief 从池中丢弃一个资源 here，here 必须未被锁定。
+   *
+   * @return true - 确实从池中移除了 here；false - here 本就不在池中。
    */
-  static void drop(Node& node) noexcept;
+  static bool drop(N& node) noexcept;
 
   /**
    * @brief 丢弃 after 之后的所有资源。
    */
-  static void clear(Node& after) noexcept;
+  static void clear(N& after) noexcept;
 
   /**
    * @brief 从 node 开始遍历池中的剩余资源。
    */
-  static Iterator begin(Node& node) noexcept
-  {
-    return { node.shared_from_this() };
-  }
+  static Iterator begin(N& node) noexcept { return { N::pin(node) }; }
 
   /**
    * @brief 遍历池中的剩余资源结束。
@@ -145,18 +348,18 @@ public:
   /**
    * @brief 统计 node 及之后的资源数量，这会锁定遍历 node 后的所有剩余资源。
    */
-  static std::size_t count(Node& node) noexcept;
+  static std::size_t count(N& node) noexcept;
 
   /**
    * @brief 遍历桩之后的所有资源。
    */
   Iterator begin() noexcept
   {
-    SpinBit::lock(mPrev);
+    SpinBit::lock(this->mPrev);
     Iterator ret;
-    if (mNext)
-      ret = begin(*mNext);
-    SpinBit::unlock(mPrev);
+    if (this->mNext)
+      ret = begin(*this->mNext);
+    SpinBit::unlock(this->mPrev);
     return ret;
   }
 
@@ -165,203 +368,1204 @@ public:
    */
   std::size_t count() noexcept
   {
-    SpinBit::lock(mPrev);
-    auto head = mNext;
-    SpinBit::unlock(mPrev);
+    SpinBit::lock(this->mPrev);
+    auto head = this->mNext;
+    SpinBit::unlock(this->mPrev);
     if (!head)
       return 0;
     return count(*head);
   }
+
+  /**
+   * @brief 以本桩为起点的操作的统计快照，未开启统计时全为 0。
+   */
+  Counters counters() const noexcept
+  {
+#if MY_POOLED_STATS
+    return mMeter.snapshot();
+#else
+    return {};
+#endif
+  }
+
+#if MY_POOLED_STATS
+  Meter mMeter;
+#endif
 };
 
-} // namespace _Pooled
+// 实现都在 Pooled.cpp 中，只为这两种节点实例化
+extern template class BasicIterator<Node>;
+extern template class BasicIterator<RcNode>;
+extern template class BasicStub<Node>;
+extern template class BasicStub<RcNode>;
+
+using Iterator = BasicIterator<Node>;
+using Stub = BasicStub<Node>;
+using RcIterator = BasicIterator<RcNode>;
+using RcStub = BasicStub<RcNode>;
 
 /**
- * @brief 多线程资源池混入类：
- * 1. 允许多个线程并发地插入资源；
- * 2. 允许多个线程并发地申请任一资源，无论资源是哪个线程创建的；
- * 3. 允许遍历所有的资源对象，但不保证遍历时的一致性，例如可能
- *    遍历到最后一个资源对象时，第一个资源对象已经被销毁了。
+ * @brief 池中资源被取出的顺序。
+ */
+enum class Order
+{
+  kLifo,     ///< 后进先出，最近归还的资源最热，对缓存最友好
+  kFifo,     ///< 先进先出，轮流使用所有资源，例如把负载分散到各个后端
+  kPriority, ///< 按用户给出的键从大到小，例如键为最近一次使用的时间
+};
+
+/**
+ * @brief 带每线程弹匣和按类型分链的资源池。
  *
- * 示例：
+ * 全局的资源按动态类型分别挂在各自的链上，take_if 只需找到对应类型的链，
+ * 而不必逐个锁定并比较池中的资源；类型链只增不减，通常只有寥寥几条。
  *
- * ```cpp
- * struct Resource : public Pooled<Resource> {};
- * Resource::Pool pool;
- * pool.give(std::make_shared<Resource>(r));
- * auto resource = pool.take();
- * Resource::Pool::drop(*resource);
- * ```
+ * 每个线程在全局链之前有一条自己的链（弹匣），取出和放入资源时先操作本线程
+ * 的弹匣，弹匣空了再从全局链成批补充，满了再成批退回全局链，于是常见情况下
+ * 只会锁定本线程独占的桩。弹匣中的资源仍然在池中，可以被 drop 和遍历到；
+ * 但一个线程取不到别的线程弹匣中的资源。线程退出时弹匣中的资源退回全局链。
  *
- * @tparam T 资源类型。
+ * 弹匣总是后进先出的，所以其它顺序下不使用弹匣。先进先出时每条类型链有一个
+ * 入口桩，放入的资源先压入入口，取出时出口空了才把入口整个倒过来搬到出口，
+ * 这样不需要维护尾指针，drop 也不必知道资源在哪条链上。顺序只在每条类型链
+ * 之内成立，不同类型的资源之间不保证顺序。
  */
-template<typename T>
-struct Pooled : _Pooled::Node
+class Cache : public std::enable_shared_from_this<Cache>
 {
-  class Iterator;
-  class Pool;
+public:
+  /**
+   * @param capacity 弹匣的容量，为 0 时不使用弹匣。
+   * @param base 资源的基础类型，预先为它建立类型链。
+   * @param order 取出资源的顺序，不是 kLifo 时忽略 capacity。
+   * @param key order 为 kPriority 时资源的键。
+   */
+  Cache(std::size_t capacity,
+        const std::type_info& base,
+        Order order = Order::kLifo,
+        Stub::Key key = {});
+  Cache(const Cache&) = delete;
+  Cache& operator=(const Cache&) = delete;
+  ~Cache() noexcept;
 
-  std::shared_ptr<T> shared_from_this() noexcept
-  {
-    return std::reinterpret_pointer_cast<T>(_Pooled::Node::shared_from_this());
-  }
+  std::shared_ptr<Node> take() noexcept;
+  std::shared_ptr<Node> take_if(const std::type_info& type) noexcept;
+  void give(std::shared_ptr<Node> here) noexcept;
+  void clear() noexcept;
+  Iterator begin() noexcept;
+  std::size_t count() noexcept;
 
-  std::shared_ptr<const T> shared_from_this() const noexcept
-  {
-    return std::reinterpret_pointer_cast<const T>(
-      _Pooled::Node::shared_from_this());
-  }
+  /**
+   * @brief 所有类型链和弹匣的统计之和，弹匣与全局链之间的搬运也计入其中。
+   */
+  Counters counters() noexcept;
 
-  std::weak_ptr<T> weak_from_this() noexcept
-  {
-    return std::reinterpret_pointer_cast<T>(_Pooled::Node::shared_from_this());
-  }
+  /**
+   * @brief 成批放入资源，不经过弹匣，相邻的同类型资源一起放入类型链。
+   */
+  void give_n(std::shared_ptr<Node>* first,
+              std::shared_ptr<Node>* last) noexcept;
 
-  std::weak_ptr<const T> weak_from_this() const noexcept
-  {
-    return std::reinterpret_pointer_cast<const T>(
-      _Pooled::Node::shared_from_this());
-  }
-};
+  /**
+   * @brief 成批取出至多 n 个资源，先取本线程的弹匣，再取全局链。
+   */
+  std::size_t take_n(std::size_t n, std::shared_ptr<Node>* out) noexcept;
 
-template<typename T>
-class Pooled<T>::Iterator : public _Pooled::Iterator
-{
-public:
-  T* operator->() const noexcept
-  {
-    return reinterpret_cast<T*>(_Pooled::Iterator::operator->());
-  }
+  struct Local; ///< 线程本地的弹匣
 
-  T& operator*() const noexcept
+private:
+  /**
+   * @brief 某一类型的全局链。
+   */
+  struct Chain
   {
-    return reinterpret_cast<T&>(_Pooled::Iterator::operator*());
-  }
+    const std::type_info& mType;
+    const std::shared_ptr<Stub> mStub{ std::make_shared<Stub>() };
+    Chain* mNext{ nullptr };
+    std::shared_ptr<Stub> mIn; ///< 先进先出时的入口
+    SpinMutex mShift;          ///< 从入口搬运到出口时加锁
 
-  Iterator& operator++() noexcept
-  {
-    return reinterpret_cast<Iterator&>(_Pooled::Iterator::operator++());
-  }
-};
+    explicit Chain(const std::type_info& type)
+      : mType(type)
+    {
+    }
+  };
+
+  const Order mOrder;
+  const Stub::Key mKey;
+  const std::size_t mCapacity;
+  const std::uint64_t mId; ///< 用于在线程本地查找弹匣，不会重复
+  std::atomic<Chain*> mChains{ nullptr }; ///< 只在头部插入，析构时才释放
+  SpinMutex mMutex;                       ///< 保护 mLocals 和插入 mChains
+  std::vector<std::shared_ptr<Stub>> mLocals; ///< 所有线程的弹匣
 
-/**
- * @brief 多线程资源池，线程安全。
- */
-template<typename T>
-class Pooled<T>::Pool
-{
-public:
   /**
-   * @brief 检查资源是否在池中。
-   *
-   * @return true - 在池中；false - 不在池中。
+   * @brief 当前线程的弹匣，首次使用时注册，失败时返回空指针。
    */
-  static bool is_in(const T& t) noexcept { return _Pooled::Stub::is_in(t); }
+  Local* local() noexcept;
 
   /**
-   * @brief 基于一个池中节点（桩或资源）取出下一个资源，取出的资源会被移除出池。
-   * 该方法是线程安全的，多个线程可以同时调用同一个对象上的该方法。
-   *
-   * @return 下一个资源（未被锁定），如果池空则返回空指针。
+   * @brief 查找类型链，没有则返回空指针。
    */
-  static std::shared_ptr<T> take(T& t) noexcept
-  {
-    return std::reinterpret_pointer_cast<T>(_Pooled::Stub::take(t));
-  }
+  Chain* find(const std::type_info& type) const noexcept;
 
   /**
-   * @brief 取出池中的下一个指定类型的资源，取出的资源会被移除出池。
-   *
-   * @return 下一个指定类型的资源（未被锁定），如果没有则返回空指针。
+   * @brief 查找或建立类型链，内存不足时返回基础类型的链。
    */
-  template<typename U>
-  static std::shared_ptr<U> take_if(T& t) noexcept
-  {
-    return std::reinterpret_pointer_cast<U>(
-      _Pooled::Stub::take_if(t, typeid(U)));
-  }
+  Chain& chain(const std::type_info& type) noexcept;
 
   /**
-   * @brief 归还资源 r，将 r 插入到 t 之后，r 必须不在池中且未被锁定。
-   * 该方法对 r 线程不安全，在同一时刻最多只能有一个线程调用该方法。
-   *
-   * @param t 任何一个池中的节点。
+   * @brief 建立一条类型链，内存不足时抛出异常。
    */
-  static void give(T& t, std::shared_ptr<T> r) noexcept
-  {
-    _Pooled::Stub::give(t, std::reinterpret_pointer_cast<_Pooled::Node>(r));
-  }
+  Chain* make_chain(const std::type_info& type);
 
   /**
-   * @brief 从池中移除一个资源 t，t 必须在池中且未被锁定。
-   * 重复调用该方法时无操作。
+   * @brief 按顺序把资源放入类型链。
    */
-  static void drop(T& t) noexcept { _Pooled::Stub::drop(t); }
+  void put(Chain& c, std::shared_ptr<Node> here) noexcept;
 
   /**
-   * @brief 清空 t 之后的所有资源，t 必须未被锁定。
+   * @brief 按顺序从类型链中取出资源。
    */
-  static void clear(T& t) noexcept { _Pooled::Stub::drop(t); }
+  std::shared_ptr<Node> get(Chain& c) noexcept;
+
+  void put_n(Chain& c,
+             std::shared_ptr<Node>* first,
+             std::shared_ptr<Node>* last) noexcept;
+  std::size_t get_n(Chain& c,
+                    std::size_t n,
+                    std::shared_ptr<Node>* out) noexcept;
 
   /**
-   * @brief 从节点 t 开始遍历池中的剩余资源。
+   * @brief 把入口中的资源搬到出口，调用者持有 c.mShift。
    */
-  static Iterator begin(T& t) noexcept { return { t.shared_from_this() }; }
+  void shift(Chain& c) noexcept;
 
   /**
-   * @brief 遍历池中的剩余资源结束。
+   * @brief 从任意一条非空的类型链中取出资源。
    */
-  static Iterator end() noexcept { return {}; }
+  std::shared_ptr<Node> take_any() noexcept;
+  std::size_t take_any_n(std::size_t n, std::shared_ptr<Node>* out) noexcept;
+
+  void spill(Local& l) noexcept;
+  std::shared_ptr<Node> refill(Local& l) noexcept;
+};
+
+/**
+ * @brief 无锁的资源栈，是 Stub 之外的另一种池实现。
+ *
+ * 资源不直接串成链，而是放在类型稳定的单元里，单元以“下标 + 版本号”的形式
+ * 组成 Treiber 栈，直到栈析构时才释放，因此不存在 ABA 问题和释放后使用。
+ * 资源的 mPrev 指向其所在的单元，丢弃资源时只认领走单元中的资源，留在栈中
+ * 的空单元由之后的 take 顺带回收。
+ */
+class Stack
+{
+public:
+  Stack() = default;
+  Stack(const Stack&) = delete;
+  Stack& operator=(const Stack&) = delete;
+  ~Stack() noexcept;
 
   /**
-   * @brief 对池中的资源进行计数，这会锁定遍历 t 后的所有剩余资源。
+   * @brief 取出栈顶的资源，如果栈空则返回空指针。
    */
-  static std::size_t count(T& t) noexcept { return _Pooled::Stub::count(t); }
+  std::shared_ptr<Node> take() noexcept;
 
-public:
   /**
-   * @see take(Pooled&)
+   * @brief 取出离栈顶最近的指定类型的资源，如果没有则返回空指针。
    */
-  std::shared_ptr<T> take() noexcept
-  {
-    return std::reinterpret_pointer_cast<T>(_Pooled::Stub::take(*mStub));
-  }
+  std::shared_ptr<Node> take_if(const std::type_info& type) noexcept;
 
   /**
-   * @see take_if(Pooled&)
+   * @brief 放入资源 here，here 必须不在任何池中。
+   *
+   * @throw std::bad_alloc 需要分配新的单元但内存不足。
    */
-  template<typename U>
-  std::shared_ptr<U> take_if() noexcept
-  {
-    return std::reinterpret_pointer_cast<U>(
-      _Pooled::Stub::take_if(*mStub, typeid(U)));
-  }
+  void give(std::shared_ptr<Node> here);
 
   /**
-   * @see give(Pooled&, std::shared_ptr<T>)
+   * @brief 从池中丢弃一个资源 here，重复调用时无操作。
    */
-  void give(std::shared_ptr<T> r) noexcept
-  {
-    _Pooled::Stub::give(*mStub, std::move(r));
-  }
+  static void drop(Node& here) noexcept;
 
   /**
-   * @see drop(Pooled&)
+   * @brief 丢弃所有资源。
    */
-  void clear() noexcept { _Pooled::Stub::clear(*mStub); }
+  void clear() noexcept;
 
   /**
-   * @see begin(const Pooled&)
+   * @brief 复制一份当前池中资源的快照，不保证一致性。
    */
-  Iterator begin() noexcept { return { mStub->begin() }; }
+  std::vector<std::shared_ptr<Node>> snapshot();
 
   /**
-   * @see count(const Pooled&)
+   * @brief 统计池中的资源数量，不保证一致性。
    */
-  std::size_t count() noexcept { return mStub->count(); }
+  std::size_t count() noexcept;
+
+private:
+  struct Cell;
+
+  /// 第 k 块有 kChunkBase << k 个单元，32 块足以容纳 32 位下标。
+  static constexpr std::uint32_t kChunkBase = 64;
+  static constexpr unsigned kChunks = 32;
+
+  std::atomic<std::uint64_t> mHead{ 0 }; ///< 高 32 位是版本号，低 32 位是下标 + 1
+  std::atomic<std::uint64_t> mFree{ 0 }; ///< 空闲单元栈，格式同 mHead
+  std::atomic<Cell*> mChunks[kChunks]{};
+  std::atomic<std::uint32_t> mCells{ 0 }; ///< 已分配的单元数
+  SpinMutex mGrow;                        ///< 分配新块时加锁
+
+  Cell& cell(std::uint32_t index) const noexcept;
+  Cell* pop(std::atomic<std::uint64_t>& head) noexcept;
+  void push(std::atomic<std::uint64_t>& head, Cell& cell) noexcept;
+  Cell& acquire();
+  void release(Cell& cell) noexcept;
+};
+
+/**
+ * @brief 分片的资源池，每个分片一个独占缓存行的桩。
+ *
+ * 每个线程固定属于一个分片，取出和放入资源时先操作自己的分片，自己的分片空了
+ * 才从随机的一个分片开始依次窃取别的分片。与弹匣不同，分片中的资源随时可以被
+ * 别的线程窃取，没有容量限制也不需要在线程退出时退回。
+ */
+class Shards
+{
+public:
+  /**
+   * @param shards 分片数，会向上取整到 2 的幂，0 表示取 CPU 数。
+   */
+  explicit Shards(std::size_t shards = 0);
+
+  std::shared_ptr<Node> take() noexcept;
+  std::shared_ptr<Node> take_if(const std::type_info& type) noexcept;
+  void give(std::shared_ptr<Node> here) noexcept;
+  void clear() noexcept;
+  Iterator begin() noexcept;
+  std::size_t count() noexcept;
+  Counters counters() const noexcept;
+
+  /**
+   * @brief 分片数。
+   */
+  std::size_t size() const noexcept { return mMask + 1; }
+
+private:
+  /**
+   * @brief 对齐到缓存行，避免不同分片的桩之间的伪共享。
+   */
+  struct alignas(64) Shard : Stub
+  {};
+
+  const std::size_t mMask;
+  std::vector<std::shared_ptr<Stub>> mShards;
+
+  /**
+   * @brief 依次在各个分片上调用 f，直到 f 取到资源：先是本线程的分片，
+   * 然后从随机的一个分片开始依次窃取。
+   */
+  template<typename F>
+  std::shared_ptr<Node> steal(F&& f) noexcept;
+};
+
+/**
+ * @brief 有容量限制的资源池。
+ *
+ * 存活的资源总数（池中空闲的加上被借出的）不超过 max_total，由 reserve 和
+ * unreserve 计数，资源析构时归还名额；池中空闲的资源不超过 max_idle，多出的
+ * 资源在 give 时直接释放。资源都挂在同一条全局链上而不经过弹匣，否则等待者
+ * 取不到别的线程归还到其弹匣中的资源。
+ *
+ * 取不到资源又没有名额时可以等待：同步的 take_until 在条件变量上等待，异步的
+ * async_take 把回调排队。没有等待者时 give 只多一次内存屏障，不加互斥锁。
+ */
+class Bounded
+{
+public:
+  using Clock = std::chrono::steady_clock;
+  using Handler = std::function<void(std::shared_ptr<Node>)>;
+  using Check = std::function<bool(Node&)>;
+
+  /**
+   * @brief 统计数据，峰值是自创建以来的高水位。
+   */
+  struct Stats
+  {
+    std::size_t mIdle{ 0 };        ///< 池中空闲的资源数
+    std::size_t mTotal{ 0 };       ///< 存活的资源总数
+    std::size_t mWaiting{ 0 };     ///< 正在等待的调用者数
+    std::size_t mPeakIdle{ 0 };    ///< 空闲资源数的峰值
+    std::size_t mPeakTotal{ 0 };   ///< 资源总数的峰值
+    std::size_t mPeakWaiting{ 0 }; ///< 等待者数的峰值
+    std::uint64_t mWaits{ 0 };     ///< 进入等待的次数
+    std::uint64_t mTimeouts{ 0 };  ///< 等待超时的次数
+    std::uint64_t mRejects{ 0 };   ///< 因达到 max_total 而拒绝创建的次数
+    std::uint64_t mDiscards{ 0 };  ///< 因超过 max_idle 而释放的资源数
+    std::uint64_t mEvicts{ 0 };    ///< 因空闲超时或检查失败而逐出的资源数
+  };
+
+  Bounded(std::size_t maxIdle, std::size_t maxTotal);
+  Bounded(const Bounded&) = delete;
+  Bounded& operator=(const Bounded&) = delete;
+
+  /**
+   * @brief 析构时以空指针调用所有仍在排队的回调。
+   */
+  ~Bounded() noexcept;
+
+  const std::size_t mMaxIdle;
+  const std::size_t mMaxTotal;
+
+  /**
+   * @brief 占用一个名额以创建新资源，达到 max_total 时返回 false。
+   */
+  bool reserve() noexcept;
+
+  /**
+   * @brief 归还一个名额，在资源析构或创建失败时调用。
+   */
+  void unreserve() noexcept;
+
+  std::shared_ptr<Node> take() noexcept;
+  std::shared_ptr<Node> take_if(const std::type_info& type) noexcept;
+
+  /**
+   * @brief 取出资源，池空且没有名额时等待直到 deadline。
+   *
+   * @return 资源；或者空指针，表示超时，或者有了空余的名额可以再尝试创建。
+   */
+  std::shared_ptr<Node> take_until(Clock::time_point deadline) noexcept;
+
+  /**
+   * @brief 异步地取出资源，参数的含义同 take_until 的返回值。
+   *
+   * 能立即得到结果时在当前线程中调用 handler，否则 handler 排队，之后在调用
+   * give 或释放资源的线程中被调用，因此 handler 应该尽快返回且不抛出异常，
+   * 例如只把续程投递到自己的执行器上。
+   */
+  void async_take(Handler handler);
+
+  void give(std::shared_ptr<Node> here) noexcept;
+
+  /**
+   * @brief 从池中丢弃一个资源 here，here 必须是本池的资源，重复调用时无操作。
+   */
+  void drop(Node& here) noexcept;
+
+  /**
+   * @brief 一趟遍历逐出所有空闲超过 ttl 的资源，然后把剩下的资源中最老的
+   * checks 个暂时移出池检查，check 返回 false 的也逐出。
+   *
+   * give 总是插在链头，所以链从头到尾是从新到老的，遍历时记住最后的几个
+   * 即可。检查期间资源不在池中，check 可以独占地使用它；通过检查的资源
+   * 保留原来的时刻，按时刻插回链中相应的位置，链仍然从新到老。
+   *
+   * @return 逐出的资源数。
+   */
+  std::size_t sweep(Clock::duration ttl,
+                    const Check& check = {},
+                    std::size_t checks = 0);
+
+  void clear() noexcept;
+  Iterator begin() noexcept { return mStub->begin(); }
+  std::size_t count() noexcept { return mStub->count(); }
+  Counters counters() const noexcept { return mStub->counters(); }
+  Stats stats() const noexcept;
+
+private:
+  const std::shared_ptr<Stub> mStub{ std::make_shared<Stub>() };
+
+  std::atomic<std::size_t> mIdle{ 0 };
+  std::atomic<std::size_t> mTotal{ 0 };
+  std::atomic<std::size_t> mWaiting{ 0 };
+  std::atomic<std::size_t> mPeakIdle{ 0 };
+  std::atomic<std::size_t> mPeakTotal{ 0 };
+  std::atomic<std::size_t> mPeakWaiting{ 0 };
+  std::atomic<std::uint64_t> mWaits{ 0 };
+  std::atomic<std::uint64_t> mTimeouts{ 0 };
+  std::atomic<std::uint64_t> mRejects{ 0 };
+  std::atomic<std::uint64_t> mDiscards{ 0 };
+  std::atomic<std::uint64_t> mEvicts{ 0 };
+
+  std::mutex mMutex; ///< 保护 mHandlers，等待者在其上登记
+  std::condition_variable mCond;
+  std::deque<Handler> mHandlers;
+
+  /**
+   * @brief 在持有 mMutex 时登记一个等待者。
+   */
+  void wait_begin() noexcept;
+
+  /**
+   * @brief 有资源归还或名额空出后，唤醒同步等待者并派发排队的回调。
+   */
+  void wake() noexcept;
+};
+
+} // namespace _Pooled
+
+/**
+ * @brief 多线程资源池混入类：
+ * 1. 允许多个线程并发地插入资源；
+ * 2. 允许多个线程并发地申请任一资源，无论资源是哪个线程创建的（开启每线程
+ *    弹匣的 Pool 除外，见 Pool 的说明）；
+ * 3. 允许遍历所有的资源对象，但不保证遍历时的一致性，例如可能
+ *    遍历到最后一个资源对象时，第一个资源对象已经被销毁了。
+ *
+ * 示例：
+ *
+ * ```cpp
+ * struct Resource : public Pooled<Resource> {};
+ * Resource::Pool pool;
+ * pool.give(std::make_shared<Resource>(r));
+ * auto resource = pool.take();
+ * Resource::Pool::drop(*resource);
+ * ```
+ *
+ * @tparam T 资源类型。
+ */
+template<typename T>
+struct Pooled : _Pooled::Node
+{
+  class Iterator;
+  class Pool;
+  class LockFreePool;
+  class BoundedPool;
+  class ShardedPool;
+
+  std::shared_ptr<T> shared_from_this() noexcept
+  {
+    return std::reinterpret_pointer_cast<T>(_Pooled::Node::shared_from_this());
+  }
+
+  std::shared_ptr<const T> shared_from_this() const noexcept
+  {
+    return std::reinterpret_pointer_cast<const T>(
+      _Pooled::Node::shared_from_this());
+  }
+
+  std::weak_ptr<T> weak_from_this() noexcept
+  {
+    return std::reinterpret_pointer_cast<T>(_Pooled::Node::shared_from_this());
+  }
+
+  std::weak_ptr<const T> weak_from_this() const noexcept
+  {
+    return std::reinterpret_pointer_cast<const T>(
+      _Pooled::Node::shared_from_this());
+  }
+};
+
+template<typename T>
+class Pooled<T>::Iterator : public _Pooled::Iterator
+{
+public:
+  T* operator->() const noexcept
+  {
+    return reinterpret_cast<T*>(_Pooled::Iterator::operator->());
+  }
+
+  T& operator*() const noexcept
+  {
+    return reinterpret_cast<T&>(_Pooled::Iterator::operator*());
+  }
+
+  Iterator& operator++() noexcept
+  {
+    return reinterpret_cast<Iterator&>(_Pooled::Iterator::operator++());
+  }
+};
+
+/**
+ * @brief 多线程资源池，线程安全。
+ *
+ * 实例方法默认后进先出地直接存取全局链，也可以选择其它的顺序，见
+ * _Pooled::Cache。构造时指定弹匣容量可以开启每线程的弹匣，减少多线程争用，
+ * 代价是一个线程取不到别的线程弹匣中的资源，即使池不为空 take 也可能返回空。
+ */
+template<typename T>
+class Pooled<T>::Pool
+{
+public:
+  using Order = _Pooled::Order;
+  using Counters = _Pooled::Counters;
+  using Key = std::function<std::int64_t(const T&)>;
+
+  /**
+   * @brief 建议的弹匣容量。
+   */
+  static constexpr std::size_t kMagazine = 16;
+
+  /**
+   * @param magazine 每线程弹匣的容量，为 0 时所有线程直接存取全局链。
+   */
+  explicit Pool(std::size_t magazine = 0)
+    : mCache(std::make_shared<_Pooled::Cache>(magazine, typeid(T)))
+  {
+  }
+
+  /**
+   * @param order 取出资源的顺序，不使用弹匣。
+   * @param key 资源的键，order 为 kPriority 时必须提供，键大的先被取出。
+   */
+  explicit Pool(Order order, Key key = {})
+    : mCache(std::make_shared<_Pooled::Cache>(0,
+                                              typeid(T),
+                                              order,
+                                              node_key(std::move(key))))
+  {
+  }
+
+public:
+  /**
+   * @brief 检查资源是否在池中。
+   *
+   * @return true - 在池中；false - 不在池中。
+   */
+  static bool is_in(const T& t) noexcept { return _Pooled::Stub::is_in(t); }
+
+  /**
+   * @brief 基于一个池中节点（桩或资源）取出下一个资源，取出的资源会被移除出池。
+   * 该方法是线程安全的，多个线程可以同时调用同一个对象上的该方法。
+   *
+   * @return 下一个资源（未被锁定），如果池空则返回空指针。
+   */
+  static std::shared_ptr<T> take(T& t) noexcept
+  {
+    return std::reinterpret_pointer_cast<T>(_Pooled::Stub::take(t));
+  }
+
+  /**
+   * @brief 取出池中的下一个指定类型的资源，取出的资源会被移除出池。
+   *
+   * @return 下一个指定类型的资源（未被锁定），如果没有则返回空指针。
+   */
+  template<typename U>
+  static std::shared_ptr<U> take_if(T& t) noexcept
+  {
+    return std::reinterpret_pointer_cast<U>(
+      _Pooled::Stub::take_if(t, typeid(U)));
+  }
+
+  /**
+   * @brief 归还资源 r，将 r 插入到 t 之后，r 必须不在池中且未被锁定。
+   * 该方法对 r 线程不安全，在同一时刻最多只能有一个线程调用该方法。
+   *
+   * @param t 任何一个池中的节点。
+   */
+  static void give(T& t, std::shared_ptr<T> r) noexcept
+  {
+    _Pooled::Stub::give(t, std::reinterpret_pointer_cast<_Pooled::Node>(r));
+  }
+
+  /**
+   * @brief 从池中移除一个资源 t，t 必须在池中且未被锁定。
+   * 重复调用该方法时无操作。
+   */
+  static void drop(T& t) noexcept { _Pooled::Stub::drop(t); }
+
+  /**
+   * @brief 清空 t 之后的所有资源，t 必须未被锁定。
+   */
+  static void clear(T& t) noexcept { _Pooled::Stub::drop(t); }
+
+  /**
+   * @brief 从节点 t 开始遍历池中的剩余资源。
+   */
+  static Iterator begin(T& t) noexcept { return { t.shared_from_this() }; }
+
+  /**
+   * @brief 遍历池中的剩余资源结束。
+   */
+  static Iterator end() noexcept { return {}; }
+
+  /**
+   * @brief 对池中的资源进行计数，这会锁定遍历 t 后的所有剩余资源。
+   */
+  static std::size_t count(T& t) noexcept { return _Pooled::Stub::count(t); }
+
+public:
+  /**
+   * @see take(Pooled&)
+   */
+  std::shared_ptr<T> take() noexcept
+  {
+    return std::reinterpret_pointer_cast<T>(mCache->take());
+  }
+
+  /**
+   * @see take_if(Pooled&)
+   */
+  template<typename U>
+  std::shared_ptr<U> take_if() noexcept
+  {
+    return std::reinterpret_pointer_cast<U>(mCache->take_if(typeid(U)));
+  }
+
+  /**
+   * @see give(Pooled&, std::shared_ptr<T>)
+   */
+  void give(std::shared_ptr<T> r) noexcept { mCache->give(std::move(r)); }
+
+  /**
+   * @brief 成批归还一组资源，直接放入全局链而不经过弹匣，每段相邻的同类型
+   * 资源只锁定一次类型链的桩，适合预热资源池。
+   *
+   * @throw std::bad_alloc 内存不足。
+   */
+  template<typename Range>
+  void give_n(Range&& range)
+  {
+    std::vector<std::shared_ptr<_Pooled::Node>> nodes;
+    for (auto& r : range) {
+      if constexpr (std::is_lvalue_reference_v<Range>)
+        nodes.emplace_back(r);
+      else
+        nodes.emplace_back(std::move(r));
+    }
+    mCache->give_n(nodes.data(), nodes.data() + nodes.size());
+  }
+
+  /**
+   * @brief 成批取出至多 n 个资源依次写入 out，每条链只锁定一次桩，适合回收。
+   *
+   * @return 实际取出的资源数。
+   * @throw std::bad_alloc 内存不足。
+   */
+  template<typename OutputIt>
+  std::size_t take_n(std::size_t n, OutputIt out)
+  {
+    std::vector<std::shared_ptr<_Pooled::Node>> nodes(n);
+    auto cnt = mCache->take_n(n, nodes.data());
+    for (std::size_t i = 0; i < cnt; ++i)
+      *out++ = std::reinterpret_pointer_cast<T>(std::move(nodes[i]));
+    return cnt;
+  }
+
+  /**
+   * @brief 清空全局链和所有弹匣中的资源。
+   */
+  void clear() noexcept { mCache->clear(); }
+
+  /**
+   * @brief 遍历全局链和所有弹匣中的资源。
+   */
+  Iterator begin() noexcept { return { mCache->begin() }; }
+
+  /**
+   * @brief 对全局链和所有弹匣中的资源进行计数。
+   */
+  std::size_t count() noexcept { return mCache->count(); }
+
+  /**
+   * @brief 链上操作的统计，需要以 MY_POOLED_STATS 编译，见 _Pooled::Counters。
+   */
+  Counters counters() const noexcept { return mCache->counters(); }
+
+private:
+  std::shared_ptr<_Pooled::Cache> mCache;
+
+  static _Pooled::Stub::Key node_key(Key key)
+  {
+    if (!key)
+      return {};
+    return [key = std::move(key)](const _Pooled::Node& node) {
+      return key(static_cast<const T&>(node));
+    };
+  }
+};
+
+/**
+ * @brief 无锁的多线程资源池，线程安全。
+ *
+ * 与 Pool 的区别在于：取出与放入都不加锁，按后进先出的顺序；只能从池头取出
+ * 资源；遍历改为复制一份快照。适合多个线程频繁地争用同一个池的场景。
+ */
+template<typename T>
+class Pooled<T>::LockFreePool
+{
+public:
+  /**
+   * @see Pool::is_in(const T&)
+   */
+  static bool is_in(const T& t) noexcept { return _Pooled::Stub::is_in(t); }
+
+  /**
+   * @brief 从池中移除一个资源 t，重复调用该方法时无操作。
+   */
+  static void drop(T& t) noexcept { _Pooled::Stack::drop(t); }
+
+public:
+  /**
+   * @brief 取出最近放入的资源，如果池空则返回空指针。
+   */
+  std::shared_ptr<T> take() noexcept
+  {
+    return std::reinterpret_pointer_cast<T>(mStack.take());
+  }
+
+  /**
+   * @brief 取出最近放入的指定类型的资源，如果没有则返回空指针。
+   */
+  template<typename U>
+  std::shared_ptr<U> take_if() noexcept
+  {
+    return std::reinterpret_pointer_cast<U>(mStack.take_if(typeid(U)));
+  }
+
+  /**
+   * @brief 归还资源 r，r 必须不在池中。
+   */
+  void give(std::shared_ptr<T> r)
+  {
+    mStack.give(std::reinterpret_pointer_cast<_Pooled::Node>(std::move(r)));
+  }
+
+  /**
+   * @brief 清空池中的所有资源。
+   */
+  void clear() noexcept { mStack.clear(); }
+
+  /**
+   * @brief 复制一份池中资源的快照。
+   */
+  std::vector<std::shared_ptr<T>> snapshot()
+  {
+    std::vector<std::shared_ptr<T>> ret;
+    for (auto& i : mStack.snapshot())
+      ret.emplace_back(std::reinterpret_pointer_cast<T>(std::move(i)));
+    return ret;
+  }
+
+  /**
+   * @brief 对池中的资源进行计数。
+   */
+  std::size_t count() noexcept { return mStack.count(); }
+
+private:
+  _Pooled::Stack mStack;
+};
+
+/**
+ * @brief 分片的多线程资源池，线程安全，见 _Pooled::Shards。
+ *
+ * 与 Pool 的区别在于：全局没有单一的桩，多个线程同时存取时分散在各个分片上；
+ * 不区分类型，take_if 要在各分片中逐个比较。
+ */
+template<typename T>
+class Pooled<T>::ShardedPool
+{
+public:
+  using Counters = _Pooled::Counters;
+
+  /**
+   * @param shards 分片数，会向上取整到 2 的幂，0 表示取 CPU 数。
+   */
+  explicit ShardedPool(std::size_t shards = 0)
+    : mShards(shards)
+  {
+  }
+
+  /**
+   * @see Pool::is_in(const T&)
+   */
+  static bool is_in(const T& t) noexcept { return _Pooled::Stub::is_in(t); }
+
+  /**
+   * @brief 从池中移除一个资源 t，无论它在哪个分片，重复调用时无操作。
+   */
+  static void drop(T& t) noexcept { _Pooled::Stub::drop(t); }
+
+public:
+  /**
+   * @brief 取出一个资源，先取本线程的分片，再窃取别的分片，池空时返回空指针。
+   */
+  std::shared_ptr<T> take() noexcept
+  {
+    return std::reinterpret_pointer_cast<T>(mShards.take());
+  }
+
+  /**
+   * @brief 取出一个指定类型的资源，如果没有则返回空指针。
+   */
+  template<typename U>
+  std::shared_ptr<U> take_if() noexcept
+  {
+    return std::reinterpret_pointer_cast<U>(mShards.take_if(typeid(U)));
+  }
+
+  /**
+   * @brief 归还资源 r 到本线程的分片，r 必须不在池中。
+   */
+  void give(std::shared_ptr<T> r) noexcept
+  {
+    mShards.give(std::reinterpret_pointer_cast<_Pooled::Node>(std::move(r)));
+  }
+
+  /**
+   * @brief 清空所有分片中的资源。
+   */
+  void clear() noexcept { mShards.clear(); }
+
+  /**
+   * @brief 遍历所有分片中的资源。
+   */
+  Iterator begin() noexcept { return { mShards.begin() }; }
+
+  /**
+   * @brief 遍历池中的资源结束。
+   */
+  static Iterator end() noexcept { return {}; }
+
+  /**
+   * @brief 对所有分片中的资源进行计数。
+   */
+  std::size_t count() noexcept { return mShards.count(); }
+
+  /**
+   * @brief 所有分片的统计之和，见 _Pooled::Counters。
+   */
+  Counters counters() const noexcept { return mShards.counters(); }
+
+  /**
+   * @brief 分片数。
+   */
+  std::size_t shards() const noexcept { return mShards.size(); }
+
+private:
+  _Pooled::Shards mShards;
+};
+
+/**
+ * @brief 有容量限制的多线程资源池，线程安全，见 _Pooled::Bounded。
+ *
+ * 资源必须经由 make 创建才会计入总数。典型用法：
+ *
+ * ```cpp
+ * Resource::BoundedPool pool(4, 16);
+ * auto r = pool.take();
+ * if (!r)
+ *   r = pool.make();
+ * if (!r)
+ *   r = pool.take_for(std::chrono::seconds(1));
+ * ```
+ */
+template<typename T>
+class Pooled<T>::BoundedPool
+{
+public:
+  using Stats = _Pooled::Bounded::Stats;
+  using Counters = _Pooled::Counters;
+
+  /**
+   * @brief 表示不限制的容量。
+   */
+  static constexpr std::size_t kUnlimited = SIZE_MAX;
+
+  /**
+   * @param maxIdle 池中空闲资源数的上限。
+   * @param maxTotal 存活资源总数的上限。
+   */
+  explicit BoundedPool(std::size_t maxIdle = kUnlimited,
+                       std::size_t maxTotal = kUnlimited)
+    : mBounded(std::make_shared<_Pooled::Bounded>(maxIdle, maxTotal))
+  {
+  }
+
+  std::size_t max_idle() const noexcept { return mBounded->mMaxIdle; }
+  std::size_t max_total() const noexcept { return mBounded->mMaxTotal; }
+
+  /**
+   * @see Pool::is_in(const T&)
+   */
+  static bool is_in(const T& t) noexcept { return _Pooled::Stub::is_in(t); }
+
+public:
+  /**
+   * @brief 创建一个计入总数的资源，资源析构时归还名额。
+   *
+   * @return 新资源，如果总数已达到上限则返回空指针。
+   */
+  template<typename U = T, typename... Args>
+  std::shared_ptr<U> make(Args&&... args)
+  {
+    if (!mBounded->reserve())
+      return nullptr;
+    U* p;
+    try {
+      p = new U(std::forward<Args>(args)...);
+    } catch (...) {
+      mBounded->unreserve();
+      throw;
+    }
+    // 如果分配控制块失败，shared_ptr 会调用删除器，名额也就归还了
+    return std::shared_ptr<U>(p, Deleter{ mBounded });
+  }
+
+  /**
+   * @brief 取出一个空闲的资源，如果池空则返回空指针。
+   */
+  std::shared_ptr<T> take() noexcept
+  {
+    return std::reinterpret_pointer_cast<T>(mBounded->take());
+  }
+
+  /**
+   * @see Pool::take_if()
+   */
+  template<typename U>
+  std::shared_ptr<U> take_if() noexcept
+  {
+    return std::reinterpret_pointer_cast<U>(mBounded->take_if(typeid(U)));
+  }
+
+  /**
+   * @brief 取出一个资源，池空且总数已达上限时等待别人归还。
+   *
+   * @return 资源；或者空指针，表示超时，或者有了空余的名额，可以再尝试 make。
+   */
+  template<typename Rep, typename Period>
+  std::shared_ptr<T> take_for(
+    const std::chrono::duration<Rep, Period>& timeout) noexcept
+  {
+    return take_until(_Pooled::Bounded::Clock::now() + timeout);
+  }
+
+  /**
+   * @see take_for
+   */
+  std::shared_ptr<T> take_until(
+    _Pooled::Bounded::Clock::time_point deadline) noexcept
+  {
+    return std::reinterpret_pointer_cast<T>(mBounded->take_until(deadline));
+  }
+
+  /**
+   * @brief 异步地取出资源，handler 的参数含义同 take_for 的返回值。
+   *
+   * handler 可能在当前线程中立即被调用，也可能之后在归还资源的线程中被调用，
+   * 因此应该尽快返回且不抛出异常。池析构时以空指针调用仍在排队的 handler。
+   */
+  template<typename Handler>
+  void async_take(Handler&& handler)
+  {
+    mBounded->async_take(
+      [handler = std::forward<Handler>(handler)](
+        std::shared_ptr<_Pooled::Node> here) mutable {
+        handler(std::reinterpret_pointer_cast<T>(std::move(here)));
+      });
+  }
+
+  /**
+   * @brief 归还资源 r，r 必须不在池中。如果有等待者则直接交给等待者，否则
+   * 空闲资源数超过上限时释放 r。
+   */
+  void give(std::shared_ptr<T> r) noexcept
+  {
+    mBounded->give(std::reinterpret_pointer_cast<_Pooled::Node>(std::move(r)));
+  }
+
+  /**
+   * @brief 从池中移除一个资源 t，重复调用该方法时无操作。
+   *
+   * 与 Pool 不同，这个方法不是静态的，因为要更新空闲资源的计数。
+   */
+  void drop(T& t) noexcept { mBounded->drop(t); }
+
+  /**
+   * @brief 逐出空闲超过 ttl 的资源，并检查剩下的资源中最老的 checks 个。
+   *
+   * 池本身不带计时器，由调用者定期调用，一个周期性的清扫代替每个空闲资源
+   * 各自的计时器。
+   *
+   * @param ttl 空闲时间的上限，从资源归还时算起。
+   * @param check 健康检查，调用时资源不在池中，返回 false 的资源被逐出。
+   * @param checks 每次检查的资源数。
+   * @return 逐出的资源数。
+   */
+  template<typename Rep, typename Period>
+  std::size_t sweep(const std::chrono::duration<Rep, Period>& ttl,
+                    std::function<bool(T&)> check = {},
+                    std::size_t checks = 0)
+  {
+    _Pooled::Bounded::Check nodeCheck;
+    if (check)
+      nodeCheck = [&check](_Pooled::Node& n) {
+        return check(static_cast<T&>(n));
+      };
+    return mBounded->sweep(
+      std::chrono::duration_cast<_Pooled::Bounded::Clock::duration>(ttl),
+      nodeCheck,
+      checks);
+  }
+
+  /**
+   * @brief 清空池中的所有资源。
+   */
+  void clear() noexcept { mBounded->clear(); }
+
+  /**
+   * @brief 遍历池中的资源。
+   */
+  Iterator begin() noexcept { return { mBounded->begin() }; }
+
+  /**
+   * @brief 对池中的资源进行计数。
+   */
+  std::size_t count() noexcept { return mBounded->count(); }
+
+  /**
+   * @brief 获取当前的统计数据和高水位。
+   */
+  Stats stats() const noexcept { return mBounded->stats(); }
+
+  /**
+   * @brief 链上操作的统计，见 _Pooled::Counters。
+   */
+  Counters counters() const noexcept { return mBounded->counters(); }
+
+private:
+  /**
+   * @brief 释放资源并归还名额，池已经析构时只释放资源。
+   */
+  struct Deleter
+  {
+    std::weak_ptr<_Pooled::Bounded> mBounded;
+
+    void operator()(T* p) const noexcept
+    {
+      delete p;
+      if (auto bounded = mBounded.lock())
+        bounded->unreserve();
+    }
+  };
+
+  std::shared_ptr<_Pooled::Bounded> mBounded;
+};
+
+/**
+ * @brief 使用侵入式引用计数的多线程资源池混入类。
+ *
+ * 用法与 Pooled 相同，但资源由 IntrusivePtr 而不是 std::shared_ptr 持有：
+ * 引用计数就在资源对象里，固定引用时是一次 fetch_add 而不是弱引用的 CAS
+ * 循环，释放时也不必再检查控制块的弱引用计数。池中的操作不涉及每线程弹匣。
+ *
+ * 示例：
+ *
+ * ```cpp
+ * struct Resource : public RcPooled<Resource> {};
+ * Resource::Pool pool;
+ * pool.give(make_intrusive<Resource>());
+ * auto resource = pool.take();
+ * Resource::Pool::drop(*resource);
+ * ```
+ *
+ * @tparam T 资源类型。
+ */
+template<typename T>
+struct RcPooled : _Pooled::RcNode
+{
+  class Iterator;
+  class Pool;
+
+  IntrusivePtr<T> ptr_from_this() noexcept
+  {
+    return IntrusivePtr<T>(static_cast<T*>(this));
+  }
+
+  IntrusivePtr<const T> ptr_from_this() const noexcept
+  {
+    return IntrusivePtr<const T>(static_cast<const T*>(this));
+  }
+};
+
+template<typename T>
+class RcPooled<T>::Iterator : public _Pooled::RcIterator
+{
+public:
+  T* operator->() const noexcept
+  {
+    return static_cast<T*>(_Pooled::RcIterator::operator->());
+  }
+
+  T& operator*() const noexcept
+  {
+    return static_cast<T&>(_Pooled::RcIterator::operator*());
+  }
+
+  Iterator& operator++() noexcept
+  {
+    return static_cast<Iterator&>(_Pooled::RcIterator::operator++());
+  }
+};
+
+/**
+ * @brief 侵入式引用计数的多线程资源池，线程安全，方法的语义同 Pooled::Pool。
+ */
+template<typename T>
+class RcPooled<T>::Pool
+{
+public:
+  static bool is_in(const T& t) noexcept { return _Pooled::RcStub::is_in(t); }
+
+  static IntrusivePtr<T> take(T& t) noexcept
+  {
+    return static_pointer_cast<T>(_Pooled::RcStub::take(t));
+  }
+
+  template<typename U>
+  static IntrusivePtr<U> take_if(T& t) noexcept
+  {
+    return static_pointer_cast<U>(_Pooled::RcStub::take_if(t, typeid(U)));
+  }
+
+  static void give(T& t, IntrusivePtr<T> r) noexcept
+  {
+    _Pooled::RcStub::give(t, std::move(r));
+  }
+
+  static void drop(T& t) noexcept { _Pooled::RcStub::drop(t); }
+
+  static void clear(T& t) noexcept { _Pooled::RcStub::clear(t); }
+
+  static Iterator begin(T& t) noexcept { return { t.ptr_from_this() }; }
+
+  static Iterator end() noexcept { return {}; }
+
+  static std::size_t count(T& t) noexcept { return _Pooled::RcStub::count(t); }
+
+public:
+  IntrusivePtr<T> take() noexcept
+  {
+    return static_pointer_cast<T>(_Pooled::RcStub::take(*mStub));
+  }
+
+  template<typename U>
+  IntrusivePtr<U> take_if() noexcept
+  {
+    return static_pointer_cast<U>(
+      _Pooled::RcStub::take_if(*mStub, typeid(U)));
+  }
+
+  void give(IntrusivePtr<T> r) noexcept
+  {
+    _Pooled::RcStub::give(*mStub, std::move(r));
+  }
+
+  void clear() noexcept { _Pooled::RcStub::clear(*mStub); }
+
+  Iterator begin() noexcept { return { mStub->begin() }; }
+
+  std::size_t count() noexcept { return mStub->count(); }
+
+  /**
+   * @brief 链上操作的统计，见 _Pooled::Counters。
+   */
+  _Pooled::Counters counters() const noexcept { return mStub->counters(); }
 
 private:
-  std::shared_ptr<_Pooled::Stub> mStub{ std::make_shared<_Pooled::Stub>() };
+  IntrusivePtr<_Pooled::RcStub> mStub{ make_intrusive<_Pooled::RcStub>() };
 };
 
 } // namespace My
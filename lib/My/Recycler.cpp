@@ -0,0 +1,130 @@
+#include "Recycler.hpp"
+
+#include <algorithm>
+
+namespace My::_Recycler {
+
+struct Bin::Free : _Pooled::RcNode
+{};
+
+Bin::Bin(std::size_t block)
+  : mBlock((std::max(block, sizeof(Free)) + kAlign - 1) / kAlign * kAlign)
+  , mStub(make_intrusive<_Pooled::RcStub>())
+{
+}
+
+void*
+Bin::allocate(std::size_t bytes, std::size_t align, Magazine* m)
+{
+  if (bytes > mBlock || align > kAlign) {
+    mOversize.fetch_add(1, std::memory_order_relaxed);
+    if (align > kAlign)
+      return ::operator new(bytes, std::align_val_t(align));
+    return ::operator new(bytes);
+  }
+
+  if (!m) {
+    void* p;
+    if (pop_n(1, &p))
+      return p;
+  } else {
+    if (!m->mSize)
+      m->mSize = pop_n(kMagazine / 2, m->mBlocks);
+    if (m->mSize)
+      return m->mBlocks[--m->mSize];
+  }
+
+  mFresh.fetch_add(1, std::memory_order_relaxed);
+  return ::operator new(mBlock);
+}
+
+void
+Bin::deallocate(void* p,
+                std::size_t bytes,
+                std::size_t align,
+                Magazine* m) noexcept
+{
+  if (align > kAlign)
+    ::operator delete(p, std::align_val_t(align));
+  else if (bytes > mBlock)
+    ::operator delete(p);
+  else if (!m)
+    push_n(&p, &p + 1);
+  else {
+    if (m->mSize == kMagazine) {
+      m->mSize -= kMagazine / 2;
+      push_n(m->mBlocks + m->mSize, m->mBlocks + kMagazine);
+    }
+    m->mBlocks[m->mSize++] = p;
+  }
+}
+
+void
+Bin::flush(Magazine& m) noexcept
+{
+  push_n(m.mBlocks, m.mBlocks + m.mSize);
+  m.mSize = 0;
+}
+
+void
+Bin::reserve(std::size_t n)
+{
+  while (mIdle.load(std::memory_order_relaxed) < n) {
+    void* p = ::operator new(mBlock);
+    mFresh.fetch_add(1, std::memory_order_relaxed);
+    push_n(&p, &p + 1);
+  }
+}
+
+void
+Bin::trim() noexcept
+{
+  void* p;
+  while (pop_n(1, &p))
+    ::operator delete(p);
+}
+
+Bin::Stats
+Bin::stats() const noexcept
+{
+  return { mBlock,
+           mIdle.load(std::memory_order_relaxed),
+           mFresh.load(std::memory_order_relaxed),
+           mOversize.load(std::memory_order_relaxed) };
+}
+
+std::size_t
+Bin::pop_n(std::size_t n, void** out) noexcept
+{
+  _Pooled::RcNode::Ptr nodes[kMagazine];
+  n = _Pooled::RcStub::take_n(*mStub, std::min(n, kMagazine), nodes);
+  if (!n)
+    return 0;
+  mIdle.fetch_sub(n, std::memory_order_relaxed);
+
+  // 链上的引用直接转交过来，这是唯一的引用，析构节点头而不是释放它
+  for (std::size_t i = 0; i < n; ++i) {
+    auto* p = nodes[i].release();
+    p->~RcNode();
+    out[i] = p;
+  }
+  return n;
+}
+
+void
+Bin::push_n(void** first, void** last) noexcept
+{
+  _Pooled::RcNode::Ptr nodes[kMagazine];
+  auto n = std::size_t(last - first);
+  if (!n)
+    return;
+  assert(n <= kMagazine);
+  for (std::size_t i = 0; i < n; ++i)
+    nodes[i] = _Pooled::RcNode::Ptr(new (first[i]) Free);
+
+  // 先计数再入链，以免 pop_n 先减到下溢
+  mIdle.fetch_add(n, std::memory_order_relaxed);
+  _Pooled::RcStub::give_n(*mStub, nodes, nodes + n);
+}
+
+} // namespace My::_Recycler
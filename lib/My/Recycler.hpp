@@ -0,0 +1,254 @@
+#pragma once
+
+#include "Pooled.hpp"
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+
+namespace My {
+
+namespace _Recycler {
+
+/**
+ * @brief 定长内存块的回收站。
+ *
+ * 归还的块不交还给堆，而是在块的开头就地构造一个 RcNode 挂到 RcStub 链上，
+ * 取出时再析构掉这个节点头。块只经由 take/give 进出链，不会被迭代器钉住，
+ * 所以取出时引用计数一定为 1，可以直接放弃所有权。
+ *
+ * 每个线程在共享链前面有一个弹匣，弹匣满时退回一半到链上，空时从链上补充
+ * 一半，平时的分配和释放不碰任何共享的缓存行。
+ *
+ * 大小或对齐超出块规格的请求直接转给全局的 operator new。
+ */
+class Bin
+{
+public:
+  /// 块的对齐，也就是 operator new 默认保证的对齐
+  static constexpr std::size_t kAlign = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+  /// 弹匣的容量
+  static constexpr std::size_t kMagazine = 32;
+
+  struct Stats
+  {
+    std::size_t mBlock;    ///< 块的字节数
+    std::size_t mIdle;     ///< 共享链上空闲的块数，不含各线程弹匣中的
+    std::size_t mFresh;    ///< 累计从堆上新分配的块数
+    std::size_t mOversize; ///< 累计因为超出块规格而直接走堆的次数
+  };
+
+  /**
+   * @brief 线程本地的弹匣，线程退出时把块退回共享链。
+   *
+   * 析构后通过 closed 标志告知调用者，这个标志要放在可平凡析构的线程本地
+   * 变量中，别的线程本地对象在弹匣析构之后释放块时还能读到它。
+   */
+  struct Magazine
+  {
+    Bin& mBin;
+    bool& mClosed; ///< 为真时弹匣已析构，直接存取共享链
+    std::size_t mSize{ 0 };
+    void* mBlocks[kMagazine];
+
+    Magazine(Bin& bin, bool& closed) noexcept
+      : mBin(bin)
+      , mClosed(closed)
+    {
+    }
+
+    Magazine(const Magazine&) = delete;
+    Magazine& operator=(const Magazine&) = delete;
+
+    ~Magazine() noexcept
+    {
+      mBin.flush(*this);
+      mClosed = true; // 别的线程本地对象可能在这之后析构并释放块
+    }
+  };
+
+  /**
+   * @param block 块的字节数，至少能放下一个节点头。
+   */
+  explicit Bin(std::size_t block);
+  Bin(const Bin&) = delete;
+  Bin& operator=(const Bin&) = delete;
+  ~Bin() noexcept { trim(); }
+
+  /**
+   * @param m 当前线程的弹匣，为空时直接存取共享链。
+   */
+  void* allocate(std::size_t bytes, std::size_t align, Magazine* m);
+  void deallocate(void* p,
+                  std::size_t bytes,
+                  std::size_t align,
+                  Magazine* m) noexcept;
+
+  /**
+   * @brief 把弹匣中的块全部退回共享链。
+   */
+  void flush(Magazine& m) noexcept;
+
+  /**
+   * @brief 预先分配块放到共享链上，直到链上空闲的块数不少于 n。
+   */
+  void reserve(std::size_t n);
+
+  /**
+   * @brief 把共享链上空闲的块全部还给堆。
+   */
+  void trim() noexcept;
+
+  Stats stats() const noexcept;
+
+private:
+  struct Free;
+
+  const std::size_t mBlock;
+  const IntrusivePtr<_Pooled::RcStub> mStub;
+  std::atomic<std::size_t> mIdle{ 0 };
+  std::atomic<std::size_t> mFresh{ 0 };
+  std::atomic<std::size_t> mOversize{ 0 };
+
+  std::size_t pop_n(std::size_t n, void** out) noexcept;
+  void push_n(void** first, void** last) noexcept;
+};
+
+/**
+ * @brief 默认的块大小：对象本身加上 allocate_shared 控制块的余量。
+ */
+template<typename T>
+constexpr std::size_t
+block_for() noexcept
+{
+  constexpr auto a = Bin::kAlign;
+  return (sizeof(T) + 4 * sizeof(void*) + a - 1) / a * a;
+}
+
+} // namespace _Recycler
+
+/**
+ * @brief 对象回收器，对象释放后内存留在池中，下次创建时直接复用。
+ *
+ * 每个 <T, kBlock> 组合共享一个全局的回收站，配合 std::allocate_shared
+ * 使用时对象和控制块分配在同一个块里，稳定状态下创建和销毁对象不再访问堆。
+ * 对象每次都会重新构造，如果成员缓冲区也要保留容量，就让它使用另一个
+ * 回收器的 Allocator，例如：
+ *
+ * ```
+ * using Buffer = std::vector<char, Recycler<char, 8192>::Allocator<char>>;
+ * auto p = Recycler<Session>::make_shared(sock);
+ * ```
+ *
+ * @tparam T 对象类型。
+ * @tparam kBlock 块的字节数，超出的分配请求直接走堆。
+ */
+template<typename T, std::size_t kBlock = _Recycler::block_for<T>()>
+class Recycler
+{
+public:
+  using Stats = _Recycler::Bin::Stats;
+
+  template<typename U>
+  class Allocator;
+
+  /**
+   * @brief 回收站，首次使用时创建且永不销毁，这样静态析构之后释放的对象
+   * 仍然可以归还。
+   */
+  static _Recycler::Bin& bin()
+  {
+    static auto* gBin = new _Recycler::Bin(kBlock);
+    return *gBin;
+  }
+
+  /**
+   * @brief 当前线程的弹匣，线程退出时已析构则返回空。
+   */
+  static _Recycler::Bin::Magazine* magazine()
+  {
+    static thread_local bool gtClosed = false;
+    if (gtClosed)
+      return nullptr;
+    static thread_local _Recycler::Bin::Magazine gtMagazine(bin(), gtClosed);
+    return &gtMagazine;
+  }
+
+  /**
+   * @brief 在回收的内存中创建对象，同 std::allocate_shared。
+   */
+  template<typename... Args>
+  static std::shared_ptr<T> make_shared(Args&&... args)
+  {
+    return std::allocate_shared<T>(Allocator<T>(),
+                                   std::forward<Args>(args)...);
+  }
+
+  /**
+   * @see _Recycler::Bin::reserve
+   */
+  static void reserve(std::size_t n) { bin().reserve(n); }
+
+  /**
+   * @brief 把当前线程弹匣中和共享链上空闲的块还给堆。
+   */
+  static void trim() noexcept
+  {
+    if (auto* m = magazine())
+      bin().flush(*m);
+    bin().trim();
+  }
+
+  static Stats stats() noexcept { return bin().stats(); }
+};
+
+/**
+ * @brief 无状态的分配器适配器，所有的重绑定都从同一个回收站分配。
+ */
+template<typename T, std::size_t kBlock>
+template<typename U>
+class Recycler<T, kBlock>::Allocator
+{
+public:
+  using value_type = U;
+
+  template<typename V>
+  struct rebind
+  {
+    using other = Allocator<V>;
+  };
+
+  Allocator() noexcept = default;
+
+  template<typename V>
+  Allocator(const Allocator<V>&) noexcept
+  {
+  }
+
+  U* allocate(std::size_t n)
+  {
+    if (n > SIZE_MAX / sizeof(U))
+      throw std::bad_array_new_length();
+    return static_cast<U*>(
+      bin().allocate(n * sizeof(U), alignof(U), magazine()));
+  }
+
+  void deallocate(U* p, std::size_t n) noexcept
+  {
+    bin().deallocate(p, n * sizeof(U), alignof(U), magazine());
+  }
+
+  template<typename V>
+  bool operator==(const Allocator<V>&) const noexcept
+  {
+    return true;
+  }
+
+  template<typename V>
+  bool operator!=(const Allocator<V>&) const noexcept
+  {
+    return false;
+  }
+};
+
+} // namespace My
@@ -1,64 +1,53 @@
 #include "SpinMutex.hpp"
 
-namespace My {
+#ifdef __linux__
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
 
-void
-SpinMutex::Recursive::lock() noexcept
-{
-  std::thread::id desired = std::this_thread::get_id();
-  if (mOwner.load(std::memory_order_relaxed) == desired) {
-    ++mCount;
-    return;
-  }
-  std::thread::id expected;
-  do
-    expected = {};
-  while (!mOwner.compare_exchange_weak(
-    expected, desired, std::memory_order_acquire, std::memory_order_relaxed));
-  mCount = 1;
-}
+namespace My::_SpinMutex {
 
-bool
-SpinMutex::Recursive::try_lock() noexcept
-{
-  std::thread::id desired = std::this_thread::get_id();
-  if (mOwner.load(std::memory_order_relaxed) == desired) {
-    ++mCount;
-    return true;
-  }
-  std::thread::id expected;
-  if (!mOwner.compare_exchange_strong(expected,
-                                      desired,
-                                      std::memory_order_acquire,
-                                      std::memory_order_relaxed))
-    return false;
-  mCount = 1;
-  return true;
-}
+ParkSlot gParkSlots[kParkSlots];
 
 void
-SpinMutex::Shared::lock_shared() noexcept
+park_wait(std::atomic<std::uint32_t>& seq,
+          std::uint32_t expected,
+          std::chrono::microseconds timeout) noexcept
 {
-  unsigned expected = 0;
-  do
-    if (expected == UINT_MAX)
-      expected = 0;
-  while (!mCount.compare_exchange_weak(expected,
-                                       expected + 1,
-                                       std::memory_order_acquire,
-                                       std::memory_order_relaxed));
+#ifdef __linux__
+  static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t));
+  timespec ts;
+  ts.tv_sec = timeout.count() / 1000000;
+  ts.tv_nsec = timeout.count() % 1000000 * 1000;
+  // 被信号打断、超时或 seq 已改变都直接返回，由调用方重新尝试加锁
+  syscall(SYS_futex,
+          reinterpret_cast<std::uint32_t*>(&seq),
+          FUTEX_WAIT_PRIVATE,
+          expected,
+          &ts,
+          nullptr,
+          0);
+#else
+  if (seq.load(std::memory_order_relaxed) == expected)
+    std::this_thread::yield();
+#endif
 }
 
-bool
-SpinMutex::Shared::try_lock_shared() noexcept
+void
+park_wake(std::atomic<std::uint32_t>& seq) noexcept
 {
-  unsigned expected = 0;
-  if (expected == UINT_MAX)
-    return false;
-  return mCount.compare_exchange_strong(expected,
-                                        expected + 1,
-                                        std::memory_order_acquire,
-                                        std::memory_order_relaxed);
+#ifdef __linux__
+  syscall(SYS_futex,
+          reinterpret_cast<std::uint32_t*>(&seq),
+          FUTEX_WAKE_PRIVATE,
+          INT_MAX,
+          nullptr,
+          nullptr,
+          0);
+#endif
 }
 
-} // namespace My
+} // namespace My::_SpinMutex
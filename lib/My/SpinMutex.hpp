@@ -4,20 +4,284 @@
 #include <cassert>
 #include <chrono>
 #include <climits>
+#include <cstdint>
+#include <memory>
 #include <thread>
 
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#endif
+
 namespace My {
 
+/**
+ * @brief 自旋策略，决定自旋锁在一次加锁尝试失败之后如何等待。
+ *
+ * 策略是可默认构造的类型，每次加锁时构造一个新对象以保存退避状态，要求提供：
+ *
+ * - `template<typename F> void operator()(const void* addr, F&& busy) noexcept`
+ *
+ *   在一次加锁尝试失败后调用。addr 是锁字的地址，busy() 返回锁是否仍被占用，
+ *   休眠类的策略在休眠前要用它复查，以免错过唤醒。
+ *
+ * - `static void wake(const void* addr) noexcept`
+ *
+ *   在释放锁之后调用，唤醒在 addr 上休眠的线程，不休眠的策略实现为空即可。
+ */
+namespace SpinPolicy {
+
+/**
+ * @brief 向 CPU 提示当前正处于自旋等待中（x86 的 pause，ARM 的 yield）。
+ */
+inline void
+pause() noexcept
+{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+  _mm_pause();
+#elif defined(__i386__) || defined(__x86_64__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  asm volatile("yield");
+#endif
+}
+
+/**
+ * @brief 空转，不做任何等待。
+ */
+struct None
+{
+  template<typename F>
+  void operator()(const void*, F&&) noexcept
+  {
+  }
+
+  static void wake(const void*) noexcept {}
+};
+
+/**
+ * @brief 每次失败后执行一次 pause 指令。
+ */
+struct Pause
+{
+  template<typename F>
+  void operator()(const void*, F&&) noexcept
+  {
+    pause();
+  }
+
+  static void wake(const void*) noexcept {}
+};
+
+/**
+ * @brief 指数退避，每次失败后执行的 pause 次数从 Min 起倍增，直到 Max 为止。
+ */
+template<unsigned Min = 1, unsigned Max = 1024>
+struct Backoff
+{
+  static_assert(0 < Min && Min <= Max);
+
+  template<typename F>
+  void operator()(const void*, F&&) noexcept
+  {
+    for (unsigned i = 0; i < mN; ++i)
+      pause();
+    if (mN < Max)
+      mN = mN * 2 < Max ? mN * 2 : Max;
+  }
+
+  static void wake(const void*) noexcept {}
+
+  unsigned mN{ Min };
+};
+
+/**
+ * @brief 先以 pause 自旋 N 次，之后每次失败都让出时间片。
+ *
+ * 在线程数超过核数时，持锁线程可能正被挂起，此时让出时间片可以避免白白耗尽
+ * 等待者的时间片。
+ */
+template<unsigned N = 64>
+struct Yield
+{
+  template<typename F>
+  void operator()(const void*, F&&) noexcept
+  {
+    if (mN < N) {
+      ++mN;
+      pause();
+    } else
+      std::this_thread::yield();
+  }
+
+  static void wake(const void*) noexcept {}
+
+  unsigned mN{ 0 };
+};
+
+} // namespace SpinPolicy
+
+namespace _SpinMutex {
+
+/**
+ * @brief 休眠槽，锁字的地址被散列到固定数量的槽上，多个锁可能共享同一个槽。
+ */
+struct alignas(64) ParkSlot
+{
+  std::atomic<std::uint32_t> mSeq{ 0 };     ///< 唤醒序号，用作 futex 字
+  std::atomic<std::uint32_t> mWaiters{ 0 }; ///< 正在休眠的线程数
+};
+
+constexpr std::size_t kParkSlots = 256;
+
+extern ParkSlot gParkSlots[kParkSlots];
+
+inline ParkSlot&
+park_slot(const void* addr) noexcept
+{
+  auto h = reinterpret_cast<std::uintptr_t>(addr) >> 4;
+  h ^= h >> 8;
+  return gParkSlots[h % kParkSlots];
+}
+
+/**
+ * @brief 若 seq 仍等于 expected，则休眠至被唤醒或超时。
+ */
+void
+park_wait(std::atomic<std::uint32_t>& seq,
+          std::uint32_t expected,
+          std::chrono::microseconds timeout) noexcept;
+
+/**
+ * @brief 唤醒所有在 seq 上休眠的线程。
+ */
+void
+park_wake(std::atomic<std::uint32_t>& seq) noexcept;
+
+/**
+ * @brief MCS 锁的排队结点，每个等待者都只在自己的结点上自旋。
+ */
+struct alignas(64) McsNode
+{
+  std::atomic<McsNode*> mNext{ nullptr };
+  std::atomic<bool> mLocked{ false };
+  McsNode* mFree{ nullptr }; ///< 线程本地空闲链表
+};
+
+/**
+ * @brief 线程本地的 MCS 结点缓存，一个线程同时持有几把锁就缓存几个结点。
+ */
+struct McsNodes
+{
+  McsNode* mFree{ nullptr };
+
+  ~McsNodes() noexcept
+  {
+    while (mFree) {
+      auto* node = mFree;
+      mFree = node->mFree;
+      delete node;
+    }
+  }
+
+  McsNode* acquire()
+  {
+    auto* node = mFree;
+    if (!node)
+      return new McsNode;
+    mFree = node->mFree;
+    return node;
+  }
+
+  void release(McsNode* node) noexcept
+  {
+    node->mFree = mFree;
+    mFree = node;
+  }
+};
+
+inline thread_local McsNodes gtMcsNodes;
+
+/**
+ * @brief 分布式读写锁的读者计数槽，每个槽独占一个缓存行。
+ */
+struct alignas(64) ReaderSlot
+{
+  std::atomic<unsigned> mCount{ 0 };
+};
+
+inline std::atomic<unsigned> gReaderSlotNext{ 0 };
+
+/**
+ * @brief 线程的读者槽序号，线程第一次使用时依次分配，各线程尽量落在不同槽上。
+ */
+inline thread_local const unsigned gtReaderSlot =
+  gReaderSlotNext.fetch_add(1, std::memory_order_relaxed);
+
+} // namespace _SpinMutex
+
+namespace SpinPolicy {
+
+/**
+ * @brief 先以 pause 自旋 N 次，之后在锁字地址对应的休眠槽上休眠。
+ *
+ * Linux 上使用 futex，其它平台上退化为让出时间片。每次休眠最长 Us 微秒，
+ * 因此带超时的加锁方法最多会多等待这么久。
+ */
+template<unsigned N = 64, unsigned Us = 1000>
+struct Park
+{
+  template<typename F>
+  void operator()(const void* addr, F&& busy) noexcept
+  {
+    if (mN < N) {
+      ++mN;
+      pause();
+      return;
+    }
+
+    auto& slot = _SpinMutex::park_slot(addr);
+    slot.mWaiters.fetch_add(1, std::memory_order_relaxed);
+    // 与 wake 中的栅栏配对：要么 wake 看到了等待者，要么这里看到了锁被释放
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto seq = slot.mSeq.load(std::memory_order_relaxed);
+    if (busy())
+      _SpinMutex::park_wait(slot.mSeq, seq, std::chrono::microseconds(Us));
+    slot.mWaiters.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  static void wake(const void* addr) noexcept
+  {
+    auto& slot = _SpinMutex::park_slot(addr);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (slot.mWaiters.load(std::memory_order_relaxed) == 0)
+      return;
+    slot.mSeq.fetch_add(1, std::memory_order_relaxed);
+    _SpinMutex::park_wake(slot.mSeq);
+  }
+
+  unsigned mN{ 0 };
+};
+
+} // namespace SpinPolicy
+
 /**
  * @brief 符合标准库具名要求的可定时自旋锁。
  *
  * https://zh.cppreference.com/w/cpp/named_req/BasicLockable
+ *
+ * @tparam P 自旋策略，见 SpinPolicy，对所有嵌套的锁类型同样生效。
  */
-class SpinMutex
+template<typename P = SpinPolicy::Yield<>>
+class BasicSpinMutex
 {
 public:
+  using Policy = P;
+
   class Recursive;
   class Shared;
+  class Distributed;
+  class Ticket;
+  class Mcs;
 
   template<typename T,
            unsigned B = 1,
@@ -27,15 +291,23 @@ public:
 public:
   void lock() noexcept
   {
-    while (mLocked.test_and_set(std::memory_order_acquire))
-      ;
+    P p;
+    // 只在锁看起来空闲时才执行 RMW 操作，等待时只读，以免缓存行在核间来回传递
+    while (mLocked.exchange(true, std::memory_order_acquire))
+      while (mLocked.load(std::memory_order_relaxed))
+        p(&mLocked, [&] { return mLocked.load(std::memory_order_relaxed); });
   }
 
-  void unlock() noexcept { mLocked.clear(std::memory_order_release); }
+  void unlock() noexcept
+  {
+    mLocked.store(false, std::memory_order_release);
+    P::wake(&mLocked);
+  }
 
   bool try_lock() noexcept
   {
-    return !mLocked.test_and_set(std::memory_order_acquire);
+    return !mLocked.load(std::memory_order_relaxed) &&
+           !mLocked.exchange(true, std::memory_order_acquire);
   }
 
   template<class Rep, class Period>
@@ -49,38 +321,88 @@ public:
     const std::chrono::time_point<Clock, Duration>& timeout) noexcept;
 
 protected:
-  std::atomic_flag mLocked{ ATOMIC_FLAG_INIT };
+  std::atomic<bool> mLocked{ false };
 };
 
+/**
+ * @brief 使用默认自旋策略的自旋锁。
+ */
+using SpinMutex = BasicSpinMutex<>;
+
+template<typename P>
 template<class Clock, class Duration>
 bool
-SpinMutex::try_lock_until(
+BasicSpinMutex<P>::try_lock_until(
   const std::chrono::time_point<Clock, Duration>& timeout) noexcept
 {
-  while (mLocked.test_and_set(std::memory_order_acquire))
-    if (Clock::now() >= timeout)
-      return false;
+  P p;
+  while (mLocked.exchange(true, std::memory_order_acquire))
+    while (mLocked.load(std::memory_order_relaxed)) {
+      if (Clock::now() >= timeout)
+        return false;
+      p(&mLocked, [&] { return mLocked.load(std::memory_order_relaxed); });
+    }
   return true;
 }
 
 /**
  * @brief 符合标准库具名要求的递归自旋锁。
  */
-class SpinMutex::Recursive
+template<typename P>
+class BasicSpinMutex<P>::Recursive
 {
 public:
-  void lock() noexcept;
+  void lock() noexcept
+  {
+    std::thread::id desired = std::this_thread::get_id();
+    if (mOwner.load(std::memory_order_relaxed) == desired) {
+      ++mCount;
+      return;
+    }
+    P p;
+    while (true) {
+      std::thread::id expected;
+      if (mOwner.load(std::memory_order_relaxed) != expected)
+        p(&mOwner, [&] {
+          return mOwner.load(std::memory_order_relaxed) != std::thread::id();
+        });
+      else if (mOwner.compare_exchange_weak(expected,
+                                            desired,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed))
+        break;
+    }
+    mCount = 1;
+  }
 
   void unlock() noexcept
   {
     assert(mOwner.load(std::memory_order_relaxed) ==
              std::this_thread::get_id() &&
            mCount > 0);
-    if (--mCount == 0)
+    if (--mCount == 0) {
       mOwner.store({}, std::memory_order_release);
+      P::wake(&mOwner);
+    }
   }
 
-  bool try_lock() noexcept;
+  bool try_lock() noexcept
+  {
+    std::thread::id desired = std::this_thread::get_id();
+    if (mOwner.load(std::memory_order_relaxed) == desired) {
+      ++mCount;
+      return true;
+    }
+    std::thread::id expected;
+    if (mOwner.load(std::memory_order_relaxed) != expected ||
+        !mOwner.compare_exchange_strong(expected,
+                                        desired,
+                                        std::memory_order_acquire,
+                                        std::memory_order_relaxed))
+      return false;
+    mCount = 1;
+    return true;
+  }
 
   template<class Rep, class Period>
   bool try_lock_for(const std::chrono::duration<Rep, Period>& timeout) noexcept
@@ -97,9 +419,10 @@ protected:
   unsigned mCount{ 0 };
 };
 
+template<typename P>
 template<class Clock, class Duration>
 bool
-SpinMutex::Recursive::try_lock_until(
+BasicSpinMutex<P>::Recursive::try_lock_until(
   const std::chrono::time_point<Clock, Duration>& timeout) noexcept
 {
   std::thread::id desired = std::this_thread::get_id();
@@ -107,43 +430,87 @@ SpinMutex::Recursive::try_lock_until(
     ++mCount;
     return true;
   }
-  std::thread::id expected;
-  do {
-    if (Clock::now() >= timeout)
-      return false;
-    expected = {};
-  } while (!mOwner.compare_exchange_weak(
-    expected, desired, std::memory_order_acquire, std::memory_order_relaxed));
+  P p;
+  while (true) {
+    std::thread::id expected;
+    if (mOwner.load(std::memory_order_relaxed) != expected) {
+      if (Clock::now() >= timeout)
+        return false;
+      p(&mOwner, [&] {
+        return mOwner.load(std::memory_order_relaxed) != std::thread::id();
+      });
+    } else if (mOwner.compare_exchange_weak(expected,
+                                            desired,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed))
+      break;
+  }
   mCount = 1;
   return true;
 }
 
 /**
  * @brief 符合标准库具名要求的共享自旋锁。
+ *
+ * 默认写者优先：当有写者在等待时，新的读者会等到写者完成后再加锁，从而源源
+ * 不断的读者不会饿死写者。注意在写者优先时，已持有共享锁的线程不能再次申请
+ * 共享锁，否则可能与等待中的写者互相死锁。
  */
-class SpinMutex::Shared
+template<typename P>
+class BasicSpinMutex<P>::Shared
 {
 public:
+  /**
+   * @brief 读写偏好。
+   */
+  enum class Prefer
+  {
+    kReader, ///< 读者优先，写者只能在没有任何读者时加锁，可能被饿死
+    kWriter, ///< 写者优先，等待中的写者会阻止新的读者加锁
+  };
+
+public:
+  explicit Shared(Prefer prefer = Prefer::kWriter) noexcept
+    : mPrefer(prefer)
+  {
+  }
+
   void lock() noexcept
   {
-    unsigned expected, desired = UINT_MAX;
-    do
-      expected = 0;
-    while (!mCount.compare_exchange_weak(
-      expected, desired, std::memory_order_acquire, std::memory_order_relaxed));
+    if (try_lock())
+      return;
+
+    P p;
+    intend();
+    while (true) {
+      unsigned expected = 0;
+      if (mCount.load(std::memory_order_relaxed) != 0)
+        p(&mCount,
+          [&] { return mCount.load(std::memory_order_relaxed) != 0; });
+      else if (mCount.compare_exchange_weak(expected,
+                                            UINT_MAX,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed))
+        break;
+    }
+    unintend();
   }
 
   void unlock() noexcept
   {
     assert(mCount.load(std::memory_order_relaxed) == UINT_MAX);
     mCount.store(0, std::memory_order_release);
+    P::wake(&mCount);
   }
 
   bool try_lock() noexcept
   {
-    unsigned expected = 0, desired = UINT_MAX;
-    return mCount.compare_exchange_strong(
-      expected, desired, std::memory_order_acquire, std::memory_order_relaxed);
+    unsigned expected = 0;
+    return mCount.load(std::memory_order_relaxed) == 0 &&
+           mCount.compare_exchange_strong(expected,
+                                          UINT_MAX,
+                                          std::memory_order_acquire,
+                                          std::memory_order_relaxed);
   }
 
   template<class Rep, class Period>
@@ -156,16 +523,43 @@ public:
   bool try_lock_until(
     const std::chrono::time_point<Clock, Duration>& timeout) noexcept;
 
-  void lock_shared() noexcept;
+  void lock_shared() noexcept
+  {
+    P p;
+    auto expected = mCount.load(std::memory_order_relaxed);
+    while (true) {
+      if (blocked(expected)) {
+        p(&mCount,
+          [&] { return blocked(mCount.load(std::memory_order_relaxed)); });
+        expected = mCount.load(std::memory_order_relaxed);
+      } else if (mCount.compare_exchange_weak(expected,
+                                              expected + 1,
+                                              std::memory_order_acquire,
+                                              std::memory_order_relaxed))
+        break;
+    }
+  }
 
   void unlock_shared() noexcept
   {
     assert(mCount.load(std::memory_order_relaxed) != UINT_MAX &&
            mCount.load(std::memory_order_relaxed) != 0);
-    mCount.fetch_sub(1, std::memory_order_release);
+    if (mCount.fetch_sub(1, std::memory_order_release) == 1)
+      P::wake(&mCount);
   }
 
-  bool try_lock_shared() noexcept;
+  bool try_lock_shared() noexcept
+  {
+    auto expected = mCount.load(std::memory_order_relaxed);
+    do
+      if (blocked(expected))
+        return false;
+    while (!mCount.compare_exchange_weak(expected,
+                                         expected + 1,
+                                         std::memory_order_acquire,
+                                         std::memory_order_relaxed));
+    return true;
+  }
 
   template<class Rep, class Period>
   bool try_lock_shared_for(
@@ -180,39 +574,278 @@ public:
     const std::chrono::time_point<Clock, Duration>& timeout) noexcept;
 
 protected:
-  std::atomic<unsigned> mCount{ 0 };
+  std::atomic<unsigned> mCount{ 0 };   ///< 读者数，UINT_MAX 表示被写者持有
+  std::atomic<unsigned> mWriters{ 0 }; ///< 等待中的写者数
+  const Prefer mPrefer;
+
+private:
+  /**
+   * @brief 读者在计数为 count 时是否应当等待。
+   */
+  bool blocked(unsigned count) const noexcept
+  {
+    return count == UINT_MAX || (mPrefer == Prefer::kWriter &&
+                                 mWriters.load(std::memory_order_relaxed));
+  }
+
+  /**
+   * @brief 写者开始等待，在写者优先时阻止新的读者。
+   */
+  void intend() noexcept
+  {
+    if (mPrefer == Prefer::kWriter)
+      mWriters.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief 写者结束等待（加锁成功或超时）。
+   */
+  void unintend() noexcept
+  {
+    if (mPrefer == Prefer::kWriter &&
+        mWriters.fetch_sub(1, std::memory_order_relaxed) == 1)
+      P::wake(&mCount); // 唤醒因写者意向而等待的读者
+  }
 };
 
+template<typename P>
 template<class Clock, class Duration>
 bool
-SpinMutex::Shared::try_lock_until(
+BasicSpinMutex<P>::Shared::try_lock_until(
   const std::chrono::time_point<Clock, Duration>& timeout) noexcept
 {
-  unsigned expected, desired = UINT_MAX;
-  do {
-    if (Clock::now() >= timeout)
-      return false;
-    expected = 0;
-  } while (!mCount.compare_exchange_weak(
-    expected, desired, std::memory_order_acquire, std::memory_order_relaxed));
+  if (try_lock())
+    return true;
+
+  P p;
+  intend();
+  while (true) {
+    unsigned expected = 0;
+    if (mCount.load(std::memory_order_relaxed) != 0) {
+      if (Clock::now() >= timeout) {
+        unintend();
+        return false;
+      }
+      p(&mCount, [&] { return mCount.load(std::memory_order_relaxed) != 0; });
+    } else if (mCount.compare_exchange_weak(expected,
+                                            UINT_MAX,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed))
+      break;
+  }
+  unintend();
   return true;
 }
 
+template<typename P>
 template<class Clock, class Duration>
 bool
-SpinMutex::Shared::try_lock_shared_until(
+BasicSpinMutex<P>::Shared::try_lock_shared_until(
   const std::chrono::time_point<Clock, Duration>& timeout) noexcept
 {
-  unsigned expected = 0;
-  do {
-    if (Clock::now() >= timeout)
+  P p;
+  auto expected = mCount.load(std::memory_order_relaxed);
+  while (true) {
+    if (blocked(expected)) {
+      if (Clock::now() >= timeout)
+        return false;
+      p(&mCount,
+        [&] { return blocked(mCount.load(std::memory_order_relaxed)); });
+      expected = mCount.load(std::memory_order_relaxed);
+    } else if (mCount.compare_exchange_weak(expected,
+                                            expected + 1,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed))
+      return true;
+  }
+}
+
+/**
+ * @brief 读多写少时可扩展的共享自旋锁（big-reader lock）。
+ *
+ * 读者计数分散在多个独占缓存行的槽上，每个线程固定使用其中一个，读者之间
+ * 不再争用同一个缓存行；代价是写者加锁时要扫描所有的槽。写者先置位写标志以
+ * 阻止新的读者，再等待所有槽归零，因此同样是写者优先的，持有共享锁的线程
+ * 不能再次申请共享锁。
+ */
+template<typename P>
+class BasicSpinMutex<P>::Distributed
+{
+public:
+  /**
+   * @param slots 读者槽的数量，会向上取整到 2 的幂，0 表示取 CPU 数。
+   */
+  explicit Distributed(std::size_t slots = 0)
+    : mMask(mask(slots ? slots : std::thread::hardware_concurrency()))
+    , mSlots(new _SpinMutex::ReaderSlot[mMask + 1])
+  {
+  }
+
+  void lock() noexcept
+  {
+    P p;
+    // 写标志与读者槽之间要求 seq_cst：写者先写标志再读槽，读者先写槽再读标志
+    while (mWriter.exchange(true, std::memory_order_seq_cst))
+      while (mWriter.load(std::memory_order_relaxed))
+        p(&mWriter, [&] { return mWriter.load(std::memory_order_relaxed); });
+
+    for (std::size_t i = 0; i <= mMask; ++i) {
+      auto& count = mSlots[i].mCount;
+      while (count.load(std::memory_order_seq_cst))
+        p(&count, [&] { return count.load(std::memory_order_relaxed) != 0; });
+    }
+  }
+
+  void unlock() noexcept
+  {
+    assert(mWriter.load(std::memory_order_relaxed));
+    mWriter.store(false, std::memory_order_release);
+    P::wake(&mWriter);
+  }
+
+  bool try_lock() noexcept
+  {
+    if (mWriter.load(std::memory_order_relaxed) ||
+        mWriter.exchange(true, std::memory_order_seq_cst))
       return false;
-    if (expected == UINT_MAX)
-      expected = 0;
-  } while (!mCount.compare_exchange_weak(expected,
-                                         expected + 1,
-                                         std::memory_order_acquire,
-                                         std::memory_order_relaxed));
+
+    for (std::size_t i = 0; i <= mMask; ++i) {
+      if (mSlots[i].mCount.load(std::memory_order_seq_cst)) {
+        unlock();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  template<class Rep, class Period>
+  bool try_lock_for(const std::chrono::duration<Rep, Period>& timeout) noexcept
+  {
+    return try_lock_until(std::chrono::high_resolution_clock::now() + timeout);
+  }
+
+  template<class Clock, class Duration>
+  bool try_lock_until(
+    const std::chrono::time_point<Clock, Duration>& timeout) noexcept;
+
+  void lock_shared() noexcept
+  {
+    auto& count = slot();
+    P p;
+    while (!enter(count))
+      while (mWriter.load(std::memory_order_relaxed))
+        p(&mWriter, [&] { return mWriter.load(std::memory_order_relaxed); });
+  }
+
+  void unlock_shared() noexcept
+  {
+    assert(slot().load(std::memory_order_relaxed) != 0);
+    leave(slot());
+  }
+
+  bool try_lock_shared() noexcept
+  {
+    return !mWriter.load(std::memory_order_relaxed) && enter(slot());
+  }
+
+  template<class Rep, class Period>
+  bool try_lock_shared_for(
+    const std::chrono::duration<Rep, Period>& timeout) noexcept
+  {
+    return try_lock_shared_until(std::chrono::high_resolution_clock::now() +
+                                 timeout);
+  }
+
+  template<class Clock, class Duration>
+  bool try_lock_shared_until(
+    const std::chrono::time_point<Clock, Duration>& timeout) noexcept;
+
+  /**
+   * @brief 读者槽的数量。
+   */
+  std::size_t slots() const noexcept { return mMask + 1; }
+
+protected:
+  std::atomic<bool> mWriter{ false }; ///< 写者持有或正在等待读者退出
+  const std::size_t mMask;
+  std::unique_ptr<_SpinMutex::ReaderSlot[]> mSlots;
+
+private:
+  static std::size_t mask(std::size_t slots) noexcept
+  {
+    std::size_t n = 1;
+    while (n < slots)
+      n <<= 1;
+    return n - 1;
+  }
+
+  std::atomic<unsigned>& slot() const noexcept
+  {
+    return mSlots[_SpinMutex::gtReaderSlot & mMask].mCount;
+  }
+
+  /**
+   * @brief 在槽上登记一个读者，若发现写者则撤销登记并返回 false。
+   */
+  bool enter(std::atomic<unsigned>& count) noexcept
+  {
+    count.fetch_add(1, std::memory_order_seq_cst);
+    if (!mWriter.load(std::memory_order_seq_cst))
+      return true;
+    leave(count);
+    return false;
+  }
+
+  void leave(std::atomic<unsigned>& count) noexcept
+  {
+    if (count.fetch_sub(1, std::memory_order_release) == 1)
+      P::wake(&count);
+  }
+};
+
+template<typename P>
+template<class Clock, class Duration>
+bool
+BasicSpinMutex<P>::Distributed::try_lock_until(
+  const std::chrono::time_point<Clock, Duration>& timeout) noexcept
+{
+  P p;
+  while (mWriter.exchange(true, std::memory_order_seq_cst)) {
+    while (mWriter.load(std::memory_order_relaxed)) {
+      if (Clock::now() >= timeout)
+        return false;
+      p(&mWriter, [&] { return mWriter.load(std::memory_order_relaxed); });
+    }
+  }
+
+  for (std::size_t i = 0; i <= mMask; ++i) {
+    auto& count = mSlots[i].mCount;
+    while (count.load(std::memory_order_seq_cst)) {
+      if (Clock::now() >= timeout) {
+        unlock();
+        return false;
+      }
+      p(&count, [&] { return count.load(std::memory_order_relaxed) != 0; });
+    }
+  }
+  return true;
+}
+
+template<typename P>
+template<class Clock, class Duration>
+bool
+BasicSpinMutex<P>::Distributed::try_lock_shared_until(
+  const std::chrono::time_point<Clock, Duration>& timeout) noexcept
+{
+  auto& count = slot();
+  P p;
+  while (!enter(count)) {
+    while (mWriter.load(std::memory_order_relaxed)) {
+      if (Clock::now() >= timeout)
+        return false;
+      p(&mWriter, [&] { return mWriter.load(std::memory_order_relaxed); });
+    }
+  }
   return true;
 }
 
@@ -222,8 +855,9 @@ SpinMutex::Shared::try_lock_shared_until(
  * @tparam T 标量类型，可以是整数或指针。
  * @tparam B 位号，0 为最低位。
  */
+template<typename P>
 template<typename T, unsigned B, typename>
-struct SpinMutex::Bit
+struct BasicSpinMutex<P>::Bit
 {
   static bool test(T t)
   {
@@ -286,13 +920,38 @@ struct SpinMutex::Bit
 
   static void lock(std::atomic<T>& t) noexcept
   {
-    T expected{};
-    do
-      expected = unset(expected);
-    while (!t.compare_exchange_weak(expected,
-                                    set(expected),
-                                    std::memory_order_acquire,
-                                    std::memory_order_relaxed));
+    P p;
+    T expected = t.load(std::memory_order_relaxed);
+    while (true) {
+      if (test(expected)) {
+        p(&t, [&] { return locked(t); });
+        expected = t.load(std::memory_order_relaxed);
+      } else if (t.compare_exchange_weak(expected,
+                                         set(expected),
+                                         std::memory_order_acquire,
+                                         std::memory_order_relaxed))
+        break;
+    }
+  }
+
+  /**
+   * @brief 同 lock，同时把等待的轮数累加到 spins，用于统计锁的争用。
+   */
+  static void lock(std::atomic<T>& t, std::uint64_t& spins) noexcept
+  {
+    P p;
+    T expected = t.load(std::memory_order_relaxed);
+    while (true) {
+      if (test(expected)) {
+        ++spins;
+        p(&t, [&] { return locked(t); });
+        expected = t.load(std::memory_order_relaxed);
+      } else if (t.compare_exchange_weak(expected,
+                                         set(expected),
+                                         std::memory_order_acquire,
+                                         std::memory_order_relaxed))
+        break;
+    }
   }
 
   static void unlock(std::atomic<T>& t) noexcept
@@ -305,11 +964,24 @@ struct SpinMutex::Bit
       assert(test(t.load(std::memory_order_relaxed)));
       t.fetch_and(~(T(1) << B), std::memory_order_release);
     }
+    P::wake(&t);
+  }
+
+  /**
+   * @brief 解锁的同时将原始值设置为 v，v 的锁位必须为 0。
+   */
+  static void unlock(std::atomic<T>& t, T v) noexcept
+  {
+    assert(test(t.load(std::memory_order_relaxed)) && !test(v));
+    t.store(v, std::memory_order_release);
+    P::wake(&t);
   }
 
   static bool try_lock(std::atomic<T>& t) noexcept
   {
-    T expected = unset(t.load(std::memory_order_relaxed));
+    T expected = t.load(std::memory_order_relaxed);
+    if (test(expected))
+      return false;
     return t.compare_exchange_strong(expected,
                                      set(expected),
                                      std::memory_order_acquire,
@@ -363,23 +1035,189 @@ struct SpinMutex::Bit
   }
 };
 
+template<typename P>
 template<typename T, unsigned B, typename U>
 template<class Clock, class Duration>
 bool
-SpinMutex::Bit<T, B, U>::try_lock_until(
+BasicSpinMutex<P>::Bit<T, B, U>::try_lock_until(
   std::atomic<T>& t,
   const std::chrono::time_point<Clock, Duration>& timeout) noexcept
 {
-  T expected{};
-  do {
-    expected = unset(expected);
-    if (Clock::now() >= timeout)
-      return false;
-  } while (!t.compare_exchange_weak(expected,
-                                    set(expected),
-                                    std::memory_order_acquire,
-                                    std::memory_order_relaxed));
-  return true;
+  P p;
+  T expected = t.load(std::memory_order_relaxed);
+  while (true) {
+    if (test(expected)) {
+      if (Clock::now() >= timeout)
+        return false;
+      p(&t, [&] { return locked(t); });
+      expected = t.load(std::memory_order_relaxed);
+    } else if (t.compare_exchange_weak(expected,
+                                       set(expected),
+                                       std::memory_order_acquire,
+                                       std::memory_order_relaxed))
+      return true;
+  }
 }
 
+/**
+ * @brief 符合标准库具名要求的公平排号自旋锁，按申请顺序获得锁。
+ *
+ * 带超时的加锁方法不排号，而是在锁空闲时尝试插队，因此不保证公平。
+ */
+template<typename P>
+class BasicSpinMutex<P>::Ticket
+{
+public:
+  void lock() noexcept
+  {
+    auto ticket = mNext.fetch_add(1, std::memory_order_relaxed);
+    P p;
+    while (mServing.load(std::memory_order_acquire) != ticket)
+      p(&mServing,
+        [&] { return mServing.load(std::memory_order_relaxed) != ticket; });
+  }
+
+  void unlock() noexcept
+  {
+    mServing.store(mServing.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+    P::wake(&mServing);
+  }
+
+  bool try_lock() noexcept
+  {
+    auto serving = mServing.load(std::memory_order_acquire);
+    auto expected = serving;
+    return mNext.load(std::memory_order_relaxed) == serving &&
+           mNext.compare_exchange_strong(expected,
+                                         serving + 1,
+                                         std::memory_order_acquire,
+                                         std::memory_order_relaxed);
+  }
+
+  template<class Rep, class Period>
+  bool try_lock_for(const std::chrono::duration<Rep, Period>& timeout) noexcept
+  {
+    return try_lock_until(std::chrono::high_resolution_clock::now() + timeout);
+  }
+
+  template<class Clock, class Duration>
+  bool try_lock_until(
+    const std::chrono::time_point<Clock, Duration>& timeout) noexcept
+  {
+    P p;
+    while (!try_lock()) {
+      if (Clock::now() >= timeout)
+        return false;
+      p(&mServing, [&] {
+        return mServing.load(std::memory_order_relaxed) !=
+               mNext.load(std::memory_order_relaxed);
+      });
+    }
+    return true;
+  }
+
+protected:
+  std::atomic<unsigned> mNext{ 0 };    ///< 下一个要发出的号
+  std::atomic<unsigned> mServing{ 0 }; ///< 当前持锁的号
+};
+
+/**
+ * @brief 符合标准库具名要求的 MCS 队列自旋锁（Mellor-Crummey & Scott）。
+ *
+ * 等待者按申请顺序排成链表，每个等待者只在自己线程本地的结点上自旋，释放锁
+ * 时只会使下一个等待者的缓存行失效。带超时的加锁方法不排队，而是在锁空闲时
+ * 尝试插队，因此不保证公平。
+ */
+template<typename P>
+class BasicSpinMutex<P>::Mcs
+{
+public:
+  void lock() noexcept
+  {
+    auto* node = _SpinMutex::gtMcsNodes.acquire();
+    node->mNext.store(nullptr, std::memory_order_relaxed);
+    node->mLocked.store(true, std::memory_order_relaxed);
+
+    auto* prev = mTail.exchange(node, std::memory_order_acq_rel);
+    if (prev) {
+      prev->mNext.store(node, std::memory_order_release);
+      P p;
+      while (node->mLocked.load(std::memory_order_acquire))
+        p(&node->mLocked,
+          [&] { return node->mLocked.load(std::memory_order_relaxed); });
+    }
+    mHolder = node;
+  }
+
+  void unlock() noexcept
+  {
+    auto* node = mHolder;
+    assert(node);
+
+    auto* next = node->mNext.load(std::memory_order_acquire);
+    if (!next) {
+      auto* expected = node;
+      if (mTail.compare_exchange_strong(expected,
+                                        nullptr,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed)) {
+        _SpinMutex::gtMcsNodes.release(node);
+        P::wake(&mTail);
+        return;
+      }
+      // 后继者已经入队，但还没来得及链接到 node 上
+      while (!(next = node->mNext.load(std::memory_order_acquire)))
+        SpinPolicy::pause();
+    }
+
+    next->mLocked.store(false, std::memory_order_release);
+    P::wake(&next->mLocked);
+    _SpinMutex::gtMcsNodes.release(node);
+  }
+
+  bool try_lock() noexcept
+  {
+    if (mTail.load(std::memory_order_relaxed))
+      return false;
+
+    auto* node = _SpinMutex::gtMcsNodes.acquire();
+    node->mNext.store(nullptr, std::memory_order_relaxed);
+    _SpinMutex::McsNode* expected = nullptr;
+    if (!mTail.compare_exchange_strong(expected,
+                                       node,
+                                       std::memory_order_acquire,
+                                       std::memory_order_relaxed)) {
+      _SpinMutex::gtMcsNodes.release(node);
+      return false;
+    }
+    mHolder = node;
+    return true;
+  }
+
+  template<class Rep, class Period>
+  bool try_lock_for(const std::chrono::duration<Rep, Period>& timeout) noexcept
+  {
+    return try_lock_until(std::chrono::high_resolution_clock::now() + timeout);
+  }
+
+  template<class Clock, class Duration>
+  bool try_lock_until(
+    const std::chrono::time_point<Clock, Duration>& timeout) noexcept
+  {
+    P p;
+    while (!try_lock()) {
+      if (Clock::now() >= timeout)
+        return false;
+      p(&mTail,
+        [&] { return mTail.load(std::memory_order_relaxed) != nullptr; });
+    }
+    return true;
+  }
+
+protected:
+  std::atomic<_SpinMutex::McsNode*> mTail{ nullptr };
+  _SpinMutex::McsNode* mHolder{ nullptr }; ///< 只由持锁线程读写
+};
+
 } // namespace My
@@ -1,56 +1,574 @@
 #include "Timing.hpp"
+#include "CFile64.hpp"
 #include "util.hpp"
 
+#include <algorithm>
 #include <boost/json.hpp>
+#include <charconv>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <mutex>
 #include <regex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 using namespace My::util;
 namespace sc = std::chrono;
 
-std::ostream&
-operator<<(std::ostream& out, const My::Timing& prof)
+namespace {
+
+using My::Timing;
+
+/**
+ * @brief 以缩进文本的方式逐条打印，作用域的进入和离开合并显示为耗时。
+ */
+class Printer
 {
-  using namespace My;
+public:
+  Printer(std::ostream& out, Timing::Clock::time_point initial)
+    : mOut(out)
+    , mLast(initial)
+  {
+  }
 
-  std::vector<Timing::Entry*> stack;
-  auto last = prof.initial();
-  for (auto&& i : prof) {
-    for (auto i = stack.size(); i > 1; --i)
-      out << '\t';
+  /**
+   * @param info 返回附加信息的函数，只在普通记录有附加信息时调用。
+   */
+  template<typename F>
+  void operator()(std::string_view tag,
+                  Timing::Clock::time_point time,
+                  Timing::Mapped::Kind kind,
+                  bool hasInfo,
+                  F&& info)
+  {
+    for (auto i = mStack.size(); i > 1; --i)
+      mOut << '\t';
 
-    auto info = i.get_info();
-    if (info == &Timing::Scope::gLeaveInfo && !stack.empty() &&
-        stack.back()->mTag == i.mTag) {
-      out << i.mTag << " [" << (i.mTime - stack.back()->mTime) << ']';
-      stack.pop_back();
+    if (kind == Timing::Mapped::kLeave && !mStack.empty() &&
+        mStack.back().first == tag) {
+      mOut << tag << " [" << (time - mStack.back().second) << ']';
+      mStack.pop_back();
     }
 
     else {
-      if (!stack.empty())
-        out << '\t';
-      out << i.mTag << " [" << (i.mTime - last) << ']';
-      if (info) {
-        if (info == &Timing::Scope::gEnterInfo)
-          stack.push_back(&i);
+      if (!mStack.empty())
+        mOut << '\t';
+      mOut << tag << " [" << (time - mLast) << ']';
+      if (hasInfo) {
+        if (kind == Timing::Mapped::kEnter)
+          mStack.emplace_back(tag, time);
         else
-          out << " : " << info->info();
+          mOut << " : " << info();
       }
-      out << '\n';
+      mOut << '\n';
     }
 
-    last = i.mTime;
+    mLast = time;
+  }
+
+private:
+  std::ostream& mOut;
+  Timing::Clock::time_point mLast;
+  std::vector<std::pair<std::string_view, Timing::Clock::time_point>> mStack;
+};
+
+} // namespace
+
+std::ostream&
+operator<<(std::ostream& out, const My::Timing& prof)
+{
+  using namespace My;
+
+  Printer print(out, prof.initial());
+  for (auto&& i : prof) {
+    auto* info = i.get_info();
+    auto kind = info == &Timing::Scope::gEnterInfo   ? Timing::Mapped::kEnter
+                : info == &Timing::Scope::gLeaveInfo ? Timing::Mapped::kLeave
+                                                     : Timing::Mapped::kPlain;
+    print(i.tag(), i.mTime, kind, info, [&] { return info->info(); });
   }
 
   return out;
 }
 
+std::ostream&
+operator<<(std::ostream& out, const My::Timing::Mapped& file)
+{
+  Printer print(out, file.initial());
+  for (auto&& i : file)
+    print(i.mTag, i.mTime, i.mKind, i.mInfo.data(), [&] { return i.mInfo; });
+  return out;
+}
+
 namespace My {
 
+TscClock::Calib
+TscClock::calibrate() noexcept
+{
+  // 在读 steady_clock 前后各读一次计数取中点，缩小两者之间的误差
+  auto sample = [](std::uint64_t& t) {
+    auto before = ticks();
+    auto ns = sc::steady_clock::now().time_since_epoch();
+    auto after = ticks();
+    t = before + (after - before) / 2;
+    return std::int64_t(sc::duration_cast<sc::nanoseconds>(ns).count());
+  };
+
+  std::uint64_t t0, t1;
+  auto ns0 = sample(t0);
+  std::this_thread::sleep_for(sc::milliseconds(10));
+  auto ns1 = sample(t1);
+
+  auto mult = (long double)(ns1 - ns0) * 4294967296.0L / (t1 - t0);
+  return { t1, ns1, std::uint64_t(mult) };
+}
+
+namespace {
+
+std::atomic<std::uint64_t> gSeqId{ 1 };
+
+/// 是否设置了监视筛选器，关闭时默认的 monitor 只读这一个变量
+std::atomic<bool> gMonitoring{ false };
+
+/**
+ * @brief 标签的注册表，首次使用时创建且永不销毁，以便静态初始化和析构期间
+ * 也能使用。
+ *
+ * 标签的内容按编号存放在容量倍增的段中，段一旦分配就不再移动，按编号读取时
+ * 不加锁。监视筛选器在标签注册时或者筛选器改变时对标签匹配一次，结果与内容
+ * 存放在一起。
+ */
+struct TagRegistry
+{
+  static constexpr std::size_t kFirst = 64; ///< 第一段的标签数
+  static constexpr std::size_t kSegs = 32;
+
+  struct Tag
+  {
+    const char* mName;
+    std::atomic<bool> mMonitored{ false };
+  };
+
+  std::mutex mMutex;
+  std::unordered_map<std::string_view, Timing::TagId> mIds;
+  std::atomic<Tag*> mSegs[kSegs]{};
+  std::atomic<Timing::TagId> mCount{ 0 };
+  std::unique_ptr<std::regex> mFilter;
+
+  static TagRegistry& get()
+  {
+    static auto* gRegistry = [] {
+      auto* reg = new TagRegistry;
+      char re[32];
+      size_t len;
+      getenv_s(&len, re, sizeof(re), "TIMING_MONITOR_FILTER");
+      reg->filter(len ? re : nullptr);
+      reg->find(""); // 编号 0 是空标签
+      return reg;
+    }();
+    return *gRegistry;
+  }
+
+  /**
+   * @brief 编号所在的段和段内的位置，第 s 段有 kFirst << s 个标签。
+   */
+  static std::size_t locate(Timing::TagId id, std::size_t& offset) noexcept
+  {
+    auto n = id / kFirst + 1;
+#ifdef _MSC_VER
+    unsigned long s;
+    _BitScanReverse64(&s, n);
+#else
+    std::size_t s = 63 - __builtin_clzll(n);
+#endif
+    offset = id - kFirst * ((std::size_t(1) << s) - 1);
+    return s;
+  }
+
+  Timing::TagId find(const char* name)
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (auto it = mIds.find(name); it != mIds.end())
+      return it->second;
+
+    auto id = mCount.load(std::memory_order_relaxed);
+    std::size_t offset;
+    auto s = locate(id, offset);
+    auto* seg = mSegs[s].load(std::memory_order_relaxed);
+    if (!seg) {
+      seg = new Tag[kFirst << s];
+      mSegs[s].store(seg, std::memory_order_release);
+    }
+
+    auto len = std::strlen(name);
+    auto* copy = new char[len + 1];
+    std::memcpy(copy, name, len + 1);
+    seg[offset].mName = copy;
+    seg[offset].mMonitored.store(mFilter && std::regex_match(copy, *mFilter),
+                                 std::memory_order_relaxed);
+    mIds.emplace(std::string_view(copy, len), id);
+    mCount.store(id + 1, std::memory_order_release);
+    return id;
+  }
+
+  Tag& tag(Timing::TagId id) noexcept
+  {
+    std::size_t offset;
+    auto s = locate(id, offset);
+    return mSegs[s].load(std::memory_order_acquire)[offset];
+  }
+
+  const char* name(Timing::TagId id) noexcept { return tag(id).mName; }
+
+  /**
+   * @brief 换用新的筛选器，重新匹配所有已注册的标签。
+   */
+  void filter(const char* regex)
+  {
+    auto re = regex && *regex ? std::make_unique<std::regex>(regex) : nullptr;
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFilter = std::move(re);
+    auto n = mCount.load(std::memory_order_relaxed);
+    for (Timing::TagId id = 0; id < n; ++id) {
+      auto& t = tag(id);
+      t.mMonitored.store(mFilter && std::regex_match(t.mName, *mFilter),
+                         std::memory_order_relaxed);
+    }
+    gMonitoring.store(mFilter != nullptr, std::memory_order_relaxed);
+  }
+};
+
+/// 本线程查过的标签，键是注册表中的字符串
+thread_local std::unordered_map<std::string_view, Timing::TagId> gtTagIds;
+
+} // namespace
+
+Timing::TagId
+Timing::tag_id(const char* name) noexcept(false)
+{
+  if (auto it = gtTagIds.find(name); it != gtTagIds.end())
+    return it->second;
+
+  auto& reg = TagRegistry::get();
+  auto id = reg.find(name);
+  gtTagIds.emplace(reg.name(id), id);
+  return id;
+}
+
+const char*
+Timing::tag_name(TagId id) noexcept
+{
+  assert(id < tag_count());
+  return TagRegistry::get().name(id);
+}
+
+Timing::TagId
+Timing::tag_count() noexcept
+{
+  return TagRegistry::get().mCount.load(std::memory_order_acquire);
+}
+
+void
+Timing::monitor_filter(const char* regex) noexcept(false)
+{
+  TagRegistry::get().filter(regex);
+}
+
+/**
+ * @brief 缓冲区中的一块，写入方发布了条目之后才增加 mSize。
+ */
+struct Timing::Seq::Chunk
+{
+  std::atomic<Chunk*> mNext{ nullptr }; ///< 写满之后才会链接下一块
+  const std::size_t mCapacity;
+  std::atomic<std::size_t> mSize{ 0 };
+
+  explicit Chunk(std::size_t capacity) noexcept
+    : mCapacity(capacity)
+  {
+  }
+
+  Entry* entries() noexcept { return reinterpret_cast<Entry*>(this + 1); }
+};
+
+/**
+ * @brief 环中的一格，读者用序号校验内容，发现正在或已经被覆盖就丢弃。
+ */
+struct Timing::Seq::Slot
+{
+  std::atomic<std::uint64_t> mSeq{ 0 }; ///< 为 2n+2 时存放第 n 条，奇数表示正在写
+  std::atomic<TagId> mTag{ 0 };
+  std::atomic<Clock::rep> mTime{ 0 };
+  std::atomic<Info*> mInfo{ nullptr };
+};
+
+/**
+ * @brief 一个线程在一个序列上的缓冲区，由容量倍增的块组成，飞行记录器模式下
+ * 则是固定大小的环。
+ *
+ * 只有所属的线程会追加，读者可以并发地从头遍历；块中的条目和块本身都在序列
+ * 析构时才释放。
+ */
+struct Timing::Seq::Arena
+{
+  static_assert(alignof(Entry) <= alignof(Chunk));
+
+  static constexpr std::size_t kFirst = 16;  ///< 第一块的条目数
+  static constexpr std::size_t kMax = 4096; ///< 块的条目数上限
+
+  const std::uint32_t mThread; ///< 所属线程的编号
+  Arena* mNext{ nullptr };     ///< 序列上的下一个缓冲区
+  std::atomic<Chunk*> mFirst{ nullptr };
+  Chunk* mLast{ nullptr }; ///< 只有所属的线程访问
+
+  const std::unique_ptr<Slot[]> mSlots; ///< 环，普通模式下为空
+  const std::size_t mMask;
+  std::atomic<std::uint64_t> mCount{ 0 }; ///< 环中累计写入的条目数
+  Entry mScratch;                        ///< 环模式下返回给记录者的副本
+
+  Arena(std::uint32_t thread, std::size_t ring)
+    : mThread(thread)
+    , mSlots(ring ? new Slot[ring] : nullptr)
+    , mMask(ring - 1)
+    , mScratch({}, 0, nullptr, false)
+  {
+  }
+
+  ~Arena() noexcept
+  {
+    for (auto* c = mFirst.load(std::memory_order_relaxed); c;) {
+      auto size = c->mSize.load(std::memory_order_relaxed);
+      for (std::size_t i = 0; i < size; ++i)
+        c->entries()[i].~Entry();
+      auto* next = c->mNext.load(std::memory_order_relaxed);
+      c->~Chunk();
+      ::operator delete(c);
+      c = next;
+    }
+  }
+
+  Entry& append(Clock::time_point time,
+                TagId tag,
+                Info* info,
+                bool owned)
+  {
+    if (mSlots)
+      return overwrite(time, tag, info, owned);
+
+    auto* c = mLast;
+    auto n = c ? c->mSize.load(std::memory_order_relaxed) : 0;
+    if (!c || n == c->mCapacity)
+      c = grow(), n = 0;
+    auto* entry = new (c->entries() + n) Entry(time, tag, info, owned);
+    c->mSize.store(n + 1, std::memory_order_release);
+    return *entry;
+  }
+
+  Chunk* grow()
+  {
+    auto cap = mLast ? std::min(mLast->mCapacity * 2, kMax) : kFirst;
+    auto* c = new (::operator new(sizeof(Chunk) + cap * sizeof(Entry)))
+      Chunk(cap);
+    (mLast ? mLast->mNext : mFirst).store(c, std::memory_order_release);
+    return mLast = c;
+  }
+
+  Entry& overwrite(Clock::time_point time,
+                   TagId tag,
+                   Info* info,
+                   bool owned)
+  {
+    // 环中的条目会被覆盖，无法托管附加信息，托管的直接释放
+    if (owned)
+      delete info, info = nullptr;
+
+    auto n = mCount.load(std::memory_order_relaxed);
+    auto& slot = mSlots[n & mMask];
+    slot.mSeq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.mTag.store(tag, std::memory_order_relaxed);
+    slot.mTime.store(time.time_since_epoch().count(),
+                     std::memory_order_relaxed);
+    slot.mInfo.store(info, std::memory_order_relaxed);
+    slot.mSeq.store(2 * n + 2, std::memory_order_release);
+    mCount.store(n + 1, std::memory_order_release);
+
+    return *new (&mScratch) Entry(time, tag, info, false);
+  }
+
+  /**
+   * @brief 把环中仍然有效的条目按顺序追加到 to。
+   */
+  void copy_to(Arena& to) const
+  {
+    auto n = mCount.load(std::memory_order_acquire);
+    for (auto i = n > mMask + 1 ? n - mMask - 1 : 0; i < n; ++i) {
+      auto& slot = mSlots[i & mMask];
+      auto seq = slot.mSeq.load(std::memory_order_acquire);
+      if (seq != 2 * i + 2)
+        continue; // 已经被覆盖
+      auto tag = slot.mTag.load(std::memory_order_relaxed);
+      auto time = slot.mTime.load(std::memory_order_relaxed);
+      auto* info = slot.mInfo.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.mSeq.load(std::memory_order_relaxed) != seq)
+        continue; // 读的同时被覆盖了
+      to.append(Clock::time_point(Clock::duration(time)), tag, info, false);
+    }
+  }
+};
+
+namespace {
+
+/**
+ * @brief 本线程用过的所有序列的缓冲区，序列析构后在注册新缓冲区时顺便清理。
+ */
+struct Local
+{
+  std::uint64_t mId;
+  std::weak_ptr<Timing::Seq> mSeq;
+  Timing::Seq::Arena* mArena;
+};
+
+thread_local std::vector<Local> gtLocals;
+
+std::atomic<std::uint32_t> gThreads{ 0 };
+
+/// 本线程的编号，导出时用作线程号
+thread_local const std::uint32_t gtThread = gThreads.fetch_add(1) + 1;
+
+/// 最近一次用到的缓冲区，同一序列连续记录时免去查找
+thread_local std::uint64_t gtLastId{ 0 };
+thread_local Timing::Seq::Arena* gtLastArena{ nullptr };
+
+} // namespace
+
+Timing::Seq::Seq(std::size_t ring, Clock::time_point initial)
+  : mInitial(initial)
+  , mId(gSeqId.fetch_add(1, std::memory_order_relaxed))
+  , mRing(ring ? std::size_t(1) << std::ilogb(2 * ring - 1) : 0)
+{
+}
+
+Timing::Seq::~Seq() noexcept
+{
+  // 析构只发生在最后持有 shared_ptr 的单个线程中，其它线程的追加都已可见
+  for (auto* a = mArenas.load(std::memory_order_acquire); a;) {
+    auto* next = a->mNext;
+    delete a;
+    a = next;
+  }
+}
+
+Timing::Entry&
+Timing::Seq::append(const std::shared_ptr<Seq>& self,
+                    Clock::time_point time,
+                    TagId tag,
+                    Info* info,
+                    bool owned)
+{
+  if (gtLastId == self->mId)
+    return gtLastArena->append(time, tag, info, owned);
+
+  Arena* arena = nullptr;
+  for (auto& i : gtLocals) {
+    if (i.mId == self->mId) {
+      arena = i.mArena;
+      break;
+    }
+  }
+
+  if (!arena) {
+    gtLocals.erase(std::remove_if(gtLocals.begin(),
+                                  gtLocals.end(),
+                                  [](auto& i) { return i.mSeq.expired(); }),
+                   gtLocals.end());
+
+    auto holder = std::make_unique<Arena>(gtThread, self->mRing);
+    gtLocals.push_back({ self->mId, self, holder.get() });
+    arena = holder.release();
+    arena->mNext = self->mArenas.load(std::memory_order_relaxed);
+    while (!self->mArenas.compare_exchange_weak(
+      arena->mNext, arena, std::memory_order_release))
+      ;
+  }
+
+  gtLastId = self->mId;
+  gtLastArena = arena;
+  return arena->append(time, tag, info, owned);
+}
+
+std::shared_ptr<Timing::Seq>
+Timing::Seq::snapshot() const
+{
+  auto snap = std::make_shared<Seq>(0, mInitial);
+  for (auto* a = mArenas.load(std::memory_order_acquire); a; a = a->mNext) {
+    auto copy = std::make_unique<Arena>(a->mThread, 0);
+    a->copy_to(*copy);
+    copy->mNext = snap->mArenas.load(std::memory_order_relaxed);
+    snap->mArenas.store(copy.release(), std::memory_order_relaxed);
+  }
+  return snap;
+}
+
+Timing::Iterator::Iterator(const Seq& seq) noexcept
+{
+  auto& from = seq.mRing ? *(mSnapshot = seq.snapshot()) : seq;
+  for (auto* a = from.mArenas.load(std::memory_order_acquire); a;
+       a = a->mNext) {
+    auto* c = a->mFirst.load(std::memory_order_acquire);
+    if (c && c->mSize.load(std::memory_order_acquire))
+      mHeap.push_back({ c->entries(), c, 0, a->mThread });
+  }
+  std::make_heap(mHeap.begin(), mHeap.end(), later);
+}
+
+Timing::Iterator&
+Timing::Iterator::operator++() noexcept
+{
+  std::pop_heap(mHeap.begin(), mHeap.end(), later);
+  if (next(mHeap.back()))
+    std::push_heap(mHeap.begin(), mHeap.end(), later);
+  else
+    mHeap.pop_back();
+  return *this;
+}
+
+bool
+Timing::Iterator::next(Cursor& cur) noexcept
+{
+  if (++cur.mIndex < cur.mChunk->mSize.load(std::memory_order_acquire)) {
+    cur.mEntry = cur.mChunk->entries() + cur.mIndex;
+    return true;
+  }
+
+  auto* c = cur.mChunk->mNext.load(std::memory_order_acquire);
+  if (!c || !c->mSize.load(std::memory_order_acquire))
+    return false;
+  cur = { c->entries(), c, 0, cur.mThread };
+  return true;
+}
+
 Timing
-Timing::from_json(const bj::value& json,
-                  std::set<std::string>& tags) noexcept(false)
+Timing::from_json(const bj::value& json) noexcept(false)
 {
   const auto& arr = json.as_array();
 
@@ -58,10 +576,9 @@ Timing::from_json(const bj::value& json,
   for (auto&& i : arr) {
     const auto& ent = i.as_array();
 
-    const auto* tag =
-      tags.emplace(ent.at(0).as_string().c_str()).first->c_str();
+    auto tag = tag_id(ent.at(0).as_string().c_str());
 
-    auto time = prof.mHead->mTime +
+    auto time = prof.mSeq->mInitial +
                 sc::duration_cast<Clock::duration>(
                   sc::duration<double, std::nano>(ent.at(1).as_double()));
 
@@ -71,32 +588,28 @@ Timing::from_json(const bj::value& json,
     else
       info = new StrInfo(ent.at(2).as_string().c_str());
 
-    prof.mHead->mNext.store(
-      new Entry(time,
-                tag,
-                info,
-                bool(info),
-                prof.mHead->mNext.load(std::memory_order_relaxed)),
-      std::memory_order_relaxed);
+    Seq::append(prof.mSeq, time, tag, info, bool(info));
   }
 
   return prof;
 }
 
+Timing
+Timing::snapshot() const
+{
+  if (!mSeq->mRing)
+    return *this;
+  return Timing(mSeq->snapshot());
+}
+
 Timing::Entry&
-Timing::operator()(const char* tag, Info* info, bool owned) noexcept
+Timing::operator()(TagId tag, Info* info, bool owned) noexcept
 {
   assert(info || !owned); // info为空时，owned必须为false
 
-  auto* entry = new Entry(Clock::now(), tag, info, owned, nullptr);
-  auto* next = mHead->mNext.load(std::memory_order_relaxed);
-  do {
-    entry->mNext.store(next, std::memory_order_relaxed);
-  } while (!mHead->mNext.compare_exchange_weak(
-    next, entry, std::memory_order_relaxed));
-
-  monitor(*entry);
-  return *entry;
+  auto& entry = Seq::append(mSeq, Clock::now(), tag, info, owned);
+  monitor(entry);
+  return entry;
 }
 
 bj::value
@@ -106,35 +619,431 @@ Timing::to_jval() const noexcept(false)
 
   for (auto&& i : *this) {
     bj::array ent;
-    ent.emplace_back(i.mTag);
-    sc::duration<double, std::nano> dura(i.mTime - mHead->mTime);
+    ent.emplace_back(i.tag());
+    sc::duration<double, std::nano> dura(i.mTime - initial());
     ent.emplace_back(dura.count());
-    if (i.mInfo)
-      ent.emplace_back(i.mInfo->info());
+    if (auto* info = i.get_info())
+      ent.emplace_back(info->info());
     arr.emplace_back(std::move(ent));
   }
 
   return arr;
 }
 
+namespace {
+
+/**
+ * @brief 以 JSON 字符串字面量的形式追加。
+ */
 void
-Timing::monitor(Entry& entry) noexcept
+append_json(std::string& out, const char* str)
+{
+  out += '"';
+  for (; *str; ++str) {
+    switch (auto c = *str) {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\r':
+        out += "\\r";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      default:
+        if (std::uint8_t(c) < 0x20) {
+          char esc[8];
+          std::snprintf(esc, sizeof(esc), "\\u%04x", c);
+          out += esc;
+        } else
+          out += c;
+    }
+  }
+  out += '"';
+}
+
+/**
+ * @brief 追加十进制整数。
+ */
+void
+append_int(std::string& out, std::int64_t i)
+{
+  char digits[24];
+  out.append(digits, std::to_chars(digits, std::end(digits), i).ptr);
+}
+
+} // namespace
+
+void
+Timing::to_trace(const CFile64& file) const noexcept(false)
+{
+  constexpr std::size_t kFlush = 64 << 10; // 攒够这么多再写出
+
+#ifdef _WIN32
+  auto pid = _getpid();
+#else
+  auto pid = getpid();
+#endif
+
+  std::string buf = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  const char* sep = "\n";
+  for (auto it = begin(), e = end(); it != e; ++it) {
+    auto* info = it->get_info();
+    char ph = info == &Scope::gEnterInfo   ? 'B'
+              : info == &Scope::gLeaveInfo ? 'E'
+                                           : 'i';
+
+    buf += sep;
+    sep = ",\n";
+    buf += "{\"name\":";
+    append_json(buf, it->tag());
+    buf += ",\"ph\":\"";
+    buf += ph;
+
+    // 时刻以微秒为单位，保留到纳秒，用整数运算格式化比 printf 快得多
+    auto ns = sc::nanoseconds(it->mTime - initial()).count();
+    buf += "\",\"ts\":";
+    if (ns < 0)
+      buf += '-', ns = -ns;
+    append_int(buf, ns / 1000);
+    char frac[] = { '.', char('0' + ns / 100 % 10), char('0' + ns / 10 % 10),
+                    char('0' + ns % 10) };
+    buf.append(frac, sizeof(frac));
+
+    buf += ",\"pid\":";
+    append_int(buf, pid);
+    buf += ",\"tid\":";
+    append_int(buf, it.thread());
+    if (ph == 'i') {
+      buf += ",\"s\":\"t\"";
+      if (info) {
+        buf += ",\"args\":{\"info\":";
+        append_json(buf, info->info().c_str());
+        buf += '}';
+      }
+    }
+    buf += '}';
+
+    if (buf.size() >= kFlush) {
+      file.write(buf.data(), buf.size(), 1);
+      buf.clear();
+    }
+  }
+
+  buf += "\n]}\n";
+  file.write(buf.data(), buf.size(), 1);
+}
+
+namespace {
+
+constexpr char kMagic[8] = { 'M', 'y', 'T', 'i', 'm', 'i', 'n', 'g' };
+constexpr std::size_t kHeadBytes = 24;  ///< 文件头的字节数
+constexpr std::size_t kBlockBytes = 12; ///< 块头的字节数
+
+void
+put_u32(std::string& out, std::uint32_t v)
+{
+  for (int i = 0; i < 4; ++i, v >>= 8)
+    out += char(v & 0xff);
+}
+
+void
+put_u64(std::string& out, std::uint64_t v)
+{
+  put_u32(out, std::uint32_t(v));
+  put_u32(out, std::uint32_t(v >> 32));
+}
+
+void
+put_varint(std::string& out, std::uint64_t v)
+{
+  for (; v >= 0x80; v >>= 7)
+    out += char(v | 0x80);
+  out += char(v);
+}
+
+std::uint32_t
+get_u32(const std::uint8_t* p) noexcept
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | std::uint32_t(p[3]) << 24;
+}
+
+std::uint64_t
+get_u64(const std::uint8_t* p) noexcept
+{
+  return get_u32(p) | std::uint64_t(get_u32(p + 4)) << 32;
+}
+
+std::uint64_t
+get_varint(const std::uint8_t*& p, const std::uint8_t* end) noexcept(false)
+{
+  std::uint64_t v = 0;
+  for (unsigned shift = 0; p != end && shift < 64; shift += 7) {
+    auto b = *p++;
+    v |= std::uint64_t(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return v;
+  }
+  throw My::err::Lit("corrupted Timing binary file");
+}
+
+} // namespace
+
+void
+Timing::to_binary(const CFile64& file) const noexcept(false)
+{
+  std::string head(kMagic, sizeof(kMagic));
+  put_u32(head, Mapped::kVersion);
+  put_u32(head, 0);
+  put_u64(head, sc::nanoseconds(initial().time_since_epoch()).count());
+  file.write(head.data(), head.size(), 1);
+
+  std::vector<std::uint32_t> local; // 全局编号到文件内编号加一，0 表示未出现
+  std::uint32_t tags = 0, dictN = 0, n = 0;
+  std::string dict, cols[4];
+  auto bytes = [&] {
+    return cols[0].size() + cols[1].size() + cols[2].size() + cols[3].size();
+  };
+
+  auto flush = [&] {
+    head.clear();
+    if (dictN) {
+      put_u32(head, 'D');
+      put_u32(head, dictN);
+      put_u32(head, dict.size());
+      file.write(head.data(), head.size(), 1);
+      file.write(dict.data(), dict.size(), 1);
+      head.clear(), dict.clear(), dictN = 0;
+    }
+    if (n) {
+      put_u32(head, 'R');
+      put_u32(head, n);
+      put_u32(head, 12 + bytes());
+      for (int i = 0; i < 3; ++i)
+        put_u32(head, cols[i].size());
+      file.write(head.data(), head.size(), 1);
+      for (auto& col : cols)
+        file.write(col.data(), col.size(), 1), col.clear();
+      n = 0;
+    }
+  };
+
+  auto last = initial();
+  for (auto it = begin(); it != end(); ++it) {
+    auto tag = it->mTag;
+    if (tag >= local.size())
+      local.resize(tag + 1);
+    if (!local[tag]) {
+      local[tag] = ++tags;
+      std::string_view name(it->tag());
+      put_varint(dict, name.size());
+      dict += name;
+      ++dictN;
+    }
+    put_varint(cols[0], local[tag] - 1);
+    put_varint(cols[1], it.thread());
+
+    auto ns = sc::duration_cast<sc::nanoseconds>(it->mTime - last).count();
+    put_varint(cols[2], std::uint64_t(ns) << 1 ^ std::uint64_t(ns >> 63));
+    last = it->mTime;
+
+    auto* info = it->get_info();
+    if (!info)
+      put_varint(cols[3], 0);
+    else if (info == &Scope::gEnterInfo)
+      put_varint(cols[3], Mapped::kEnter);
+    else if (info == &Scope::gLeaveInfo)
+      put_varint(cols[3], Mapped::kLeave);
+    else {
+      auto str = info->info();
+      put_varint(cols[3], str.size() + 3);
+      cols[3] += str;
+    }
+
+    ++n;
+    if (dict.size() + bytes() >= 65536)
+      flush();
+  }
+  flush();
+}
+
+Timing::Mapped::Mapped(const CFile64& file) noexcept(false)
+{
+  file.flush();
+  mBytes = file.size();
+  if (mBytes) {
+#ifdef _WIN32
+    auto fh = HANDLE(_get_osfhandle(_fileno(file)));
+    auto mh = CreateFileMapping(fh, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mh) {
+      mData = static_cast<const std::uint8_t*>(
+        MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0));
+      CloseHandle(mh); // 视图持有映射对象
+    }
+    if (!mData)
+      throw err::Errno(EIO);
+#else
+    auto* p = mmap(nullptr, mBytes, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (p == MAP_FAILED)
+      throw err::Errno(errno);
+    mData = static_cast<const std::uint8_t*>(p);
+#endif
+  }
+
+  try {
+    if (mBytes < kHeadBytes || std::memcmp(mData, kMagic, sizeof(kMagic)))
+      throw err::Lit("not a Timing binary file");
+    if (get_u32(mData + 8) != kVersion)
+      throw err::Lit("unsupported Timing binary version");
+    auto ns = sc::nanoseconds(std::int64_t(get_u64(mData + 16)));
+    mInitial = Clock::time_point(sc::duration_cast<Clock::duration>(ns));
+
+    const auto* end = mData + mBytes;
+    for (auto* p = mData + kHeadBytes; std::size_t(end - p) >= kBlockBytes;) {
+      auto kind = get_u32(p);
+      auto count = get_u32(p + 4);
+      auto bytes = get_u32(p + 8);
+      if (std::size_t(end - p - kBlockBytes) < bytes)
+        break; // 写出中途被打断的末块
+
+      const auto* q = p + kBlockBytes;
+      const auto* last = q + bytes;
+      if (kind == 'D') {
+        for (std::uint32_t i = 0; i < count; ++i) {
+          auto len = get_varint(q, last);
+          if (len > std::size_t(last - q))
+            throw err::Lit("corrupted Timing binary file");
+          mTags.emplace_back(reinterpret_cast<const char*>(q), len);
+          q += len;
+        }
+      } else if (kind == 'R' && count) {
+        if (bytes < 12 || std::uint64_t(get_u32(q)) + get_u32(q + 4) +
+                              get_u32(q + 8) >
+                            bytes - 12)
+          throw err::Lit("corrupted Timing binary file");
+        mBlocks.push_back(p);
+        mSize += count;
+      }
+      p = last;
+    }
+  } catch (...) {
+    unmap();
+    throw;
+  }
+}
+
+Timing::Mapped::~Mapped() noexcept
 {
-  static const auto kReportFilter = []() -> std::unique_ptr<std::regex> {
-    char re[32];
-    size_t len;
-    getenv_s(&len, re, sizeof(re), "TIMING_MONITOR_FILTER");
-    if (len == 0)
-      return nullptr;
-    return std::make_unique<std::regex>(re);
-  }();
+  unmap();
+}
 
-  if (kReportFilter == nullptr || !std::regex_match(entry.mTag, *kReportFilter))
+void
+Timing::Mapped::unmap() noexcept
+{
+  if (!mData)
     return;
+#ifdef _WIN32
+  UnmapViewOfFile(mData);
+#else
+  munmap(const_cast<std::uint8_t*>(mData), mBytes);
+#endif
+  mData = nullptr;
+}
+
+Timing::Mapped::Iterator::Iterator(const Mapped& file) noexcept(false)
+  : mFile(&file)
+  , mRemain(file.mSize)
+{
+  if (mRemain) {
+    enter(0);
+    decode();
+  }
+}
+
+Timing::Mapped::Iterator&
+Timing::Mapped::Iterator::operator++() noexcept(false)
+{
+  if (!--mRemain)
+    return *this;
+  if (!--mLeft)
+    enter(++mBlock);
+  decode();
+  return *this;
+}
 
-  std::cout << (entry.mTime - initial()) << " " << entry.mTag;
-  if (entry.mInfo)
-    std::cout << " " << entry.mInfo->info();
+void
+Timing::Mapped::Iterator::enter(std::size_t block) noexcept
+{
+  const auto* p = mFile->mBlocks[mBlock = block];
+  mLeft = get_u32(p + 4);
+  const auto* end = p + kBlockBytes + get_u32(p + 8);
+  p += kBlockBytes;
+  const auto* col = p + 12;
+  for (int i = 0; i < 3; ++i) {
+    mCols[i] = col;
+    mEnds[i] = col += get_u32(p + 4 * i);
+  }
+  mCols[3] = col;
+  mEnds[3] = end;
+}
+
+void
+Timing::Mapped::Iterator::decode() noexcept(false)
+{
+  auto& tags = mFile->mTags;
+  auto tag = get_varint(mCols[0], mEnds[0]);
+  if (tag >= tags.size())
+    throw err::Lit("corrupted Timing binary file");
+  mRecord.mTag = tags[tag];
+  mRecord.mThread = std::uint32_t(get_varint(mCols[1], mEnds[1]));
+
+  auto delta = get_varint(mCols[2], mEnds[2]);
+  mNs += std::int64_t(delta >> 1 ^ (0 - (delta & 1)));
+  mRecord.mTime =
+    mFile->mInitial + sc::duration_cast<Clock::duration>(sc::nanoseconds(mNs));
+
+  auto info = get_varint(mCols[3], mEnds[3]);
+  switch (info) {
+    case 0:
+      mRecord.mKind = kPlain;
+      mRecord.mInfo = {};
+      break;
+    case kEnter:
+      mRecord.mKind = kEnter;
+      mRecord.mInfo = "ENTER";
+      break;
+    case kLeave:
+      mRecord.mKind = kLeave;
+      mRecord.mInfo = "LEAVE";
+      break;
+    default:
+      if (info - 3 > std::size_t(mEnds[3] - mCols[3]))
+        throw err::Lit("corrupted Timing binary file");
+      mRecord.mKind = kPlain;
+      mRecord.mInfo = { reinterpret_cast<const char*>(mCols[3]), info - 3 };
+      mCols[3] += info - 3;
+  }
+}
+
+
+void
+Timing::monitor(Entry& entry) noexcept
+{
+  if (!gMonitoring.load(std::memory_order_relaxed) ||
+      !TagRegistry::get().tag(entry.mTag).mMonitored.load(
+        std::memory_order_relaxed))
+    return;
+
+  using util::operator<<; // 免得被 CFile64 的 operator<< 遮蔽
+  std::cout << (entry.mTime - initial()) << " " << entry.tag();
+  if (auto* info = entry.get_info())
+    std::cout << " " << info->info();
   std::cout << '\n';
 }
 
@@ -145,17 +1054,6 @@ Timing::Entry::~Entry() noexcept
 {
   if (info_owned())
     delete get_info();
-
-  // 无需原子操作，因为析构操作只发生在最后持有 shared_ptr 的单个线程中。
-  auto* next = mNext.load(std::memory_order_relaxed);
-  if (next) {
-    while (next != nullptr) {
-      auto* nextnext = next->mNext.load(std::memory_order_relaxed);
-      next->mNext.store(nullptr, std::memory_order_relaxed);
-      delete next; // 先将 next 置空，防止陷入递归析构。
-      next = nextnext;
-    }
-  }
 }
 
 std::string
@@ -170,4 +1068,218 @@ Timing::Scope::LeaveInfo::info() noexcept
   return "LEAVE";
 }
 
+void
+Timing::Histogram::record(std::uint64_t value) noexcept
+{
+  mBuckets[index(value)].fetch_add(1, std::memory_order_relaxed);
+  mSum.fetch_add(value, std::memory_order_relaxed);
+
+  auto min = mMin.load(std::memory_order_relaxed);
+  while (value < min &&
+         !mMin.compare_exchange_weak(min, value, std::memory_order_relaxed))
+    ;
+  auto max = mMax.load(std::memory_order_relaxed);
+  while (value > max &&
+         !mMax.compare_exchange_weak(max, value, std::memory_order_relaxed))
+    ;
+}
+
+Timing::Histogram::Summary
+Timing::Histogram::summary() const noexcept
+{
+  std::uint64_t counts[kBuckets];
+  std::uint64_t total = 0;
+  for (std::size_t i = 0; i < kBuckets; ++i)
+    total += counts[i] = mBuckets[i].load(std::memory_order_relaxed);
+
+  Summary ret{};
+  if (!total)
+    return ret;
+
+  ret.mCount = total;
+  ret.mMin = mMin.load(std::memory_order_relaxed);
+  ret.mMax = mMax.load(std::memory_order_relaxed);
+  ret.mMean = double(mSum.load(std::memory_order_relaxed)) / total;
+
+  const double kQuantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+  std::uint64_t* outs[] = { &ret.mP50, &ret.mP90, &ret.mP99, &ret.mP999 };
+  std::size_t q = 0;
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < kBuckets && q < std::size(outs); ++i) {
+    seen += counts[i];
+    for (; q < std::size(outs); ++q) {
+      auto rank = std::max(std::uint64_t(std::ceil(kQuantiles[q] * total)),
+                           std::uint64_t(1));
+      if (seen < rank)
+        break;
+      *outs[q] = std::min(upper(i), ret.mMax);
+    }
+  }
+  return ret;
+}
+
+std::size_t
+Timing::Histogram::index(std::uint64_t value) noexcept
+{
+  if (value < 2 * kSub)
+    return value;
+#ifdef _MSC_VER
+  unsigned long msb;
+  _BitScanReverse64(&msb, value);
+#else
+  unsigned msb = 63 - __builtin_clzll(value);
+#endif
+  auto shift = msb - kSubBits;
+  return (std::size_t(shift) << kSubBits) + (value >> shift);
+}
+
+std::uint64_t
+Timing::Histogram::upper(std::size_t index) noexcept
+{
+  if (index < 2 * kSub)
+    return index;
+  auto shift = index / kSub - 1;
+  auto top = std::uint64_t(index % kSub + kSub + 1) << shift;
+  return top - 1; // 最后一格的 top 溢出为 0，减一正好是最大值
+}
+
+bj::value
+Timing::Histogram::Summary::to_jval() const noexcept(false)
+{
+  bj::object obj;
+  obj.emplace("count", mCount);
+  obj.emplace("min", mMin);
+  obj.emplace("max", mMax);
+  obj.emplace("mean", mMean);
+  obj.emplace("p50", mP50);
+  obj.emplace("p90", mP90);
+  obj.emplace("p99", mP99);
+  obj.emplace("p999", mP999);
+  return obj;
+}
+
+/**
+ * @brief 以标签编号为键的直方图集合，被浅拷贝的 Stats 共享。
+ */
+struct Timing::Stats::Tags
+{
+  const std::uint64_t mId; ///< 用于在线程本地查找，不会重复
+  std::mutex mMutex;
+  std::map<TagId, std::unique_ptr<Histogram>> mHists;
+
+  Tags() noexcept
+    : mId(gSeqId.fetch_add(1, std::memory_order_relaxed))
+  {
+  }
+
+  /**
+   * @brief 查找标签的直方图，没有则创建，结果缓存在线程本地。
+   */
+  static Histogram& of(const std::shared_ptr<Tags>& self, TagId tag);
+};
+
+namespace {
+
+/**
+ * @brief 本线程尚未离开的作用域。
+ */
+struct Open
+{
+  std::uint64_t mId; ///< 所属 Stats::Tags 的编号
+  Timing::TagId mTag;
+  Timing::Clock::time_point mTime;
+};
+
+thread_local std::vector<Open> gtOpens;
+
+/**
+ * @brief 本线程查过的标签，Stats 析构后在缓存新标签时顺便清理。
+ */
+struct Known
+{
+  std::uint64_t mId;
+  std::weak_ptr<void> mTags;
+  Timing::TagId mTag;
+  Timing::Histogram* mHist;
+};
+
+thread_local std::vector<Known> gtKnowns;
+
+} // namespace
+
+Timing::Histogram&
+Timing::Stats::Tags::of(const std::shared_ptr<Tags>& self, TagId tag)
+{
+  for (auto& i : gtKnowns) {
+    if (i.mId == self->mId && i.mTag == tag)
+      return *i.mHist;
+  }
+
+  gtKnowns.erase(std::remove_if(gtKnowns.begin(),
+                                gtKnowns.end(),
+                                [](auto& i) { return i.mTags.expired(); }),
+                 gtKnowns.end());
+
+  Histogram* hist;
+  {
+    std::lock_guard<std::mutex> lock(self->mMutex);
+    auto& p = self->mHists[tag];
+    if (!p)
+      p = std::make_unique<Histogram>();
+    hist = p.get();
+  }
+  gtKnowns.push_back({ self->mId, self, tag, hist });
+  return *hist;
+}
+
+Timing::Stats::Stats(std::size_t ring)
+  : Timing(ring)
+  , mTags(std::make_shared<Tags>())
+{
+}
+
+std::map<std::string, Timing::Histogram::Summary>
+Timing::Stats::summary() const noexcept(false)
+{
+  std::map<std::string, Histogram::Summary> ret;
+  std::lock_guard<std::mutex> lock(mTags->mMutex);
+  for (auto& [tag, hist] : mTags->mHists)
+    ret.emplace(tag_name(tag), hist->summary());
+  return ret;
+}
+
+bj::value
+Timing::Stats::to_jval() const noexcept(false)
+{
+  bj::object obj;
+  for (auto& [tag, sum] : summary())
+    obj.emplace(tag, sum.to_jval());
+  return obj;
+}
+
+void
+Timing::Stats::monitor(Entry& entry) noexcept
+{
+  Timing::monitor(entry);
+
+  auto* info = entry.get_info();
+  if (info == &Scope::gEnterInfo) {
+    gtOpens.push_back({ mTags->mId, entry.mTag, entry.mTime });
+    return;
+  }
+  if (info != &Scope::gLeaveInfo)
+    return;
+
+  // 作用域在线程内严格嵌套，从栈顶往下找，跳过其它 Stats 的作用域
+  auto it = std::find_if(gtOpens.rbegin(), gtOpens.rend(), [&](auto& i) {
+    return i.mId == mTags->mId && i.mTag == entry.mTag;
+  });
+  if (it == gtOpens.rend())
+    return; // 进入时不是由本对象记录的
+  auto ns =
+    sc::duration_cast<sc::nanoseconds>(entry.mTime - it->mTime).count();
+  gtOpens.erase(std::next(it).base());
+  Tags::of(mTags, entry.mTag).record(ns > 0 ? ns : 0);
+}
+
 } // namespace My
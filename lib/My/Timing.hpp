@@ -4,26 +4,134 @@
 #include <atomic>
 #include <cassert>
 #include <chrono>
+#include <cstdint>
 #include <iomanip>
+#include <map>
 #include <memory>
 #include <set>
+#include <string_view>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#endif
 
 namespace boost::json {
 class value;
 };
 
 namespace My {
+
+class CFile64;
 class Timing;
+
+/**
+ * @brief 读取 CPU 时间戳计数器的时钟，比 high_resolution_clock 快一个数量级。
+ *
+ * 首次使用时以 steady_clock 为基准校准频率，要花大约 10 毫秒，可以在启动时
+ * 先调用一次 now() 预热。读数换算为与 steady_clock 同一纪元的纳秒，换算只是
+ * 一次乘法和移位。x86 上读 TSC，ARM64 上读虚拟计数器，其它平台退化为
+ * steady_clock。
+ */
+struct TscClock
+{
+  using duration = std::chrono::nanoseconds;
+  using rep = duration::rep;
+  using period = duration::period;
+  using time_point = std::chrono::time_point<TscClock>;
+
+  static constexpr bool is_steady = true;
+
+  /**
+   * @brief 校准的结果，计数 t 对应的纳秒数是 mBaseNs + (t - mBase) * mMult / 2^32。
+   */
+  struct Calib
+  {
+    std::uint64_t mBase;
+    std::int64_t mBaseNs;
+    std::uint64_t mMult;
+  };
+
+  /**
+   * @brief 读取原始计数，单位因 CPU 而异，用 to_duration 换算。
+   */
+  static std::uint64_t ticks() noexcept
+  {
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+    return __rdtsc();
+#elif defined(__i386__) || defined(__x86_64__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    std::uint64_t t;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(t));
+    return t;
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+  }
+
+  /**
+   * @brief 把原始计数之差换算为时长，需要推迟换算时配合 ticks 使用。
+   */
+  static duration to_duration(std::int64_t ticks) noexcept
+  {
+    return duration(scale(ticks, calib().mMult));
+  }
+
+  static time_point now() noexcept
+  {
+    auto& c = calib();
+    auto t = std::int64_t(ticks() - c.mBase);
+    return time_point(duration(c.mBaseNs + scale(t, c.mMult)));
+  }
+
+  /**
+   * @brief 校准结果，首次调用时校准。
+   */
+  static const Calib& calib() noexcept
+  {
+    static const Calib kCalib = calibrate();
+    return kCalib;
+  }
+
+private:
+  static Calib calibrate() noexcept;
+
+  static std::int64_t scale(std::int64_t ticks, std::uint64_t mult) noexcept
+  {
+#if defined(__SIZEOF_INT128__)
+    return std::int64_t((__int128(ticks) * mult) >> 32);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    std::int64_t hi;
+    auto lo = std::uint64_t(_mul128(ticks, std::int64_t(mult), &hi));
+    return std::int64_t(std::uint64_t(hi) << 32 | lo >> 32);
+#else
+    return std::int64_t(double(ticks) * double(mult) / 4294967296.0);
+#endif
+  }
+};
+
 } // namespace My
 
+/**
+ * @brief Timing、MY_TIMING 和 MY_NIMING 使用的时钟类型。
+ *
+ * 默认是 std::chrono::high_resolution_clock，在紧凑的循环中计时时可以改用
+ * My::TscClock 以免计时本身扰动被测的代码。它决定了 Timing::Clock，整个程序
+ * 必须一致，通常由 CMake 选项 MY_TIMING_TSC 设置。
+ */
+#ifndef MY_TIMING_CLOCK
+#define MY_TIMING_CLOCK std::chrono::high_resolution_clock
+#endif
+
 /**
  * @brief 计时宏，宏参数可以是表达式，也可以是语句块，返回纳秒级计时。
  */
 #define MY_TIMING(code)                                                        \
   [&]() {                                                                      \
-    auto __timing_begin__ = std::chrono::high_resolution_clock::now();         \
+    auto __timing_begin__ = MY_TIMING_CLOCK::now();                            \
     code;                                                                      \
-    auto __timing_end__ = std::chrono::high_resolution_clock::now();           \
+    auto __timing_end__ = MY_TIMING_CLOCK::now();                              \
     return std::chrono::duration_cast<std::chrono::nanoseconds>(               \
       __timing_end__ - __timing_begin__);                                      \
   }()
@@ -33,14 +141,24 @@ class Timing;
  */
 #define MY_NIMING(n, code)                                                     \
   [&]() {                                                                      \
-    auto __niming_begin__ = std::chrono::high_resolution_clock::now();         \
+    auto __niming_begin__ = MY_TIMING_CLOCK::now();                            \
     for (std::size_t __niming_n__ = 0; __niming_n__ < n; ++__niming_n__)       \
       code;                                                                    \
-    auto __niming_end__ = std::chrono::high_resolution_clock::now();           \
+    auto __niming_end__ = MY_TIMING_CLOCK::now();                              \
     return std::chrono::duration_cast<std::chrono::nanoseconds>(               \
       __niming_end__ - __niming_begin__);                                      \
   }()
 
+/**
+ * @brief 取得标签的编号，每个调用点只在第一次执行时查找注册表，此后只读一个
+ * 静态变量。用它初始化命名空间作用域的常量，就能在静态初始化时注册。
+ */
+#define MY_TIMING_TAG(name)                                                    \
+  [] {                                                                         \
+    static const auto __timing_tag__ = ::My::Timing::tag_id(name);             \
+    return __timing_tag__;                                                     \
+  }()
+
 /**
  * @brief 标准输出流打印函数，以缩进文本的方式打印输出。
  */
@@ -58,7 +176,12 @@ namespace bj = boost::json;
 class Timing
 {
 public:
-  using Clock = std::chrono::high_resolution_clock;
+  using Clock = MY_TIMING_CLOCK;
+
+  /**
+   * @brief 标签的编号，内容相同的标签编号相同，从 0 开始连续分配，0 是空标签。
+   */
+  using TagId = std::uint32_t;
 
   /**
    * @brief 用于给记录提供额外信息的接口类。
@@ -89,18 +212,57 @@ public:
   class Entry;
   class Iterator;
   class Scope;
+  class Histogram;
+  class Stats;
+  class Mapped;
+  struct Seq;
 
 public:
+  /**
+   * @brief 在全局的注册表中查找标签，没有则注册，线程安全。
+   *
+   * 每个线程缓存查过的标签，命中时只是一次哈希查找，不加锁。注册表中的字符串
+   * 在进程退出前不会释放。热点代码中应使用 MY_TIMING_TAG。
+   */
+  static TagId tag_id(const char* name) noexcept(false);
+
+  /**
+   * @brief 标签的内容，编号必须是已经注册过的。
+   */
+  static const char* tag_name(TagId id) noexcept;
+
+  /**
+   * @brief 已经注册的标签数，编号都小于它。
+   */
+  static TagId tag_count() noexcept;
+
+  /**
+   * @brief 设置默认 monitor 的筛选器，取代环境变量 TIMING_MONITOR_FILTER。
+   *
+   * 筛选器是 ECMAScript 正则表达式，每个标签只在注册时或者筛选器改变时匹配
+   * 一次，结果按标签编号缓存。
+   *
+   * @param regex 为空指针或者空串时关闭监视。
+   * @throw std::regex_error 正则表达式无效。
+   */
+  static void monitor_filter(const char* regex) noexcept(false);
+
   /**
    * @brief 从 JSON 导入。
    *
    * @param json JSON 对象。
-   * @param tags 用于保存标签字符串所有权的集合容器。
-   *
-   * @note \p tags 不能为 unordered，以免发生重哈希时返回对象中的指针失效！
    */
-  static Timing from_json(const bj::value& json,
-                          std::set<std::string>& tags) noexcept(false);
+  static Timing from_json(const bj::value& json) noexcept(false);
+
+  /**
+   * @deprecated 标签由注册表持有，不再需要 \p tags。
+   */
+  [[deprecated("use from_json(json)")]] static Timing from_json(
+    const bj::value& json,
+    std::set<std::string>& /* tags */) noexcept(false)
+  {
+    return from_json(json);
+  }
 
 public:
   virtual ~Timing() = default;
@@ -110,6 +272,19 @@ public:
    */
   Timing();
 
+  /**
+   * @brief 构造飞行记录器模式的计时序列，适合在长期运行的服务中一直开启。
+   *
+   * 每个线程只保留最近的 ring 条记录，新记录覆盖最旧的，内存占用恒定，每次
+   * 记录只是几次写入。遍历和导出时先取快照，记录不会被阻塞。
+   *
+   * 这一模式下序列不托管附加信息：传入 owned 为真的 info 会被立即释放而不
+   * 记录，附加信息的生存期要长于序列，例如 Scope 的进入和离开信息。
+   *
+   * @param ring 每个线程保留的条目数，向上取整到 2 的幂。
+   */
+  explicit Timing(std::size_t ring);
+
   /**
    * @brief 该构造函数是浅拷贝，拷贝后的对象与原对象共享计时序列。
    */
@@ -130,12 +305,23 @@ public:
    * @param info 附加信息，可为空。
    * @param owned 是否托管 info，若 info 为空则此参数必须为 false。
    *
-   * @return 本次计时构造的记录条目，是引用，当心指针悬挂。
+   * @return 本次计时构造的记录条目，是引用，当心指针悬挂。飞行记录器模式下
+   * 是本线程的一个副本，下次记录时被覆盖，修改它不影响序列。
    */
-  Entry& operator()(const char* tag,
+  Entry& operator()(TagId tag,
                     Info* info = nullptr,
                     bool owned = false) noexcept;
 
+  /**
+   * @brief 以标签的内容记录一次计时，每次都要查找标签的编号。
+   */
+  Entry& operator()(const char* tag,
+                    Info* info = nullptr,
+                    bool owned = false) noexcept
+  {
+    return (*this)(tag_id(tag), info, owned);
+  }
+
 public:
   /**
    * @brief 获取 Timing 的创建的时刻。
@@ -143,10 +329,35 @@ public:
   Clock::time_point initial() const noexcept;
 
   /**
-   * @brief 导出到 JSON 值对象。
+   * @brief 导出到 JSON 值对象，条目按时刻从早到晚排列。
    */
   bj::value to_jval() const noexcept(false);
 
+  /**
+   * @brief 以 Chrome Trace Event 格式流式写出，可以直接用 chrome://tracing 或
+   * Perfetto UI 打开。
+   *
+   * 作用域的进入和离开成为持续事件（B/E），其它记录成为线程内的瞬时事件，
+   * 附加信息放在 args.info 中。边遍历边写出，不在内存中构造整个 JSON。
+   */
+  void to_trace(const CFile64& file) const noexcept(false);
+
+  /**
+   * @brief 以紧凑的二进制格式流式写出，用 Mapped 读回，格式见 Mapped。
+   *
+   * 比 JSON 小一个数量级：时刻存为与前一条之差，标签只在首次出现时写入字典。
+   * 每积累约 64KB 写出一块，中途崩溃时已写出的块仍然可读。
+   */
+  void to_binary(const CFile64& file) const noexcept(false);
+
+  /**
+   * @brief 获取飞行记录器中当前所有条目的快照，可以在任何时候调用，例如在
+   * 收到信号后由专门的线程或者在 HTTP 接口中调用，不能在信号处理函数中调用。
+   *
+   * 返回的是普通模式的计时序列，普通模式下直接返回浅拷贝。
+   */
+  Timing snapshot() const;
+
 public:
   ///@name 迭代器。
   ///@{
@@ -160,29 +371,34 @@ protected:
    *
    * 默认实现对标签进行筛选并打印到 cout。筛选方式是将 TIMING_MONITOR_FILTER
    * 解释为 ECMAScript 正则表达式，如果该环境变量未设置，则不打印任何信息。
+   * 匹配的结果按标签预先算好，未开启时只是一次读和一次分支，见 monitor_filter。
    *
    * @param ent 本次计时构造的记录条目。
    */
   virtual void monitor(Entry& entry) noexcept;
 
 private:
-  std::shared_ptr<Entry> mHead;
+  std::shared_ptr<Seq> mSeq;
+
+  explicit Timing(std::shared_ptr<Seq> seq) noexcept
+    : mSeq(std::move(seq))
+  {
+  }
 
 private:
   friend std::ostream& ::operator<<(std::ostream & out, const Timing & prof);
 };
 
 /**
- * @brief 记录条目。
- *
- * TODO 或许定制内存分配器可以更快？
+ * @brief 记录条目，追加在计时序列的线程缓冲区中，随序列一起释放。
  */
 class Timing::Entry
 {
   friend class Timing;
+  friend struct Seq;
 
 public:
-  const char* mTag;        ///< 计时标签
+  TagId mTag;              ///< 计时标签
   Clock::time_point mTime; ///< 计时点
 
 public:
@@ -194,13 +410,18 @@ public:
   ~Entry() noexcept;
 
 public:
+  /**
+   * @brief 计时标签的内容。
+   */
+  const char* tag() const noexcept { return tag_name(mTag); }
+
   /**
    * @brief 获取记录上的附加消息，如果没有则返回空。
    */
   std::string info()
   {
-    if (mInfo)
-      return mInfo->info();
+    if (auto* info = get_info())
+      return info->info();
     return {};
   }
 
@@ -240,39 +461,79 @@ public:
 
 private:
   Info* mInfo; ///< 附加信息，最低位为所有权标记
-  std::atomic<Entry*> mNext;
 
 private:
   Entry() = default;
 
-  Entry(Clock::time_point time,
-        const char* tag,
-        Info* info,
-        bool owned,
-        Entry* next)
+  Entry(Clock::time_point time, TagId tag, Info* info, bool owned)
     : mInfo(info)
     , mTag(tag)
     , mTime(time)
-    , mNext(next)
   {
     reinterpret_cast<std::size_t&>(mInfo) |= int(owned);
   }
 };
 
+/**
+ * @brief 计时序列，被浅拷贝的 Timing 共享。
+ *
+ * 每个线程第一次向序列记录时领取一个自己的缓冲区，此后该线程的条目都按顺序
+ * 追加到其中，既不经过堆也不写任何共享的缓存行，序列析构时整块释放。
+ * 飞行记录器模式下缓冲区是固定大小的环。
+ */
+struct Timing::Seq
+{
+  struct Chunk;
+  struct Slot;
+  struct Arena;
+
+  const Clock::time_point mInitial; ///< 初始计时点
+  const std::uint64_t mId; ///< 用于在线程本地查找缓冲区，不会重复
+  const std::size_t mRing; ///< 每个线程的环的大小，为 0 时不限条目数
+  std::atomic<Arena*> mArenas{ nullptr }; ///< 所有线程的缓冲区
+
+  explicit Seq(std::size_t ring = 0, Clock::time_point initial = Clock::now());
+  Seq(const Seq&) = delete;
+  Seq& operator=(const Seq&) = delete;
+  ~Seq() noexcept;
+
+  /**
+   * @brief 在当前线程的缓冲区末尾追加一个条目，首次调用时注册缓冲区。
+   *
+   * @param self 指向本序列的共享指针，线程本地只保存它的弱引用。
+   */
+  static Entry& append(const std::shared_ptr<Seq>& self,
+                       Clock::time_point time,
+                       TagId tag,
+                       Info* info,
+                       bool owned);
+
+  /**
+   * @brief 把各线程环中的条目复制到一个新的普通序列中，保留线程编号。
+   */
+  std::shared_ptr<Seq> snapshot() const;
+};
+
+/**
+ * @brief 按时刻从早到晚归并各线程缓冲区的迭代器。
+ *
+ * 迭代时可以有其它线程在记录，迭代开始之后追加的条目可能遍历不到。
+ */
 class Timing::Iterator
 {
 public:
-  Iterator(Entry* entry) noexcept
-    : mEntry(entry)
-  {
-  }
+  /**
+   * @brief 构造尾迭代器。
+   */
+  Iterator() noexcept = default;
+
+  /**
+   * @brief 构造头迭代器，飞行记录器模式下先取快照，迭代器持有快照。
+   */
+  explicit Iterator(const Seq& seq) noexcept;
 
 public:
-  Iterator& operator++() noexcept
-  {
-    mEntry = mEntry->mNext.load();
-    return *this;
-  }
+  Iterator& operator++() noexcept;
 
   Iterator operator++(int) noexcept
   {
@@ -283,20 +544,52 @@ public:
 
   bool operator==(const Iterator& other) const noexcept
   {
-    return mEntry == other.mEntry;
+    return get() == other.get();
   }
 
   bool operator!=(const Iterator& other) const noexcept
   {
-    return mEntry != other.mEntry;
+    return get() != other.get();
   }
 
-  Entry& operator*() const noexcept { return *mEntry; }
+  Entry& operator*() const noexcept { return *get(); }
 
-  Entry* operator->() const noexcept { return mEntry; }
+  Entry* operator->() const noexcept { return get(); }
+
+  /**
+   * @brief 当前条目是由哪个线程记录的，线程编号在进程内从 1 开始分配。
+   */
+  std::uint32_t thread() const noexcept { return mHeap.front().mThread; }
 
 private:
-  Entry* mEntry;
+  /**
+   * @brief 一个线程缓冲区中的读取位置。
+   */
+  struct Cursor
+  {
+    Entry* mEntry;
+    Seq::Chunk* mChunk;
+    std::size_t mIndex;
+    std::uint32_t mThread;
+  };
+
+  std::vector<Cursor> mHeap; ///< 以当前条目的时刻排序的小顶堆
+  std::shared_ptr<Seq> mSnapshot;
+
+  Entry* get() const noexcept
+  {
+    return mHeap.empty() ? nullptr : mHeap.front().mEntry;
+  }
+
+  /**
+   * @brief 把游标移到所在缓冲区的下一个条目，没有则返回 false。
+   */
+  static bool next(Cursor& cur) noexcept;
+
+  static bool later(const Cursor& a, const Cursor& b) noexcept
+  {
+    return b.mEntry->mTime < a.mEntry->mTime;
+  }
 };
 
 /**
@@ -320,13 +613,18 @@ public:
   static LeaveInfo gLeaveInfo; ///< 作用域离开时的附加信息
 
 public:
-  Scope(Timing& self, const char* tag)
+  Scope(Timing& self, TagId tag)
     : _(self)
     , mTag(tag)
   {
     _(mTag, &gEnterInfo, false);
   }
 
+  Scope(Timing& self, const char* tag)
+    : Scope(self, tag_id(tag))
+  {
+  }
+
   Scope(const Scope&) = delete;
   Scope(Scope&&) = delete;
   Scope& operator=(const Scope&) = delete;
@@ -336,34 +634,284 @@ public:
 
 private:
   Timing& _;
-  const char* mTag;
+  const TagId mTag;
+};
+
+/**
+ * @brief HDR 风格的对数线性直方图，线程安全，记录一个值只是几次原子加。
+ *
+ * 小于 64 的值各占一格，此后每个 2 的幂区间再线性地分成 32 格，分位数的相对
+ * 误差不超过 1/32，覆盖整个 64 位的取值范围。
+ */
+class Timing::Histogram
+{
+public:
+  static constexpr unsigned kSubBits = 5;
+  static constexpr std::size_t kSub = std::size_t(1) << kSubBits;
+  static constexpr std::size_t kBuckets = (64 - kSubBits + 1) * kSub;
+
+  /**
+   * @brief 直方图的摘要，没有记录时各项都为 0。
+   */
+  struct Summary
+  {
+    std::uint64_t mCount;
+    std::uint64_t mMin;
+    std::uint64_t mMax;
+    double mMean;
+    std::uint64_t mP50;
+    std::uint64_t mP90;
+    std::uint64_t mP99;
+    std::uint64_t mP999;
+
+    bj::value to_jval() const noexcept(false);
+  };
+
+public:
+  Histogram() noexcept = default;
+  Histogram(const Histogram&) = delete;
+  Histogram& operator=(const Histogram&) = delete;
+
+  void record(std::uint64_t value) noexcept;
+
+  /**
+   * @brief 一次遍历算出摘要，与记录并发时得到的是近似值。
+   *
+   * 分位数取所在格的上界，但不超过最大值。
+   */
+  Summary summary() const noexcept;
+
+  /**
+   * @brief 值所在的格。
+   */
+  static std::size_t index(std::uint64_t value) noexcept;
+
+  /**
+   * @brief 格中的最大值。
+   */
+  static std::uint64_t upper(std::size_t index) noexcept;
+
+private:
+  std::atomic<std::uint64_t> mSum{ 0 };
+  std::atomic<std::uint64_t> mMin{ UINT64_MAX };
+  std::atomic<std::uint64_t> mMax{ 0 };
+  std::atomic<std::uint64_t> mBuckets[kBuckets]{};
+};
+
+/**
+ * @brief 在线汇总作用域耗时的计时类，不必导出原始条目再离线统计。
+ *
+ * 每个线程把 Scope 的进入和离开配对，耗时按纳秒记入该标签的直方图，内容相同
+ * 的标签共用一个直方图。默认以每线程只保留一条的飞行记录器模式构造，内存占用
+ * 只与标签数有关而与记录数无关。浅拷贝的对象共享直方图。
+ *
+ * 重载了 monitor，子类如果再重载需要调用这里的实现。
+ */
+class Timing::Stats : public Timing
+{
+public:
+  /**
+   * @param ring 每个线程在飞行记录器中保留的条目数。
+   */
+  explicit Stats(std::size_t ring = 1);
+
+  /**
+   * @brief 各标签的摘要，以标签排序。
+   */
+  std::map<std::string, Histogram::Summary> summary() const noexcept(false);
+
+  /**
+   * @brief 把摘要导出为以标签为键的 JSON 对象。
+   *
+   * 这隐藏了 Timing::to_jval，需要原始条目时通过基类调用。
+   */
+  bj::value to_jval() const noexcept(false);
+
+protected:
+  void monitor(Entry& entry) noexcept override;
+
+private:
+  struct Tags;
+
+  std::shared_ptr<Tags> mTags;
+};
+
+/**
+ * @brief 以内存映射的方式只读打开 Timing::to_binary 写出的文件，迭代时就地
+ * 解码，标签和附加信息都直接指向映射的内存，不复制。
+ *
+ * 文件格式（版本 1），定长整数都是小端的，变长整数是 LEB128：
+ *
+ * - 文件头：魔数 "MyTiming"，u32 版本，u32 保留，i64 初始时刻的纳秒数；
+ * - 此后是若干块，块头是 u32 类型、u32 条数、u32 负载字节数，未知类型的块
+ *   被跳过，不完整的末块被忽略：
+ *   - 字典块 'D'：每条是标签的变长长度和内容，编号接续前面的字典块；
+ *   - 记录块 'R'：负载开头是标签列、线程列、时刻列的 u32 字节数，然后依次
+ *     是这三列变长整数：标签编号、线程编号、与前一条的纳秒差（zigzag），
+ *     最后是信息列，每条一个变长整数 v，0 表示没有，1、2 表示作用域的进入
+ *     和离开，否则后跟 v - 3 字节的内容。
+ */
+class Timing::Mapped
+{
+public:
+  static constexpr std::uint32_t kVersion = 1;
+
+  enum Kind : std::uint8_t
+  {
+    kPlain, ///< 普通记录
+    kEnter, ///< 作用域进入
+    kLeave, ///< 作用域离开
+  };
+
+  /**
+   * @brief 一条记录，字符串指向映射的内存，与 Mapped 同生存期。
+   */
+  struct Record
+  {
+    std::string_view mTag;
+    Clock::time_point mTime;
+    std::uint32_t mThread;
+    Kind mKind;
+    std::string_view mInfo; ///< 没有附加信息时 data() 为空
+  };
+
+  class Iterator;
+
+public:
+  /**
+   * @brief 映射整个文件，映射建立之后 file 可以关闭。
+   *
+   * @throw err::Lit 不是这个格式的文件或者版本不支持。
+   */
+  explicit Mapped(const CFile64& file) noexcept(false);
+
+  Mapped(const Mapped&) = delete;
+  Mapped& operator=(const Mapped&) = delete;
+  ~Mapped() noexcept;
+
+  Clock::time_point initial() const noexcept { return mInitial; }
+
+  /**
+   * @brief 记录的条数。
+   */
+  std::size_t size() const noexcept { return mSize; }
+
+  /**
+   * @brief 标签字典，下标是文件内的标签编号。
+   */
+  const std::vector<std::string_view>& tags() const noexcept { return mTags; }
+
+  ///@name 迭代器，按写出的顺序，也就是时刻从早到晚。
+  ///@{
+  Iterator begin() const noexcept(false);
+  Iterator end() const noexcept;
+  ///@}
+
+private:
+  const std::uint8_t* mData{ nullptr };
+  std::size_t mBytes{ 0 };
+  Clock::time_point mInitial;
+  std::size_t mSize{ 0 };
+  std::vector<std::string_view> mTags;
+  std::vector<const std::uint8_t*> mBlocks; ///< 各记录块的块头
+
+  void unmap() noexcept;
+};
+
+/**
+ * @brief 逐条解码记录块的迭代器。
+ *
+ * @throw err::Lit 记录块的内容损坏。
+ */
+class Timing::Mapped::Iterator
+{
+public:
+  /**
+   * @brief 构造尾迭代器。
+   */
+  Iterator() noexcept = default;
+
+  explicit Iterator(const Mapped& file) noexcept(false);
+
+public:
+  Iterator& operator++() noexcept(false);
+
+  bool operator==(const Iterator& other) const noexcept
+  {
+    return mRemain == other.mRemain;
+  }
+
+  bool operator!=(const Iterator& other) const noexcept
+  {
+    return mRemain != other.mRemain;
+  }
+
+  const Record& operator*() const noexcept { return mRecord; }
+
+  const Record* operator->() const noexcept { return &mRecord; }
+
+private:
+  const Mapped* mFile{ nullptr };
+  std::size_t mRemain{ 0 }; ///< 包括当前条在内还剩下的条数
+  std::size_t mBlock{ 0 };
+  std::uint32_t mLeft{ 0 }; ///< 当前块中包括当前条在内还剩下的条数
+  const std::uint8_t* mCols[4];
+  const std::uint8_t* mEnds[4];
+  std::int64_t mNs{ 0 }; ///< 当前条相对初始时刻的纳秒数
+  Record mRecord{};
+
+  void enter(std::size_t block) noexcept;
+  void decode() noexcept(false);
 };
 
 } // namespace My
 
+/**
+ * @brief 回放二进制文件中的记录，输出与 Timing 的打印格式相同。
+ */
+std::ostream&
+operator<<(std::ostream& out, const My::Timing::Mapped& file);
+
 namespace My {
 
 inline Timing::Timing()
-  : mHead(new Entry(Clock::now(), nullptr, nullptr, false, nullptr))
+  : mSeq(std::make_shared<Seq>())
+{
+}
+
+inline Timing::Timing(std::size_t ring)
+  : mSeq(std::make_shared<Seq>(ring ? ring : 1))
 {
 }
 
 inline Timing::Clock::time_point
 Timing::initial() const noexcept
 {
-  return mHead->mTime;
+  return mSeq->mInitial;
 }
 
 inline Timing::Iterator
 Timing::begin() const noexcept
 {
-  return Iterator(mHead->mNext.load(std::memory_order_relaxed));
+  return Iterator(*mSeq);
 }
 
 inline Timing::Iterator
 Timing::end() const noexcept
 {
-  return Iterator(nullptr);
+  return Iterator();
+}
+
+inline Timing::Mapped::Iterator
+Timing::Mapped::begin() const noexcept(false)
+{
+  return Iterator(*this);
+}
+
+inline Timing::Mapped::Iterator
+Timing::Mapped::end() const noexcept
+{
+  return Iterator();
 }
 
 } // namespace My
@@ -13,6 +13,7 @@ namespace {
 
 using Conn = std::shared_ptr<Client::Connection>;
 using StdHRC = std::chrono::high_resolution_clock;
+using StdSC = std::chrono::steady_clock;
 
 void
 close_gracefully(Socket& socket, My::log::Logger& logger)
@@ -54,6 +55,55 @@ parse_keep_alive(std::string_view value)
   return { timeout, max };
 }
 
+/**
+ * @brief 检查空闲的连接是否还能用：没有过保活期限，对端也没有关闭。
+ */
+bool
+is_alive(Client::Connection& conn) noexcept
+{
+  if (StdSC::now() >= conn.mExpiry)
+    return false;
+
+  // 非阻塞地窥探一个字节：对端关闭时读到 EOF，正常的空闲连接应当无数据可读
+  BoostEC ec, ignored;
+  char c;
+  conn.mSocket.non_blocking(true, ignored);
+  conn.mSocket.receive(ba::buffer(&c, 1), Socket::message_peek, ec);
+  conn.mSocket.non_blocking(false, ignored);
+  return ec == ba::error::would_block;
+}
+
+/// 每次清扫时检查的最老的空闲连接数
+constexpr std::size_t kSweepChecks = 16;
+
+/**
+ * @brief 如果清扫器没有在计时，就让它在半个 ttl 后清扫一次。
+ *
+ * 池中还有空闲连接时清扫器会继续计时，没有时停下，以免执行器一直有活干。
+ */
+void
+arm_sweeper(std::shared_ptr<Client::Sweeper> sweeper,
+            ba::steady_timer::duration ttl)
+{
+  // 与下面清扫后的屏障配对：要么清扫器看到了刚归还的连接，要么我们看到它
+  // 已经停下，由我们来重新计时
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sweeper->mArmed.exchange(true))
+    return;
+
+  sweeper->mTimer.expires_after(ttl / 2);
+  sweeper->mTimer.async_wait([weak = std::weak_ptr(sweeper), ttl](auto&& ec) {
+    auto sweeper = weak.lock();
+    if (ec || !sweeper)
+      return; // 客户端已经析构了
+    sweeper->mPool.sweep(ttl, is_alive, kSweepChecks);
+    sweeper->mArmed = false;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sweeper->mPool.stats().mIdle)
+      arm_sweeper(std::move(sweeper), ttl);
+  });
+}
+
 void
 handle_keep_alive(Conn conn,
                   Response& res,
@@ -78,14 +128,54 @@ handle_keep_alive(Conn conn,
     timeout = std::chrono::seconds(t);
   }
 
-  // 将连接放回连接池，并设定计时器等过了有效时间将其丢弃。
-  client.mConnPool.give(conn);
-  conn->mTimer.expires_after(timeout);
-  conn->mTimer.async_wait([conn = std::move(conn)](auto&& ec) {
-    if (!ec)
-      Client::Connection::Pool::drop(*conn);
-    // 如果是这种情况，我们就不要优雅关闭连接了，因为远端可能已经关闭过了。
-  });
+  // 将连接放回连接池，过了有效时间后由清扫器逐出，或者在取出时丢弃。这时
+  // 就不要优雅关闭连接了，因为远端可能已经关闭过了。
+  conn->mExpiry = StdSC::now() + timeout;
+  client.mConnPool.give(std::move(conn));
+  arm_sweeper(client.mSweeper, client.mConfig.mKeepAliveTimeout);
+}
+
+/**
+ * @brief 取出没有过保活期限的空闲连接，过了期限的直接丢弃。
+ *
+ * 清扫器每隔半个默认保活超时才清扫一次，服务器声明的期限可能更短，所以
+ * 取出时还要再检查一次。
+ */
+Conn
+take_idle(Client& client) noexcept
+{
+  while (auto conn = client.mConnPool.take())
+    if (StdSC::now() < conn->mExpiry)
+      return conn;
+  return nullptr;
+}
+
+/**
+ * @brief 取出空闲的连接，没有则新建，新建时将 fresh 置为 true。
+ *
+ * 连接数达到上限时等待别的请求归还连接或者空出名额，超时返回空指针。
+ */
+Conn
+acquire_conn(Client& client, bool& fresh)
+{
+  fresh = false;
+  if (auto conn = take_idle(client))
+    return conn;
+
+  auto deadline = StdSC::now() + client.mConfig.mTimeout;
+  while (true) {
+    if (auto conn = client.mConnPool.make(client.mEx)) {
+      fresh = true;
+      return conn;
+    }
+    if (auto conn = client.mConnPool.take_until(deadline)) {
+      if (StdSC::now() < conn->mExpiry)
+        return conn;
+      continue; // 过了保活期限，丢弃后空出了名额，重新尝试新建
+    }
+    if (StdSC::now() >= deadline)
+      return nullptr;
+  }
 }
 
 struct AsyncHttp : std::enable_shared_from_this<AsyncHttp>
@@ -110,19 +200,31 @@ private:
   std::uint32_t mRetry{ 0 };
 
   Request mReq;
-  bb::flat_buffer mBuf;
+  FlatBuffer mBuf;
   Response mRes;
 
   StdHRC::time_point mTiming, mTimingTotal;
 
   void do_request()
   {
-    mConn = _.mConnPool.take();
+    mConn.reset(); // 重试时先归还名额，否则连接数为 1 时会等待自己
+    mConn = take_idle(_);
     if (!mConn) {
+      mConn = _.mConnPool.make(_.mEx);
+      if (!mConn) {
+        // 连接数达到上限，等待别的请求归还连接或者空出名额
+        BOOST_LOG_SEV(mLogger, verb) << "waiting for connection";
+        _.mConnPool.async_take([self = shared_from_this()](Conn conn) {
+          ba::post(self->_.mEx, [self, conn = std::move(conn)]() mutable {
+            self->on_take(std::move(conn));
+          });
+        });
+        return;
+      }
+
       BOOST_LOG_SEV(mLogger, verb) << "resolving";
       mTimingTotal = mTiming = StdHRC::now();
 
-      mConn = std::make_shared<Client::Connection>(_.mEx);
       mConn->mResolver.async_resolve(
         _.mConfig.mHost,
         _.mConfig.mPort,
@@ -137,8 +239,17 @@ private:
       mConn->mTimer.expires_after(_.mConfig.mTimeout);
       return;
     }
-    mConn->mTimer.cancel(); // 计时器可能正等着从连接池中移除连接，重置它。
+    do_write();
+  }
 
+  void on_take(Conn conn) noexcept
+  {
+    if (!conn || StdSC::now() >= conn->mExpiry) {
+      conn.reset();
+      do_request(); // 空出了名额，或者连接过了保活期限，重新尝试
+      return;
+    }
+    mConn = std::move(conn);
     do_write();
   }
 
@@ -272,10 +383,13 @@ Client::http(Request& req) noexcept
   timingTotal = StdHRC::now();
 
   BoostEC ec;
-  auto conn = mConnPool.take();
+  bool fresh;
+  auto conn = acquire_conn(*this, fresh);
   if (!conn) {
-    conn = std::make_shared<Connection>(mEx);
-
+    BOOST_LOG_SEV(logger, noti) << "no connection available";
+    return BoostEC(ba::error::timed_out);
+  }
+  if (fresh) {
     BOOST_LOG_SEV(logger, verb) << "resolving";
     timing = StdHRC::now();
     conn->mTimer.async_wait([&conn = *conn](auto&& ec) {
@@ -340,7 +454,7 @@ Client::http(Request& req) noexcept
     }
   });
   conn->mTimer.expires_after(mConfig.mTimeout);
-  bb::flat_buffer buf;
+  FlatBuffer buf;
   Response res;
   auto resSize = http::read(conn->mSocket, buf, res, ec);
   if (ec) {
@@ -360,9 +474,10 @@ void
 Client::async_http(Request req, std::function<void(BoostResult<Response>&&)> cb)
 {
   req.prepare_payload();
-  ba::post(mEx,
-           [x = std::make_shared<AsyncHttp>(*this, mLogName, std::move(cb)),
-            req = std::move(req)]() mutable { x->exec(std::move(req)); });
+  auto x = My::Recycler<AsyncHttp>::make_shared(*this, mLogName, std::move(cb));
+  ba::post(mEx, [x = std::move(x), req = std::move(req)]() mutable {
+    x->exec(std::move(req));
+  });
 };
 
 bj::value
@@ -380,6 +495,8 @@ Client::Config::to_jval() const noexcept
     "KeepAliveTimeout",
     std::chrono::duration_cast<std::chrono::milliseconds>(mKeepAliveTimeout)
       .count());
+  jobj.emplace("MaxConnections", mMaxConnections);
+  jobj.emplace("MaxIdleConnections", mMaxIdleConnections);
   return { std::move(jobj) };
 }
 
@@ -394,6 +511,13 @@ Client::Config::jval_to(const bj::value& jval)
   mMaxRetry = jobj.at("MaxRetry").as_uint64();
   mKeepAliveTimeout =
     std::chrono::milliseconds(jobj.at("KeepAliveTimeout").as_uint64());
+  // 以下为后加的配置项，旧的配置文件中没有时表示不限
+  mMaxConnections = 0;
+  if (auto* v = jobj.if_contains("MaxConnections"))
+    mMaxConnections = v->as_uint64();
+  mMaxIdleConnections = 0;
+  if (auto* v = jobj.if_contains("MaxIdleConnections"))
+    mMaxIdleConnections = v->as_uint64();
 }
 
 } // namespace MyHttp
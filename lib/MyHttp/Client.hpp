@@ -36,6 +36,10 @@ public:
     std::uint32_t mMaxRetry{ 1 };
     /// 保活超时限制，超时无活动的连接会被关闭
     ba::steady_timer::duration mKeepAliveTimeout = std::chrono::seconds(3);
+    /// 最大连接数，达到上限时请求等待空闲的连接，0 表示不限制
+    std::size_t mMaxConnections{ 0 };
+    /// 最大空闲连接数，超出的连接在请求结束后关闭，0 表示不限制
+    std::size_t mMaxIdleConnections{ 0 };
 
     /// 转换到 JSON 值对象
     bj::value to_jval() const noexcept;
@@ -54,6 +58,9 @@ public:
     : mEx(std::move(ex))
     , mConfig(config)
     , mLogName(std::move(logName))
+    , mConnPool(or_unlimited(config.mMaxIdleConnections),
+                or_unlimited(config.mMaxConnections))
+    , mSweeper(std::make_shared<Sweeper>(mEx, mConnPool))
   {
   }
 
@@ -97,9 +104,35 @@ private:
     ba::steady_timer mTimer;
     ba::ip::tcp::resolver mResolver;
     Socket mSocket;
+    /// 服务器声明的保活期限，空闲的连接过了这个时刻就不能再用了
+    std::chrono::steady_clock::time_point mExpiry;
   };
 
-  Connection::Pool mConnPool;
+  /**
+   * @brief 空闲连接的清扫器，池中有空闲连接时每隔半个保活超时清扫一次。
+   *
+   * 代替每个空闲连接各自的计时器；计时器只由当前武装它的线程使用。
+   */
+  struct Sweeper
+  {
+    ba::steady_timer mTimer;
+    Connection::BoundedPool mPool; ///< 与客户端共享同一份状态
+    std::atomic<bool> mArmed{ false };
+
+    Sweeper(Executor& ex, const Connection::BoundedPool& pool)
+      : mTimer(ex)
+      , mPool(pool)
+    {
+    }
+  };
+
+  Connection::BoundedPool mConnPool;
+  std::shared_ptr<Sweeper> mSweeper;
+
+  static std::size_t or_unlimited(std::size_t limit) noexcept
+  {
+    return limit ? limit : Connection::BoundedPool::kUnlimited;
+  }
 };
 
 } // namespace MyHttp
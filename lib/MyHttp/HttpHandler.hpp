@@ -90,7 +90,7 @@ protected:
 private:
   const Config& mConfig;
   bb::tcp_stream mStream;
-  bb::flat_buffer mBuffer;
+  FlatBuffer mBuffer;
   std::uint16_t mKeepAliveCount{ 0 };
 
   std::chrono::high_resolution_clock::time_point mTimingBegin;
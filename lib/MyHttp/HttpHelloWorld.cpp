@@ -18,7 +18,8 @@ HttpHelloWorld::do_handle() noexcept
 void
 HttpHelloWorld::Server::come(Socket&& sock)
 {
-  std::make_shared<HttpHelloWorld>(std::move(sock), mConfig)->start();
+  // 会话对象的内存从回收器分配，连接断开后留给下一个连接复用
+  My::Recycler<HttpHelloWorld>::make_shared(std::move(sock), mConfig)->start();
 }
 
 } // namespace MyHttp
@@ -118,7 +118,7 @@ HttpMatpowsum::do_handle() noexcept
 void
 HttpMatpowsum::Server::come(Socket&& sock)
 {
-  std::make_shared<HttpMatpowsum>(std::move(sock), mConfig)->start();
+  My::Recycler<HttpMatpowsum>::make_shared(std::move(sock), mConfig)->start();
 }
 
 } // namespace MyHttp
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <My/Recycler.hpp>
 #include <My/log.hpp>
 
 #include <boost/asio.hpp>
@@ -23,6 +24,15 @@ using Executor = ba::any_io_executor;
 using Socket = ba::ip::tcp::socket;
 using Endpoint = ba::ip::tcp::endpoint;
 
+/**
+ * @brief 从回收器分配存储的读缓冲区。
+ *
+ * 会话对象销毁后缓冲区的存储留给下一个会话，不超过块大小（与默认的
+ * BufferLimit 相同）的缓冲区在稳定状态下不再访问堆。
+ */
+using FlatBuffer =
+  bb::basic_flat_buffer<My::Recycler<char, 8 << 10>::Allocator<char>>;
+
 using BytesBody = http::vector_body<std::uint8_t>;
 using Request = http::request<BytesBody>;
 using Response = http::response<BytesBody>;
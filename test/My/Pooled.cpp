@@ -1,6 +1,11 @@
 #include "testutil.hpp"
 
 #include <My/Pooled.hpp>
+#include <My/Recycler.hpp>
+#include <algorithm>
+#include <boost/json.hpp>
+#include <atomic>
+#include <chrono>
 #include <thread>
 
 using namespace My;
@@ -23,6 +28,24 @@ struct SubRC : public RC
   }
 };
 
+struct IRC : public RcPooled<IRC>
+{
+  IRC(int i)
+    : mI(i)
+  {
+  }
+
+  int mI;
+};
+
+struct SubIRC : public IRC
+{
+  SubIRC(int i)
+    : IRC(i)
+  {
+  }
+};
+
 BOOST_AUTO_TEST_CASE(basic)
 {
   RC::Pool pool;
@@ -56,6 +79,95 @@ BOOST_AUTO_TEST_CASE(basic)
   pool.give(rc1);
   pool.clear();
   BOOST_TEST(pool.count() == 0);
+
+  // take_if 跳过的资源必须留在池中
+  pool.give(rc3);
+  pool.give(rc2);
+  pool.give(rc1);
+  BOOST_TEST(pool.take_if<SubRC>() == rc3);
+  BOOST_TEST(pool.count() == 2);
+  BOOST_TEST(RC::Pool::is_in(*rc1));
+  BOOST_TEST(RC::Pool::is_in(*rc2));
+}
+
+BOOST_AUTO_TEST_CASE(intrusive)
+{
+  IRC::Pool pool;
+
+  auto rc1 = make_intrusive<IRC>(1);
+  pool.give(rc1);
+  BOOST_TEST(IRC::Pool::is_in(*rc1));
+  BOOST_TEST(rc1->use_count() == 2);
+
+  BOOST_TEST((pool.take() == rc1));
+  BOOST_TEST(!IRC::Pool::is_in(*rc1));
+  BOOST_TEST(rc1->use_count() == 1);
+  pool.give(rc1);
+
+  auto rc2 = make_intrusive<IRC>(2);
+  pool.give(rc2);
+  IntrusivePtr<IRC> rc3 = make_intrusive<SubIRC>(3);
+  pool.give(rc3);
+  BOOST_TEST(pool.count() == 3);
+
+  int sum = 0;
+  for (auto& rc : pool)
+    sum += rc.mI;
+  BOOST_TEST(sum == 6);
+
+  IRC::Pool::drop(*rc1);
+  BOOST_TEST(!IRC::Pool::is_in(*rc1));
+  BOOST_TEST(rc1->use_count() == 1);
+
+  pool.give(rc1);
+  BOOST_TEST((pool.take_if<SubIRC>() == rc3));
+  BOOST_TEST(pool.count() == 2);
+  BOOST_TEST((pool.take() == rc1));
+  BOOST_TEST((pool.take() == rc2));
+  BOOST_TEST(!pool.take());
+
+  // 池析构时释放其持有的引用
+  {
+    IRC::Pool other;
+    other.give(rc3);
+    BOOST_TEST(rc3->use_count() == 2);
+    other.clear();
+  }
+  BOOST_TEST(rc3->use_count() == 1);
+}
+
+BOOST_AUTO_TEST_CASE(intrusive_concurrent)
+{
+  IRC::Pool pool;
+
+  std::vector<std::thread> threads(std::thread::hardware_concurrency());
+  for (auto& t : threads) {
+    t = std::thread([&] {
+      for (int i = 0; i < 1000; ++i) {
+        auto rc = pool.take();
+        if (!rc)
+          rc = make_intrusive<IRC>(i);
+        if (i % 7 == 0) {
+          pool.give(rc);
+          IRC::Pool::drop(*rc);
+        } else
+          pool.give(rc);
+      }
+    });
+  }
+
+  for (auto i = threads.size(); --i != SIZE_MAX;) {
+    if (i & 1) {
+      pool.clear();
+    } else {
+      for (auto& rc : pool)
+        BOOST_TEST(rc.mI >= 0);
+    }
+  }
+
+  for (auto& t : threads)
+    t.join();
+  BOOST_TEST(pool.count() <= threads.size());
 }
 
 BOOST_AUTO_TEST_CASE(concurrent)
@@ -88,15 +200,835 @@ BOOST_AUTO_TEST_CASE(concurrent)
   BOOST_TEST(pool.count() <= threads.size());
 }
 
-BOOST_AUTO_TEST_CASE(performance)
+BOOST_AUTO_TEST_CASE(magazine)
+{
+  RC::Pool pool(4);
+
+  // 弹匣满了之后溢出到全局链，但所有资源都能被遍历和计数
+  std::vector<std::shared_ptr<RC>> rcs;
+  for (int i = 0; i < 20; ++i) {
+    rcs.emplace_back(std::make_shared<RC>(i));
+    pool.give(rcs.back());
+  }
+  BOOST_TEST(pool.count() == 20);
+
+  // 别的线程只能取到全局链中的资源，线程退出时其弹匣中的资源退回全局链
+  std::vector<std::shared_ptr<RC>> taken;
+  std::thread([&] {
+    while (auto rc = pool.take())
+      taken.emplace_back(std::move(rc));
+    pool.give(taken[0]);
+    pool.give(taken[1]);
+  }).join();
+  BOOST_TEST(taken.size() < 20);
+  BOOST_TEST(RC::Pool::is_in(*taken[0]));
+  BOOST_TEST(pool.count() == 20 - taken.size() + 2);
+
+  // 弹匣中的资源同样可以被丢弃
+  for (auto& rc : rcs)
+    RC::Pool::drop(*rc);
+  BOOST_TEST(pool.count() == 0);
+
+  for (auto& rc : rcs)
+    pool.give(rc);
+  pool.clear();
+  BOOST_TEST(pool.count() == 0);
+  BOOST_TEST(!RC::Pool::is_in(*rcs[0]));
+
+  RC::Pool direct; // 默认不使用弹匣，别的线程放入的资源也能取到
+  direct.give(rcs[0]);
+  std::thread([&] { BOOST_TEST(direct.take() == rcs[0]); }).join();
+}
+
+BOOST_AUTO_TEST_CASE(typed)
 {
   auto loopsEnv = std::getenv("LOOPS");
   auto loops = loopsEnv ? std::atoi(loopsEnv) : 10000;
-  auto threadsEnv = std::getenv("THREADS");
-  auto threadsNum =
-    threadsEnv ? std::atoi(threadsEnv) : std::thread::hardware_concurrency();
 
-  RC::Pool pool;
+  // 稀有类型的资源淹没在大量其它资源中，take_if 的代价应与 take 相当
+  RC::Pool pool(0);
+  auto sub = std::make_shared<SubRC>(-1);
+  pool.give(sub);
+  for (int i = 0; i < 10000; ++i)
+    pool.give(std::make_shared<RC>(i));
+  BOOST_TEST(pool.count() == 10001);
+
+  std::shared_ptr<SubRC> rc;
+  auto firstNs = timing({ rc = pool.take_if<SubRC>(); }).count();
+  BOOST_TEST(rc == sub);
+  pool.give(std::move(rc));
+
+  auto takeNs = timing({
+                  for (int i = 0; i < loops; ++i)
+                    pool.give(pool.take());
+                }).count();
+  std::size_t found = 0;
+  auto takeIfNs = timing({
+                    for (int i = 0; i < loops; ++i) {
+                      auto rc = pool.take_if<SubRC>();
+                      found += rc == sub;
+                      pool.give(std::move(rc));
+                    }
+                  }).count();
+  std::cout << "10001 items in pool, ns per loop: take "
+            << double(takeNs) / loops << ", take_if "
+            << double(takeIfNs) / loops << ", first take_if " << firstNs
+            << std::endl;
+  BOOST_TEST(found == loops);
+  BOOST_TEST(pool.count() == 10001);
+
+  BOOST_TEST(pool.take_if<SubRC>() == sub);
+  BOOST_TEST(!pool.take_if<SubRC>());
+  BOOST_TEST(pool.count() == 10000);
+
+  // 经过弹匣时同样能按类型取出
+  RC::Pool cached;
+  cached.give(sub);
+  for (int i = 0; i < 100; ++i)
+    cached.give(std::make_shared<RC>(i));
+  BOOST_TEST(cached.take_if<SubRC>() == sub);
+  BOOST_TEST(cached.count() == 100);
+}
+
+BOOST_AUTO_TEST_CASE(lock_free)
+{
+  RC::LockFreePool pool;
+
+  auto rc1 = std::make_shared<RC>(1);
+  pool.give(rc1);
+  BOOST_TEST(RC::LockFreePool::is_in(*rc1));
+
+  BOOST_TEST(pool.take() == rc1);
+  BOOST_TEST(!RC::LockFreePool::is_in(*rc1));
+  pool.give(rc1);
+
+  auto rc2 = std::make_shared<RC>(2);
+  pool.give(rc2);
+  auto rc3 = std::make_shared<SubRC>(3);
+  pool.give(rc3);
+  BOOST_TEST(pool.count() == 3);
+  BOOST_TEST(pool.snapshot().size() == 3);
+
+  RC::LockFreePool::drop(*rc1);
+  BOOST_TEST(!RC::LockFreePool::is_in(*rc1));
+  RC::LockFreePool::drop(*rc1);
+  BOOST_TEST(pool.count() == 2);
+
+  BOOST_TEST(pool.take_if<SubRC>() == rc3);
+  BOOST_TEST(!pool.take_if<SubRC>());
+  BOOST_TEST(pool.take() == rc2);
+  BOOST_TEST(!pool.take());
+
+  // 超过一块的单元数，检查单元的分配和回收
+  std::vector<std::shared_ptr<RC>> rcs;
+  for (int i = 0; i < 1000; ++i) {
+    rcs.emplace_back(std::make_shared<RC>(i));
+    pool.give(rcs.back());
+  }
+  for (int i = 0; i < 1000; i += 2)
+    RC::LockFreePool::drop(*rcs[i]);
+  BOOST_TEST(pool.count() == 500);
+  for (int i = 999; i > 0; i -= 2)
+    BOOST_TEST(pool.take() == rcs[i]);
+  BOOST_TEST(!pool.take());
+
+  pool.give(rc3);
+  pool.give(rc2);
+  pool.clear();
+  BOOST_TEST(pool.count() == 0);
+  BOOST_TEST(!RC::LockFreePool::is_in(*rc2));
+}
+
+BOOST_AUTO_TEST_CASE(lock_free_concurrent)
+{
+  RC::LockFreePool pool;
+  std::vector<std::shared_ptr<RC>> rcs;
+  for (int i = 0; i < 64; ++i) {
+    rcs.emplace_back(i & 1 ? std::make_shared<SubRC>(i)
+                           : std::make_shared<RC>(i));
+    pool.give(rcs.back());
+  }
+
+  std::vector<std::thread> threads(std::thread::hardware_concurrency());
+  for (std::size_t n = 0; n < threads.size(); ++n) {
+    threads[n] = std::thread([&, n] {
+      for (int i = 0; i < 1000; ++i) {
+        switch (n % 4) {
+          case 3: // 在别的线程取出和放入的同时丢弃任意的资源
+            RC::LockFreePool::drop(*rcs[i % rcs.size()]);
+            break;
+          case 2:
+            if (auto rc = pool.take_if<SubRC>())
+              pool.give(rc);
+            break;
+          default: {
+            auto rc = pool.take();
+            if (!rc)
+              rc = std::make_shared<RC>(i);
+            pool.give(rc);
+          }
+        }
+      }
+    });
+  }
+
+  for (int i = 0; i < 100; ++i)
+    for (auto& rc : pool.snapshot())
+      BOOST_TEST(rc->mI >= 0);
+
+  for (auto& t : threads)
+    t.join();
+  BOOST_TEST(pool.count() <= rcs.size() + threads.size());
+  BOOST_TEST(pool.snapshot().size() == pool.count());
+}
+
+BOOST_AUTO_TEST_CASE(order)
+{
+  auto take = [](RC::Pool& pool) {
+    auto rc = pool.take();
+    return rc ? rc->mI : -1;
+  };
+  std::vector<std::shared_ptr<RC>> rcs;
+  for (int i = 0; i < 6; ++i)
+    rcs.emplace_back(std::make_shared<RC>(i));
+
+  RC::Pool lifo(RC::Pool::Order::kLifo);
+  for (int i = 0; i < 3; ++i)
+    lifo.give(rcs[i]);
+  BOOST_TEST(take(lifo) == 2);
+  lifo.give(rcs[3]);
+  BOOST_TEST(take(lifo) == 3);
+  BOOST_TEST(take(lifo) == 1);
+  lifo.clear();
+
+  // 先进先出时放入的资源先进入口，出口空了才搬过去
+  RC::Pool fifo(RC::Pool::Order::kFifo);
+  for (int i = 0; i < 3; ++i)
+    fifo.give(rcs[i]);
+  BOOST_TEST(take(fifo) == 0);
+  fifo.give(rcs[3]);
+  fifo.give(std::make_shared<SubRC>(4));
+  BOOST_TEST(fifo.count() == 4);
+  // 顺序只在每条类型链之内成立
+  BOOST_TEST(fifo.take_if<RC>()->mI == 1);
+  BOOST_TEST(fifo.take_if<SubRC>()->mI == 4);
+  BOOST_TEST(take(fifo) == 2);
+  RC::Pool::drop(*rcs[3]);
+  BOOST_TEST(take(fifo) == -1);
+
+  // 入口和出口中的资源都能被遍历和丢弃
+  for (int i = 0; i < 4; ++i)
+    fifo.give(rcs[i]);
+  BOOST_TEST(take(fifo) == 0);
+  fifo.give(rcs[4]);
+  int sum = 0;
+  for (auto it = fifo.begin(); it != RC::Pool::end(); ++it)
+    sum += it->mI;
+  BOOST_TEST(sum == 1 + 2 + 3 + 4);
+  RC::Pool::drop(*rcs[2]);
+  RC::Pool::drop(*rcs[4]);
+  BOOST_TEST(take(fifo) == 1);
+  BOOST_TEST(take(fifo) == 3);
+  fifo.clear();
+
+  // 键大的先被取出，键相同时先进先出
+  RC::Pool prio(RC::Pool::Order::kPriority,
+                [](const RC& rc) { return rc.mI / 2; });
+  for (int i : { 2, 5, 0, 3, 4, 1 })
+    prio.give(rcs[i]);
+  for (int i : { 5, 4, 2, 3, 0, 1, -1 })
+    BOOST_TEST(take(prio) == i);
+}
+
+BOOST_AUTO_TEST_CASE(order_concurrent)
+{
+  for (auto order : { RC::Pool::Order::kLifo,
+                      RC::Pool::Order::kFifo,
+                      RC::Pool::Order::kPriority }) {
+    RC::Pool pool(order, [](const RC& rc) { return rc.mI % 7; });
+    std::vector<std::shared_ptr<RC>> rcs;
+    for (int i = 0; i < 64; ++i) {
+      rcs.emplace_back(i & 1 ? std::make_shared<SubRC>(i)
+                             : std::make_shared<RC>(i));
+      pool.give(rcs.back());
+    }
+
+    std::vector<std::thread> threads(std::thread::hardware_concurrency());
+    for (std::size_t n = 0; n < threads.size(); ++n) {
+      threads[n] = std::thread([&, n] {
+        for (int i = 0; i < 1000; ++i) {
+          std::shared_ptr<RC> rc;
+          switch (n % 4) {
+            case 3: // 在别的线程搬运和插入的同时丢弃任意的资源
+              RC::Pool::drop(*rcs[i % rcs.size()]);
+              continue;
+            case 2:
+              rc = pool.take_if<SubRC>();
+              break;
+            case 1: { // 成批的取出和放入
+              std::vector<std::shared_ptr<RC>> rcs;
+              pool.take_n(i % 5, std::back_inserter(rcs));
+              pool.give_n(std::move(rcs));
+              continue;
+            }
+            default:
+              rc = pool.take();
+          }
+          if (rc)
+            pool.give(std::move(rc));
+        }
+      });
+    }
+    for (auto& t : threads)
+      t.join();
+
+    auto count = pool.count();
+    BOOST_TEST(count <= rcs.size());
+    std::size_t taken = 0;
+    std::int64_t last = 7;
+    while (auto rc = pool.take_if<RC>()) {
+      ++taken;
+      if (order == RC::Pool::Order::kPriority) {
+        BOOST_TEST(rc->mI % 7 <= last);
+        last = rc->mI % 7;
+      }
+    }
+    BOOST_TEST(taken <= count);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(batch)
+{
+  std::vector<std::shared_ptr<RC>> rcs;
+  for (int i = 0; i < 8; ++i)
+    rcs.emplace_back(i < 6 ? std::make_shared<RC>(i)
+                           : std::make_shared<SubRC>(i));
+
+  // 成批放入等价于依次放入
+  RC::Pool pool(0);
+  pool.give_n(rcs);
+  BOOST_TEST(pool.count() == 8);
+  BOOST_TEST(pool.take_if<RC>()->mI == 5);
+  RC::Pool::drop(*rcs[3]);
+
+  std::vector<std::shared_ptr<RC>> out;
+  BOOST_TEST(pool.take_n(3, std::back_inserter(out)) == 3);
+  BOOST_TEST(pool.count() == 3);
+  for (auto& rc : out)
+    BOOST_TEST(!RC::Pool::is_in(*rc));
+  BOOST_TEST(pool.take_n(10, std::back_inserter(out)) == 3);
+  BOOST_TEST(pool.take_n(10, std::back_inserter(out)) == 0);
+  std::vector<int> is;
+  for (auto& rc : out)
+    is.push_back(rc->mI);
+  std::sort(is.begin(), is.end());
+  BOOST_TEST(is == (std::vector<int>{ 0, 1, 2, 4, 6, 7 }));
+
+  // 先进先出时也保持放入的顺序
+  RC::Pool fifo(RC::Pool::Order::kFifo);
+  fifo.give_n(std::vector<std::shared_ptr<RC>>(rcs.begin(), rcs.begin() + 3));
+  fifo.give(rcs[3]);
+  out.clear();
+  BOOST_TEST(fifo.take_n(4, std::back_inserter(out)) == 4);
+  for (int i = 0; i < 4; ++i)
+    BOOST_TEST(out[i]->mI == i);
+
+  // 弹匣的成批补充和退回
+  RC::Pool magazine(4);
+  magazine.give_n(rcs);
+  for (int i = 0; i < 100; ++i) {
+    out.clear();
+    magazine.take_n(i % 6, std::back_inserter(out));
+    for (auto& rc : out)
+      magazine.give(rc);
+    if (auto rc = magazine.take())
+      magazine.give(rc);
+  }
+  BOOST_TEST(magazine.count() == 8);
+}
+
+BOOST_AUTO_TEST_CASE(sharded)
+{
+  RC::ShardedPool pool(3);
+  BOOST_TEST(pool.shards() == 4);
+
+  // 各个线程放入自己的分片，遍历和计数覆盖所有分片
+  std::vector<std::shared_ptr<RC>> rcs;
+  for (int i = 0; i < 16; ++i)
+    rcs.emplace_back(i & 1 ? std::make_shared<SubRC>(i)
+                           : std::make_shared<RC>(i));
+  std::vector<std::thread> threads(4);
+  for (std::size_t n = 0; n < threads.size(); ++n)
+    threads[n] = std::thread([&, n] {
+      for (std::size_t i = n; i < rcs.size(); i += threads.size())
+        pool.give(rcs[i]);
+    });
+  for (auto& t : threads)
+    t.join();
+  BOOST_TEST(pool.count() == 16);
+  int sum = 0;
+  for (auto& rc : pool)
+    sum += rc.mI;
+  BOOST_TEST(sum == 15 * 16 / 2);
+
+  // 丢弃任意分片中的资源
+  for (int i = 0; i < 16; i += 4)
+    RC::ShardedPool::drop(*rcs[i]);
+  BOOST_TEST(pool.count() == 12);
+
+  // 本线程的分片空了就从别的分片窃取
+  int subs = 0;
+  while (auto rc = pool.take_if<SubRC>())
+    ++subs;
+  BOOST_TEST(subs == 8);
+  std::size_t taken = 0;
+  while (pool.take())
+    ++taken;
+  BOOST_TEST(taken == 4);
+  BOOST_TEST(!RC::ShardedPool::is_in(*rcs[2]));
+
+  pool.give(rcs[0]);
+  pool.clear();
+  BOOST_TEST(pool.count() == 0);
+}
+
+BOOST_AUTO_TEST_CASE(sharded_concurrent)
+{
+  RC::ShardedPool pool;
+  std::vector<std::shared_ptr<RC>> rcs;
+  for (int i = 0; i < 64; ++i) {
+    rcs.emplace_back(std::make_shared<RC>(i));
+    pool.give(rcs.back());
+  }
+
+  std::vector<std::thread> threads(std::thread::hardware_concurrency());
+  for (std::size_t n = 0; n < threads.size(); ++n) {
+    threads[n] = std::thread([&, n] {
+      for (int i = 0; i < 1000; ++i) {
+        if (n % 4 == 3) { // 在别的线程窃取的同时丢弃任意的资源
+          RC::ShardedPool::drop(*rcs[i % rcs.size()]);
+          continue;
+        }
+        if (auto rc = pool.take())
+          pool.give(std::move(rc));
+      }
+    });
+  }
+  for (int i = 0; i < 100; ++i)
+    for (auto& rc : pool)
+      BOOST_TEST(rc.mI >= 0);
+  for (auto& t : threads)
+    t.join();
+  BOOST_TEST(pool.count() <= rcs.size());
+}
+
+BOOST_AUTO_TEST_CASE(bounded)
+{
+  using namespace std::chrono_literals;
+  RC::BoundedPool pool(1, 2);
+
+  // 总数达到上限后 make 失败，资源析构后名额归还
+  auto a = pool.make(1);
+  std::shared_ptr<RC> b = pool.make<SubRC>(2);
+  BOOST_TEST((a && b));
+  BOOST_TEST(!pool.make(3));
+  b.reset();
+  b = pool.make(2);
+  BOOST_TEST(b);
+
+  // 空闲资源超过上限时，多出的资源被释放
+  std::weak_ptr<RC> weakB = b;
+  pool.give(a);
+  pool.give(std::move(b));
+  BOOST_TEST(pool.count() == 1);
+  BOOST_TEST(weakB.expired());
+  BOOST_TEST(pool.take() == a);
+
+  // 没有空闲资源也没有名额时等待超时，或者一有名额就返回空指针
+  b = pool.make(2);
+  BOOST_TEST(!pool.take_for(10ms));
+  std::thread([&] {
+    std::this_thread::sleep_for(10ms);
+    b.reset();
+  }).join();
+  BOOST_TEST(!pool.take_for(1s));
+  b = pool.make(2);
+  BOOST_TEST(b);
+
+  // 等待者会拿到别的线程归还的资源
+  std::thread giver([&] {
+    std::this_thread::sleep_for(10ms);
+    pool.give(b);
+  });
+  BOOST_TEST(pool.take_for(10s) == b);
+  giver.join();
+
+  // 排队的回调在归还时被调用；名额空出时以空指针被调用
+  std::shared_ptr<RC> got;
+  int calls = 0;
+  auto handler = [&](std::shared_ptr<RC> rc) { got = std::move(rc), ++calls; };
+  pool.async_take(handler);
+  BOOST_TEST(calls == 0);
+  pool.give(a);
+  BOOST_TEST((calls == 1 && got == a));
+  pool.async_take(handler);
+  got.reset(), a.reset();
+  BOOST_TEST((calls == 2 && !got));
+
+  // 丢弃资源时更新空闲计数
+  pool.give(b);
+  RC::BoundedPool::Stats st = pool.stats();
+  BOOST_TEST(st.mIdle == 1);
+  pool.drop(*b);
+  pool.drop(*b);
+  st = pool.stats();
+  BOOST_TEST(st.mIdle == 0);
+  BOOST_TEST(st.mTotal == 1);
+  BOOST_TEST(st.mPeakTotal == 2);
+  BOOST_TEST(st.mPeakIdle == 1);
+  BOOST_TEST(st.mPeakWaiting == 1);
+  BOOST_TEST(st.mWaits >= 4); // 归还者可能先于 take_for 等待
+  BOOST_TEST(st.mTimeouts == 1);
+  BOOST_TEST(st.mRejects == 1);
+  BOOST_TEST(st.mDiscards == 1);
+
+  // 池析构时排队的回调以空指针结束等待
+  {
+    RC::BoundedPool small(1, 1);
+    auto c = small.make(3);
+    small.async_take(handler);
+    BOOST_TEST(calls == 2);
+  }
+  BOOST_TEST((calls == 3 && !got));
+}
+
+BOOST_AUTO_TEST_CASE(bounded_concurrent)
+{
+  using namespace std::chrono_literals;
+  constexpr std::size_t kMaxTotal = 2;
+  RC::BoundedPool pool(1, kMaxTotal);
+
+  std::atomic<int> inUse{ 0 }, maxInUse{ 0 }, timeouts{ 0 };
+  std::vector<std::thread> threads(std::thread::hardware_concurrency());
+  for (auto& t : threads) {
+    t = std::thread([&] {
+      for (int i = 0; i < 200; ++i) {
+        auto rc = pool.take();
+        while (!rc) {
+          rc = pool.make(i);
+          if (!rc && !(rc = pool.take_for(1s)))
+            ++timeouts; // 也可能只是有了名额，重试即可
+        }
+
+        auto n = ++inUse;
+        for (auto m = maxInUse.load(); m < n;)
+          maxInUse.compare_exchange_weak(m, n);
+        --inUse;
+
+        if (i % 16 == 0)
+          rc.reset(); // 偶尔销毁资源而不是归还，空出名额
+        else
+          pool.give(std::move(rc));
+      }
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+
+  auto st = pool.stats();
+  BOOST_TEST(maxInUse <= int(kMaxTotal));
+  BOOST_TEST(st.mPeakTotal <= kMaxTotal);
+  BOOST_TEST(st.mTotal == st.mIdle);
+  BOOST_TEST(st.mIdle == pool.count());
+  BOOST_TEST(st.mWaiting == 0);
+}
+
+BOOST_AUTO_TEST_CASE(bounded_sweep)
+{
+  using namespace std::chrono_literals;
+  RC::BoundedPool pool;
+  for (int i = 0; i < 3; ++i)
+    pool.give(pool.make(i));
+  std::this_thread::sleep_for(50ms);
+  for (int i = 3; i < 6; ++i)
+    pool.give(pool.make(i));
+
+  // 先归还的三个空闲超时，逐出后名额也归还了
+  BOOST_TEST(pool.sweep(25ms) == 3);
+  BOOST_TEST(pool.count() == 3);
+  auto st = pool.stats();
+  BOOST_TEST((st.mIdle == 3 && st.mTotal == 3 && st.mEvicts == 3));
+  for (auto it = pool.begin(); it; ++it)
+    BOOST_TEST(it->mI >= 3);
+
+  // 只检查最老的两个，检查失败的逐出，通过的放回池中
+  std::vector<int> checked;
+  auto check = [&](RC& rc) {
+    checked.push_back(rc.mI);
+    return rc.mI != 3;
+  };
+  BOOST_TEST(pool.sweep(1h, check, 2) == 1);
+  std::sort(checked.begin(), checked.end());
+  BOOST_TEST((checked == std::vector<int>{ 3, 4 }));
+  BOOST_TEST(pool.count() == 2);
+  BOOST_TEST(pool.stats().mTotal == 2);
+
+  // 放回的资源保留原来的时刻，插回原来的位置，链仍然从新到老
+  std::vector<int> order;
+  for (auto it = pool.begin(); it; ++it)
+    order.push_back(it->mI);
+  BOOST_TEST((order == std::vector<int>{ 5, 4 }));
+  std::this_thread::sleep_for(50ms);
+  BOOST_TEST(pool.sweep(25ms) == 2);
+  BOOST_TEST((pool.count() == 0 && pool.stats().mTotal == 0));
+}
+
+BOOST_AUTO_TEST_CASE(bounded_sweep_concurrent)
+{
+  RC::BoundedPool pool(RC::BoundedPool::kUnlimited, 8);
+  std::atomic<bool> done{ false };
+  std::thread sweeper([&] {
+    while (!done)
+      pool.sweep(std::chrono::microseconds(randgen::tf()),
+                 [](RC& rc) { return rc.mI % 3 != 0; },
+                 4);
+  });
+
+  std::vector<std::thread> threads(std::thread::hardware_concurrency());
+  for (auto& t : threads) {
+    t = std::thread([&] {
+      for (int i = 0; i < 2000; ++i) {
+        auto rc = pool.take();
+        if (!rc && !(rc = pool.make(i)))
+          continue;
+        pool.give(std::move(rc));
+      }
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+  done = true;
+  sweeper.join();
+
+  auto st = pool.stats();
+  BOOST_TEST(st.mTotal == st.mIdle);
+  BOOST_TEST(st.mIdle == pool.count());
+  BOOST_TEST(st.mPeakTotal <= 8);
+
+  // 逐出都经由桩记录，进出的次数与池中的资源数对得上
+  auto c = pool.counters();
+  if (RC::BoundedPool::Counters::kEnabled) {
+    BOOST_TEST(c.mGives - c.mTakes - c.mDrops == pool.count());
+    BOOST_TEST(c.mSize == pool.count());
+    BOOST_TEST(c.mPeakSize <= 8);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(counters)
+{
+  RC::Pool pool(0);
+  for (int i = 0; i < 4; ++i)
+    pool.give(std::make_shared<RC>(i));
+  while (pool.take())
+    ;
+  pool.give(std::make_shared<RC>(4));
+  pool.give(std::make_shared<RC>(5));
+  pool.clear();
+
+  auto c = pool.counters();
+  if (RC::Pool::Counters::kEnabled) {
+    BOOST_TEST(c.mGives == 6);
+    BOOST_TEST(c.mTakes == 4);
+    BOOST_TEST(c.mMisses == 1);
+    BOOST_TEST(c.mDrops == 2);
+    BOOST_TEST(c.mSize == 0);
+    BOOST_TEST(c.mPeakSize == 4);
+    BOOST_TEST(c.mLocks >= 12);
+    BOOST_TEST(c.spins_per_lock() >= 0);
+  } else {
+    BOOST_TEST(c.mGives == 0);
+    BOOST_TEST(c.mLocks == 0);
+  }
+
+  // 多个分片的统计合并在一起
+  RC::ShardedPool sharded(4);
+  std::vector<std::thread> threads(4);
+  for (auto& t : threads)
+    t = std::thread([&] {
+      for (int i = 0; i < 1000; ++i) {
+        auto rc = sharded.take();
+        sharded.give(rc ? std::move(rc) : std::make_shared<RC>(i));
+      }
+    });
+  for (auto& t : threads)
+    t.join();
+  auto sc = sharded.counters();
+  if (RC::ShardedPool::Counters::kEnabled) {
+    BOOST_TEST(sc.mGives == 4000);
+    BOOST_TEST(sc.mGives - sc.mTakes == sharded.count());
+    BOOST_TEST(sc.mSize == sharded.count());
+    BOOST_TEST(sc.mLocks >= sc.mGives + sc.mTakes);
+    std::cout << "sharded spins/lock: " << sc.spins_per_lock() << std::endl;
+  }
+
+  // 导出为 JSON 对象，键名就是去掉前缀 m 的字段名
+  auto jv = c.to_jval();
+  auto& obj = jv.as_object();
+  for (auto* key : { "Takes",
+                     "Gives",
+                     "Misses",
+                     "Drops",
+                     "Locks",
+                     "Spins",
+                     "Size",
+                     "PeakSize" })
+    BOOST_TEST(obj.contains(key));
+  BOOST_TEST(obj.at("Gives").as_uint64() == c.mGives);
+}
+
+/**
+ * @brief 模拟的会话：对象本身和缓冲区都从回收器分配。
+ */
+struct Session : public std::enable_shared_from_this<Session>
+{
+  using Buffer = std::vector<char, Recycler<char, 256>::Allocator<char>>;
+
+  Session(int i)
+    : mI(i)
+  {
+  }
+
+  int mI;
+  Buffer mBuffer;
+};
+
+BOOST_AUTO_TEST_CASE(recycler)
+{
+  using R = Recycler<Session>;
+  using B = Recycler<char, 256>;
+  R::trim(), B::trim();
+  auto fresh = R::stats().mFresh, bufFresh = B::stats().mFresh;
+
+  {
+    auto s = R::make_shared(1);
+    BOOST_TEST(s->mI == 1);
+    BOOST_TEST((s->shared_from_this() == s));
+    s->mBuffer.reserve(200);
+  }
+  BOOST_TEST(R::stats().mFresh == fresh + 1);
+  BOOST_TEST(B::stats().mFresh == bufFresh + 1);
+
+  // 稳定状态下对象、控制块和缓冲区都不再从堆上分配
+  {
+    auto s = R::make_shared(2);
+  }
+  BOOST_TEST(R::stats().mFresh == fresh + 1);
+  // 下面同时存活两个对象，还要再分配一块
+  fresh += 2, bufFresh += 2;
+  for (int i = 0; i < 100; ++i) {
+    auto a = R::make_shared(i), b = R::make_shared(i + 1);
+    a->mBuffer.assign(100, 'a'), b->mBuffer.assign(200, 'b');
+    BOOST_TEST((a->mI == i && b->mI == i + 1));
+  }
+  BOOST_TEST(R::stats().mFresh == fresh);
+  BOOST_TEST(B::stats().mFresh == bufFresh);
+
+  // 弱引用还在时控制块不能回收
+  auto s = R::make_shared(3), t = R::make_shared(4);
+  std::weak_ptr<Session> w = s;
+  s.reset(), t.reset();
+  auto u = R::make_shared(5), v = R::make_shared(6);
+  BOOST_TEST(R::stats().mFresh == fresh + 1);
+  w.reset(), u.reset(), v.reset();
+  u = R::make_shared(7), v = R::make_shared(8), s = R::make_shared(9);
+  BOOST_TEST(R::stats().mFresh == fresh + 1);
+  u.reset(), v.reset(), s.reset();
+
+  // 超出块规格的请求直接走堆
+  auto oversize = B::stats().mOversize;
+  {
+    Session big(0);
+    big.mBuffer.resize(1000);
+  }
+  BOOST_TEST(B::stats().mOversize == oversize + 1);
+
+  // 弹匣和共享链都清空后只能再从堆上分配
+  R::reserve(4);
+  BOOST_TEST(R::stats().mIdle >= 4);
+  R::trim();
+  BOOST_TEST(R::stats().mIdle == 0);
+  fresh = R::stats().mFresh;
+  R::make_shared(0);
+  BOOST_TEST(R::stats().mFresh == fresh + 1);
+  R::trim(), B::trim();
+}
+
+BOOST_AUTO_TEST_CASE(recycler_concurrent)
+{
+  using R = Recycler<Session>;
+  R::trim();
+  auto fresh = R::stats().mFresh;
+
+  constexpr std::size_t kBatch = 8;
+  std::atomic<int> errors{ 0 };
+  std::vector<std::shared_ptr<Session>> shared(64);
+  std::vector<std::thread> threads(std::thread::hardware_concurrency());
+  for (std::size_t t = 0; t < threads.size(); ++t) {
+    threads[t] = std::thread([&, t] {
+      std::vector<std::shared_ptr<Session>> live;
+      for (int i = 0; i < 1000; ++i) {
+        live.emplace_back(R::make_shared(int(t) * 1000 + i));
+        if (live.size() == kBatch || randgen::tf()) {
+          for (auto& s : live)
+            if (s->mI / 1000 != int(t))
+              ++errors;
+          // 偶尔交给别的线程释放，块会落到别的线程的弹匣里
+          std::atomic_store(&shared[i % shared.size()], std::move(live[0]));
+          live.clear();
+        }
+      }
+    });
+  }
+  for (auto& t : threads)
+    t.join();
+  shared.clear();
+  R::bin().flush(*R::magazine()); // 主线程的弹匣也收到了块
+
+  // 线程退出时弹匣已经退回，所有的块都回到了共享链上
+  BOOST_TEST(errors == 0);
+  auto st = R::stats();
+  auto perThread = kBatch + 1 + _Recycler::Bin::kMagazine;
+  BOOST_TEST(st.mFresh - fresh <= threads.size() * perThread + 64);
+  BOOST_TEST(st.mIdle == st.mFresh - fresh);
+  R::trim();
+}
+
+BOOST_AUTO_TEST_CASE(recycler_thread_exit)
+{
+  using R = Recycler<Session>;
+  R::trim();
+  auto fresh = R::stats().mFresh;
+
+  // 先于弹匣构造的线程本地对象后于弹匣析构，释放时弹匣已经关闭
+  std::thread([] {
+    static thread_local std::shared_ptr<Session> tHeld;
+    auto& held = tHeld;
+    held = R::make_shared(1);
+  }).join();
+
+  auto st = R::stats();
+  BOOST_TEST(st.mFresh == fresh + 1);
+  BOOST_TEST(st.mIdle == 1);
+  R::trim();
+}
+
+/**
+ * @brief 多个线程反复取出和归还资源，返回每秒的吞吐量。
+ */
+template<typename P, typename F>
+double
+churn(P& pool, std::size_t threadsNum, int loops, F&& make)
+{
   auto ns = timing({
               std::vector<std::thread> threads(threadsNum);
               for (auto& t : threads) {
@@ -104,17 +1036,190 @@ BOOST_AUTO_TEST_CASE(performance)
                   for (int i = 0; i < loops; ++i) {
                     auto rc = pool.take();
                     if (!rc)
-                      rc = std::make_shared<RC>(i);
-                    pool.give(rc);
+                      rc = make(i);
+                    pool.give(std::move(rc));
                   }
                 });
               }
               for (auto& t : threads)
                 t.join();
             }).count();
+  return loops * threadsNum / (double(ns) / 1e9);
+}
 
+/**
+ * @brief 模拟的连接：负载用来体现缓存的冷热，时间戳用来判断连接是否已经
+ * 因为空闲太久被服务器关闭。
+ */
+struct Warm : public Pooled<Warm>
+{
+  std::int64_t mUsed{ 0 };
+  char mPayload[16 << 10]{};
+};
+
+/**
+ * @brief 每轮取出几个资源，读写其负载后归还，统计每次取用的耗时、取到的资源
+ * 中空闲超过 keepAlive 轮的比例，以及用到过的不同资源数。
+ */
+template<typename F>
+void
+reuse(const char* name, Warm::Pool& pool, int loops, F&& report)
+{
+  constexpr std::size_t kSize = 256; // 共 4 MB，超出大多数 L2 缓存
+  constexpr std::int64_t kKeepAlive = 64;
+  for (std::size_t i = 0; i < kSize; ++i)
+    pool.give(std::make_shared<Warm>());
+
+  std::int64_t tick = 0;
+  std::size_t takes = 0, stale = 0;
+  std::vector<const Warm*> used;
+  std::vector<std::shared_ptr<Warm>> burst;
+  auto ns = timing({
+              for (int i = 0; i < loops; ++i) {
+                for (int n = 1 + i * 7 % 4; n; --n) {
+                  auto w = pool.take();
+                  ++takes;
+                  if (tick - w->mUsed > kKeepAlive)
+                    ++stale;
+                  for (std::size_t j = 0; j < sizeof(w->mPayload); j += 64)
+                    ++w->mPayload[j];
+                  w->mUsed = ++tick;
+                  used.emplace_back(w.get());
+                  burst.emplace_back(std::move(w));
+                }
+                for (auto& w : burst)
+                  pool.give(std::move(w));
+                burst.clear();
+              }
+            }).count();
+  std::sort(used.begin(), used.end());
+  auto distinct = std::unique(used.begin(), used.end()) - used.begin();
+  report(name, double(ns) / takes, double(stale) / takes, distinct);
+  pool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(performance)
+{
+  auto loopsEnv = std::getenv("LOOPS");
+  auto loops = loopsEnv ? std::atoi(loopsEnv) : 10000;
+  auto threadsEnv = std::getenv("THREADS");
+  auto threadsNum =
+    threadsEnv ? std::atoi(threadsEnv) : std::thread::hardware_concurrency();
+
+  auto make = [](int i) { return std::make_shared<RC>(i); };
+  auto makeIntrusive = [](int i) { return make_intrusive<IRC>(i); };
+
+  RC::Pool direct(0);
+  auto directTp = churn(direct, threadsNum, loops, make);
   std::cout << threadsNum << " threads perform " << loops
-            << " loops, with total " << loops * threadsNum / (double(ns) / 1e9)
+            << " loops without magazine, with total " << directTp
+            << " throughput per second and " << direct.count()
+            << " items in pool." << std::endl;
+
+  RC::Pool pool(RC::Pool::kMagazine);
+  auto tp = churn(pool, threadsNum, loops, make);
+  std::cout << threadsNum << " threads perform " << loops
+            << " loops with magazine, with total " << tp
             << " throughput per second and " << pool.count()
             << " items in pool." << std::endl;
+
+  RC::LockFreePool lockFree;
+  auto lockFreeTp = churn(lockFree, threadsNum, loops, make);
+  std::cout << threadsNum << " threads perform " << loops
+            << " loops on lock-free pool, with total " << lockFreeTp
+            << " throughput per second and " << lockFree.count()
+            << " items in pool." << std::endl;
+
+  RC::ShardedPool sharded;
+  auto shardedTp = churn(sharded, threadsNum, loops, make);
+  std::cout << threadsNum << " threads perform " << loops
+            << " loops on sharded pool, with total " << shardedTp
+            << " throughput per second and " << sharded.count()
+            << " items in pool." << std::endl;
+
+  // 分片池与单一全局链的吞吐量随线程数的变化
+  for (std::size_t n = 1; n <= std::size_t(threadsNum); n *= 2) {
+    RC::Pool single(0);
+    RC::ShardedPool shards;
+    auto singleTp = churn(single, n, loops, make);
+    auto shardsTp = churn(shards, n, loops, make);
+    std::cout << n << " threads scaling, throughput per second: single "
+              << singleTp << ", sharded " << shardsTp << std::endl;
+  }
+
+  IRC::Pool intrusive;
+  auto intrusiveTp = churn(intrusive, threadsNum, loops, makeIntrusive);
+  std::cout << threadsNum << " threads perform " << loops
+            << " loops on intrusive pool, with total " << intrusiveTp
+            << " throughput per second and " << intrusive.count()
+            << " items in pool." << std::endl;
+
+  // 预热和回收资源池时，成批操作只锁定一次桩
+  {
+    std::vector<std::shared_ptr<RC>> rcs, out;
+    for (int i = 0; i < loops; ++i)
+      rcs.emplace_back(make(i));
+    out.reserve(rcs.size());
+    RC::Pool warm(0);
+    auto giveNs = timing({
+                    for (auto& rc : rcs)
+                      warm.give(rc);
+                  }).count();
+    auto takeNs = timing({
+                    while (auto rc = warm.take())
+                      out.emplace_back(std::move(rc));
+                  }).count();
+    out.clear();
+    auto giveNNs = timing({ warm.give_n(rcs); }).count();
+    auto takeNNs = timing({
+                     warm.take_n(rcs.size(), std::back_inserter(out));
+                   }).count();
+    std::cout << rcs.size() << " items, ns per item: give "
+              << giveNs / double(loops) << ", give_n "
+              << giveNNs / double(loops) << ", take "
+              << takeNs / double(loops) << ", take_n "
+              << takeNNs / double(loops) << std::endl;
+  }
+
+  // 比较不同的取出顺序下缓存的冷热和连接的复用情况
+  auto report = [](const char* name, double ns, double stale, long distinct) {
+    std::cout << "order " << name << ": " << ns << " ns per take, "
+              << stale * 100 << "% stale, " << distinct
+              << " distinct items used." << std::endl;
+  };
+  Warm::Pool lifoOrder(Warm::Pool::Order::kLifo);
+  reuse("lifo", lifoOrder, loops, report);
+  Warm::Pool fifoOrder(Warm::Pool::Order::kFifo);
+  reuse("fifo", fifoOrder, loops, report);
+  Warm::Pool warmest(Warm::Pool::Order::kPriority,
+                     [](const Warm& w) { return w.mUsed; });
+  reuse("warmest-first", warmest, loops, report);
+
+  // 池中的每次操作都要固定前驱节点，比较两种引用计数固定一次节点的开销
+  auto rc = make(0);
+  auto irc = makeIntrusive(0);
+  auto pin = [&](auto&& f) {
+    return timing({
+             std::vector<std::thread> threads(threadsNum);
+             for (auto& t : threads)
+               t = std::thread([&] {
+                 for (int i = 0; i < loops; ++i)
+                   f();
+               });
+             for (auto& t : threads)
+               t.join();
+           }).count() /
+           double(loops * threadsNum);
+  };
+  auto sharedNs = pin([&] { rc->shared_from_this(); });
+  auto intrusiveNs = pin([&] { irc->ptr_from_this(); });
+  std::cout << threadsNum << " threads pin a node, ns per pin: shared "
+            << sharedNs << ", intrusive " << intrusiveNs << std::endl;
+
+  // 每次创建并销毁一个会话，比较直接走堆和从回收器分配
+  Recycler<Session>::reserve(threadsNum);
+  auto heapNs = pin([] { std::make_shared<Session>(0); });
+  auto recycledNs = pin([] { Recycler<Session>::make_shared(0); });
+  std::cout << threadsNum << " threads create a session, ns per create: heap "
+            << heapNs << ", recycled " << recycledNs << std::endl;
 }
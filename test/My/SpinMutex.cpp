@@ -1,8 +1,11 @@
 #include "testutil.hpp"
 
 #include <My/SpinMutex.hpp>
+#include <algorithm>
 #include <mutex>
+#include <shared_mutex>
 #include <thread>
+#include <tuple>
 #include <vector>
 
 using namespace My;
@@ -114,11 +117,13 @@ BOOST_AUTO_TEST_CASE(recursive)
     thread.join();
 }
 
-BOOST_AUTO_TEST_CASE(shared)
+using SharedMutexes = std::tuple<SpinMutex::Shared, SpinMutex::Distributed>;
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(shared, M, SharedMutexes)
 {
   std::vector<std::thread> threads(std::thread::hardware_concurrency());
 
-  SpinMutex::Shared mutex;
+  M mutex;
   Progression series(randgen::range(0, 100), threads.size());
 
   for (auto& thread : threads)
@@ -179,6 +184,127 @@ BOOST_AUTO_TEST_CASE(shared)
     thread.join();
 }
 
+BOOST_AUTO_TEST_CASE(distributed)
+{
+  BOOST_TEST(SpinMutex::Distributed(3).slots() == 4);
+  BOOST_TEST(SpinMutex::Distributed(8).slots() == 8);
+
+  SpinMutex::Distributed mutex(4);
+  mutex.lock_shared();
+  BOOST_TEST(!mutex.try_lock());
+  BOOST_TEST(!mutex.try_lock_for(1ms));
+
+  // 其它线程的读者落在别的槽上，同样要被写者看到
+  std::thread([&] {
+    BOOST_TEST(mutex.try_lock_shared());
+    mutex.unlock_shared();
+  }).join();
+  mutex.unlock_shared();
+
+  mutex.lock();
+  BOOST_TEST(!mutex.try_lock_shared());
+  std::thread([&] { BOOST_TEST(!mutex.try_lock_shared_for(1ms)); }).join();
+  mutex.unlock();
+  BOOST_TEST(mutex.try_lock_shared());
+  mutex.unlock_shared();
+}
+
+/**
+ * @brief 读者不断加共享锁时，测量写者 loops 次加锁中最长的等待时间。
+ *
+ * 读者优先时写者可能一直拿不到锁，因此用 try_lock_for 限定每次的等待。
+ */
+static std::chrono::nanoseconds
+writer_wait(SpinMutex::Shared::Prefer prefer, std::size_t loops)
+{
+  SpinMutex::Shared mutex(prefer);
+  std::atomic<bool> stop{ false };
+  std::vector<std::thread> readers(std::thread::hardware_concurrency());
+  for (auto& reader : readers)
+    reader = std::thread([&] {
+      while (!stop.load(std::memory_order_relaxed)) {
+        std::shared_lock<SpinMutex::Shared> lock(mutex);
+        for (volatile int i = 0; i < 100; ++i)
+          ;
+      }
+    });
+
+  std::chrono::nanoseconds worst{ 0 };
+  for (std::size_t i = 0; i < loops; ++i) {
+    auto begin = std::chrono::steady_clock::now();
+    auto locked = mutex.try_lock_for(100ms);
+    worst = std::max(worst, std::chrono::steady_clock::now() - begin);
+    if (locked)
+      mutex.unlock();
+    std::this_thread::yield();
+  }
+
+  stop = true;
+  for (auto& reader : readers)
+    reader.join();
+  return worst;
+}
+
+BOOST_AUTO_TEST_CASE(shared_starvation)
+{
+  auto loopsEnv = std::getenv("LOOPS");
+  auto loops = loopsEnv ? std::atoi(loopsEnv) : 100;
+
+  auto reader = writer_wait(SpinMutex::Shared::Prefer::kReader, loops);
+  auto writer = writer_wait(SpinMutex::Shared::Prefer::kWriter, loops);
+  std::cout << "writer worst wait in " << loops << " loops: prefer reader "
+            << reader.count() << "ns, prefer writer " << writer.count()
+            << "ns" << std::endl;
+  BOOST_TEST((writer < 100ms));
+}
+
+using QueuedMutexes = std::tuple<SpinMutex::Ticket, SpinMutex::Mcs>;
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(queued, M, QueuedMutexes)
+{
+  std::vector<std::thread> threads(std::thread::hardware_concurrency());
+
+  M mutex;
+  Progression series(randgen::range(0, 100), threads.size());
+  BOOST_ASSERT(series.check());
+
+  for (auto& thread : threads)
+    thread = std::thread([&] {
+      for (std::size_t i = 0; i < 1000; ++i) {
+        switch (i % 4) {
+          case 0:
+            mutex.lock();
+            break;
+          case 1:
+            if (!mutex.try_lock())
+              continue;
+            break;
+          case 2:
+            if (!mutex.try_lock_for(1ms))
+              continue;
+            break;
+          case 3:
+            if (!mutex.try_lock_until(std::chrono::steady_clock::now() + 1ms))
+              continue;
+            break;
+        }
+
+        BOOST_TEST(series.check());
+        series.assign(randgen::range(0, 100));
+        mutex.unlock();
+      }
+    });
+  for (auto& thread : threads)
+    thread.join();
+
+  // 一个线程可以同时持有多把队列锁
+  M other;
+  std::lock_guard<M> lockA(mutex);
+  std::lock_guard<M> lockB(other);
+  BOOST_TEST(!mutex.try_lock());
+  BOOST_TEST(!other.try_lock());
+}
+
 BOOST_AUTO_TEST_CASE(spin_bit)
 {
   {
@@ -273,3 +399,132 @@ BOOST_AUTO_TEST_CASE(spin_bit)
       thread.join();
   }
 }
+
+using SpinPolicies = std::tuple<SpinPolicy::None,
+                                SpinPolicy::Pause,
+                                SpinPolicy::Backoff<>,
+                                SpinPolicy::Yield<>,
+                                SpinPolicy::Park<>>;
+
+BOOST_AUTO_TEST_CASE_TEMPLATE(spin_policy, P, SpinPolicies)
+{
+  using Mutex = BasicSpinMutex<P>;
+
+  std::vector<std::thread> threads(std::thread::hardware_concurrency());
+
+  Mutex mutex;
+  typename Mutex::Recursive recursive;
+  typename Mutex::Shared shared;
+  std::atomic<int> bits{ 0 };
+  typename Mutex::template Bit<int, 3> bit(bits);
+  typename Mutex::Ticket ticket;
+  typename Mutex::Mcs mcs;
+  typename Mutex::Distributed distributed(2);
+  std::size_t counts[7]{};
+
+  for (auto& thread : threads)
+    thread = std::thread([&] {
+      for (std::size_t i = 0; i < 1400; ++i) {
+        switch (i % 7) {
+          case 0: {
+            std::lock_guard<Mutex> lock(mutex);
+            ++counts[0];
+          } break;
+          case 1: {
+            std::lock_guard<typename Mutex::Recursive> lock(recursive);
+            std::lock_guard<typename Mutex::Recursive> again(recursive);
+            ++counts[1];
+          } break;
+          case 2: {
+            if (!shared.try_lock_for(1s))
+              continue;
+            ++counts[2];
+            shared.unlock();
+          } break;
+          case 3: {
+            std::lock_guard<decltype(bit)> lock(bit);
+            ++counts[3];
+          } break;
+          case 4: {
+            std::lock_guard<typename Mutex::Ticket> lock(ticket);
+            ++counts[4];
+          } break;
+          case 5: {
+            std::lock_guard<typename Mutex::Mcs> lock(mcs);
+            ++counts[5];
+          } break;
+          case 6: {
+            std::lock_guard<typename Mutex::Distributed> lock(distributed);
+            ++counts[6];
+          } break;
+        }
+      }
+    });
+  for (auto& thread : threads)
+    thread.join();
+
+  for (auto count : counts)
+    BOOST_TEST(count == threads.size() * 200);
+  BOOST_TEST(bits.load() == 0);
+}
+
+/**
+ * @brief 每次尝试都执行 RMW 操作的朴素自旋锁，作为测试-测试-设置的对照。
+ */
+struct TasMutex
+{
+  std::atomic<bool> mLocked{ false };
+
+  void lock() noexcept
+  {
+    while (mLocked.exchange(true, std::memory_order_acquire))
+      SpinPolicy::pause();
+  }
+
+  void unlock() noexcept { mLocked.store(false, std::memory_order_release); }
+};
+
+/**
+ * @brief 多个线程争用同一把锁，返回每秒完成的加解锁次数。
+ */
+template<typename M>
+double
+contend(M& mutex, std::size_t threadsNum, std::size_t loops)
+{
+  std::uint64_t counter = 0;
+  auto ns = timing({
+              std::vector<std::thread> threads(threadsNum);
+              for (auto& t : threads)
+                t = std::thread([&] {
+                  for (std::size_t i = 0; i < loops; ++i) {
+                    std::lock_guard<M> lock(mutex);
+                    ++counter;
+                  }
+                });
+              for (auto& t : threads)
+                t.join();
+            }).count();
+  BOOST_TEST(counter == threadsNum * loops);
+  return threadsNum * loops / (double(ns) / 1e9);
+}
+
+BOOST_AUTO_TEST_CASE(contention)
+{
+  auto loopsEnv = std::getenv("LOOPS");
+  auto loops = loopsEnv ? std::atoi(loopsEnv) : 100000;
+
+  std::size_t threadsNums[] = { 2, 8, std::thread::hardware_concurrency() };
+  for (auto threadsNum : threadsNums) {
+    TasMutex tas;
+    BasicSpinMutex<SpinPolicy::Pause> ttas;
+    std::atomic<std::uintptr_t> word{ 0 };
+    BasicSpinMutex<SpinPolicy::Pause>::Bit<std::uintptr_t, 0> bit(word);
+
+    auto tasTp = contend(tas, threadsNum, loops);
+    auto ttasTp = contend(ttas, threadsNum, loops);
+    auto bitTp = contend(bit, threadsNum, loops);
+    std::cout << threadsNum << " threads perform " << loops
+              << " loops, with throughput per second: tas " << tasTp
+              << ", ttas " << ttasTp << ", ttas bit " << bitTp << std::endl;
+  }
+}
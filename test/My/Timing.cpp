@@ -1,5 +1,13 @@
 #include "testutil.hpp"
 
+#include <My/CFile64.hpp>
+#include <boost/json.hpp>
+#include <map>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <thread>
+
 using namespace My;
 
 /**
@@ -14,3 +22,447 @@ BOOST_AUTO_TEST_CASE(performance)
   std::cout << kLoops << " times cost " << cost << ", " << cost / kLoops
             << " per time." << std::endl;
 }
+
+/**
+ * @brief TSC 时钟与 steady_clock 走得一样快，而读一次要快得多。
+ */
+BOOST_AUTO_TEST_CASE(tsc_clock)
+{
+  namespace sc = std::chrono;
+
+  TscClock::now(); // 先完成校准
+  auto t0 = TscClock::ticks();
+  auto tsc0 = TscClock::now();
+  auto steady0 = sc::steady_clock::now();
+  std::this_thread::sleep_for(50ms);
+  auto t1 = TscClock::ticks();
+  auto tsc1 = TscClock::now();
+  auto steady1 = sc::steady_clock::now();
+
+  double tsc = (tsc1 - tsc0).count();
+  double steady = sc::nanoseconds(steady1 - steady0).count();
+  BOOST_TEST(std::abs(tsc / steady - 1) < 0.01);
+  double deferred = TscClock::to_duration(t1 - t0).count();
+  BOOST_TEST(std::abs(deferred / steady - 1) < 0.01);
+  // 同一纪元，读数可以直接与 steady_clock 比较
+  BOOST_TEST(std::abs(double(tsc1.time_since_epoch().count()) -
+                      double(steady1.time_since_epoch().count())) < 1e6);
+
+  constexpr std::size_t kLoops = 1000000;
+  std::uint64_t sink = 0;
+  auto hrc = niming(kLoops, {
+    sink += sc::high_resolution_clock::now().time_since_epoch().count();
+  });
+  auto ticks = niming(kLoops, sink += TscClock::ticks());
+  auto now = niming(kLoops, sink += TscClock::now().time_since_epoch().count());
+  std::cout << "ns per read: high_resolution_clock "
+            << double(hrc.count()) / kLoops << ", tsc ticks "
+            << double(ticks.count()) / kLoops << ", tsc now "
+            << double(now.count()) / kLoops << " (" << (sink & 1) << ')'
+            << std::endl;
+}
+
+/**
+ * @brief 多个线程交替向多个计时序列记录，序列析构后线程本地的分配区也随之作废。
+ */
+BOOST_AUTO_TEST_CASE(arena)
+{
+  std::atomic<int> errors{ 0 };
+  std::vector<std::thread> threads(4);
+  for (auto& t : threads)
+    t = std::thread([&] {
+      for (int round = 0; round < 20; ++round) {
+        Timing a, b;
+        auto c = a; // 浅拷贝共享同一个序列
+        for (int i = 0; i < 100; ++i) {
+          a("a");
+          b("b", new Timing::StrInfo(std::to_string(i).c_str()), true);
+          c("c");
+        }
+        std::size_t as = 0, bs = 0;
+        for (auto& i : a)
+          as += i.mTag == MY_TIMING_TAG("a") || i.mTag == MY_TIMING_TAG("c");
+        for (auto& i : b)
+          bs += i.info() == std::to_string(bs);
+        if (as != 200 || bs != 100)
+          ++errors;
+      }
+    });
+  for (auto& t : threads)
+    t.join();
+  BOOST_TEST(errors == 0);
+}
+
+/**
+ * @brief 各线程的缓冲区按时刻归并，导出再导入后顺序不变。
+ */
+BOOST_AUTO_TEST_CASE(merge)
+{
+  Timing tim;
+  std::vector<std::thread> threads(4);
+  for (std::size_t n = 0; n < threads.size(); ++n)
+    threads[n] = std::thread([&, n] {
+      const char* tags[] = { "t0", "t1", "t2", "t3" };
+      for (int i = 0; i < 1000; ++i)
+        tim(tags[n]);
+    });
+  {
+    Timing::Scope scope(tim, "main");
+    // 记录的同时可以遍历，看到的总是各线程已发布的前缀
+    for (int i = 0; i < 10; ++i) {
+      std::size_t cnt = 0;
+      for (auto& j : tim)
+        cnt += j.tag() != nullptr;
+      BOOST_TEST(cnt <= 4001);
+    }
+  }
+  for (auto& t : threads)
+    t.join();
+
+  std::size_t cnt = 0, disorders = 0;
+  auto last = tim.initial();
+  for (auto& i : tim) {
+    disorders += i.mTime < last;
+    last = i.mTime;
+    ++cnt;
+  }
+  BOOST_TEST(cnt == 4002);
+  BOOST_TEST(disorders == 0);
+
+  auto copy = Timing::from_json(tim.to_jval());
+  auto it = copy.begin();
+  for (auto& i : tim) {
+    BOOST_TEST(it->mTag == i.mTag);
+    BOOST_TEST(it->info() == i.info());
+    ++it;
+  }
+  BOOST_TEST((it == copy.end()));
+}
+
+/**
+ * @brief 写出二进制格式再映射读回，逐条一致，回放的打印与原序列相同。
+ */
+BOOST_AUTO_TEST_CASE(binary)
+{
+  Timing tim;
+  {
+    Timing::Scope scope(tim, "outer");
+    tim("say", new Timing::StrInfo("a\nb"), true);
+    tim("empty", new Timing::StrInfo(""), true);
+    std::thread([&] {
+      Timing::Scope scope(tim, "worker");
+      tim("point");
+    }).join();
+  }
+
+  CFile64 file(std::tmpfile());
+  CFile64::Closer closer(file);
+  tim.to_binary(file);
+  Timing::Mapped mapped(file);
+  BOOST_TEST(mapped.size() == 7);
+  BOOST_TEST(mapped.tags().size() == 5);
+  BOOST_TEST((mapped.initial() == tim.initial()));
+  auto it = tim.begin();
+  for (auto& i : mapped) {
+    BOOST_TEST(i.mTag == it->tag());
+    BOOST_TEST((i.mTime == it->mTime));
+    BOOST_TEST(i.mThread == it.thread());
+    BOOST_TEST(i.mInfo == it->info());
+    ++it;
+  }
+  BOOST_TEST((it == tim.end()));
+
+  std::ostringstream text, replay;
+  text << tim;
+  replay << mapped;
+  BOOST_TEST(text.str() == replay.str());
+
+  // 写出中途被打断的末块被忽略，不是这个格式的文件报错
+  file.rewind();
+  auto data = file.rest_s();
+  CFile64 cut(std::tmpfile());
+  CFile64::Closer cutCloser(cut);
+  cut.write(data.data(), data.size() - 1, 1);
+  Timing::Mapped partial(cut);
+  BOOST_TEST(partial.size() == 0);
+  BOOST_TEST(partial.tags().size() == 5);
+  BOOST_CHECK_THROW(Timing::Mapped(CFile64(std::tmpfile())), Err);
+
+  // 大量条目时的写出和读取速度
+  Timing big;
+  constexpr std::size_t kEntries = 100000;
+  for (std::size_t i = 0; i < kEntries; ++i)
+    Timing::Scope scope(big, "loop");
+  CFile64 out(std::tmpfile());
+  CFile64::Closer outCloser(out);
+  auto write = timing(big.to_binary(out));
+  Timing::Mapped all(out);
+  std::size_t threads = 0;
+  auto read = timing({
+    for (auto& i : all)
+      threads += i.mThread;
+  });
+  BOOST_TEST(all.size() == 2 * kEntries);
+  std::cout << 2 * kEntries << " entries to binary, ns per entry: "
+            << double(write.count()) / (2 * kEntries) << " write, "
+            << double(read.count()) / (2 * kEntries) << " read, "
+            << double(out.size()) / (2 * kEntries) << " bytes per entry"
+            << std::endl;
+}
+
+/**
+ * @brief 内容相同的标签编号相同，多个线程并发注册得到一致的编号。
+ */
+BOOST_AUTO_TEST_CASE(tags)
+{
+  auto a = MY_TIMING_TAG("tags.a");
+  std::string copy = "tags.a";
+  BOOST_TEST(Timing::tag_id(copy.c_str()) == a);
+  BOOST_TEST(MY_TIMING_TAG("tags.b") != a);
+  BOOST_TEST(Timing::tag_name(a) == copy);
+  BOOST_TEST(Timing::tag_id("") == 0);
+  BOOST_TEST(a < Timing::tag_count());
+
+  std::vector<std::vector<Timing::TagId>> ids(4);
+  std::vector<std::thread> threads(ids.size());
+  for (std::size_t n = 0; n < threads.size(); ++n)
+    threads[n] = std::thread([&ids, n] {
+      for (int i = 0; i < 1000; ++i) {
+        auto name = "tags." + std::to_string(i);
+        ids[n].push_back(Timing::tag_id(name.c_str()));
+      }
+    });
+  for (auto& t : threads)
+    t.join();
+  for (std::size_t n = 1; n < ids.size(); ++n)
+    BOOST_TEST((ids[n] == ids[0]));
+  for (int i = 0; i < 1000; ++i)
+    BOOST_TEST(Timing::tag_name(ids[0][i]) == "tags." + std::to_string(i));
+
+  Timing tim(1);
+  constexpr auto kLoops = 1000000;
+  auto byName = niming(kLoops, tim("tags.loop"));
+  auto byId = niming(kLoops, tim(MY_TIMING_TAG("tags.loop")));
+  std::cout << "record by name " << byName / kLoops << ", by id "
+            << byId / kLoops << " per time." << std::endl;
+}
+
+/**
+ * @brief 默认的 monitor 只打印匹配筛选器的标签，以及未开启和不匹配时的开销。
+ */
+BOOST_AUTO_TEST_CASE(monitor)
+{
+  Timing tim(1);
+  auto before = MY_TIMING_TAG("mon.a"); // 设置筛选器之前注册的标签也会重新匹配
+  std::ostringstream out;
+  auto* buf = std::cout.rdbuf(out.rdbuf());
+  Timing::monitor_filter("mon\\.(a|b)");
+  tim(before);
+  tim("mon.b");
+  tim("mon.c");
+  Timing::monitor_filter(nullptr);
+  tim(before);
+  std::cout.rdbuf(buf);
+
+  auto text = out.str();
+  BOOST_TEST(text.find("mon.a") != std::string::npos);
+  BOOST_TEST(text.find("mon.a") == text.rfind("mon.a")); // 关闭后不再打印
+  BOOST_TEST(text.find("mon.b") != std::string::npos);
+  BOOST_TEST(text.find("mon.c") == std::string::npos);
+
+  constexpr auto kLoops = 1000000;
+  auto tag = MY_TIMING_TAG("mon.loop");
+  auto off = niming(kLoops, tim(tag));
+  Timing::monitor_filter("mon\\.none");
+  auto on = niming(kLoops, tim(tag));
+  Timing::monitor_filter(nullptr);
+  std::regex re("mon\\.none");
+  auto regex = niming(kLoops, std::regex_match("mon.loop", re));
+  std::cout << "monitor: " << off / kLoops << " disabled, " << on / kLoops
+            << " enabled per record, " << regex / kLoops
+            << " per regex match." << std::endl;
+}
+
+/**
+ * @brief 导出为 Chrome Trace Event 格式，作用域成为成对的持续事件。
+ */
+BOOST_AUTO_TEST_CASE(trace)
+{
+  Timing tim;
+  {
+    Timing::Scope scope(tim, "outer");
+    tim("say \"hi\"", new Timing::StrInfo("a\nb"), true);
+    std::thread([&] { Timing::Scope scope(tim, "worker"); }).join();
+  }
+
+  CFile64 file(std::tmpfile());
+  CFile64::Closer closer(file);
+  tim.to_trace(file);
+  file.rewind();
+  auto text = file.rest_s();
+
+  auto count = [&](const std::string& s) {
+    std::size_t n = 0;
+    for (auto i = text.find(s); i != text.npos; i = text.find(s, i + 1))
+      ++n;
+    return n;
+  };
+  auto header = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":["s;
+  BOOST_TEST(text.compare(0, header.size(), header) == 0);
+  BOOST_TEST(text.substr(text.size() - 4) == "\n]}\n");
+  BOOST_TEST(count("\"ph\":\"B\"") == 2);
+  BOOST_TEST(count("\"ph\":\"E\"") == 2);
+  BOOST_TEST(count("\"ph\":\"i\"") == 1);
+  BOOST_TEST(count("\"name\":\"say \\\"hi\\\"\"") == 1);
+  BOOST_TEST(count("\"args\":{\"info\":\"a\\nb\"}") == 1);
+  BOOST_TEST(count("\"tid\":") == 5);
+
+  // 大量条目时的导出速度
+  Timing big;
+  constexpr std::size_t kEntries = 100000;
+  for (std::size_t i = 0; i < kEntries; ++i)
+    Timing::Scope scope(big, "loop");
+  CFile64 out(std::tmpfile());
+  CFile64::Closer outCloser(out);
+  auto cost = timing(big.to_trace(out));
+  std::cout << 2 * kEntries << " entries to trace, ns per entry: "
+            << double(cost.count()) / (2 * kEntries) << ", "
+            << out.size() / (2 * kEntries) << " bytes per entry" << std::endl;
+}
+
+/**
+ * @brief 飞行记录器只保留每个线程最近的条目，记录的同时可以取快照。
+ */
+BOOST_AUTO_TEST_CASE(ring)
+{
+  Timing tim(50); // 取整为 64
+  std::vector<std::string> names(1000);
+  for (int i = 0; i < 1000; ++i) {
+    names[i] = std::to_string(i);
+    tim(names[i].c_str());
+  }
+  std::size_t cnt = 0;
+  for (auto& i : tim)
+    BOOST_TEST(i.tag() == names[936 + cnt++]);
+  BOOST_TEST(cnt == 64);
+
+  Timing rec(256);
+  std::atomic<bool> stop{ false };
+  std::vector<std::thread> threads(4);
+  for (auto& t : threads)
+    t = std::thread([&] {
+      Timing::StrInfo info("info");
+      while (!stop.load(std::memory_order_relaxed))
+        rec("rec", &info);
+    });
+  std::size_t errors = 0;
+  for (int round = 0; round < 100; ++round) {
+    auto snap = rec.snapshot();
+    std::map<std::uint32_t, std::size_t> counts;
+    std::map<std::uint32_t, Timing::Clock::time_point> lasts;
+    for (auto it = snap.begin(); it != snap.end(); ++it) {
+      auto& last = lasts[it.thread()];
+      errors += it->mTime < last || it->info() != "info";
+      last = it->mTime;
+      errors += ++counts[it.thread()] > 256;
+    }
+  }
+  stop = true;
+  for (auto& t : threads)
+    t.join();
+  BOOST_TEST(errors == 0);
+
+  constexpr auto kLoops = 1000000;
+  auto cost = niming(kLoops, rec(""));
+  std::cout << "ring: " << kLoops << " times cost " << cost << ", "
+            << cost / kLoops << " per time." << std::endl;
+}
+
+/**
+ * @brief 直方图分位数的相对误差不超过 1/32，Stats 在线汇总各线程的作用域耗时。
+ */
+BOOST_AUTO_TEST_CASE(stats)
+{
+  using Hist = Timing::Histogram;
+  for (std::uint64_t v : { 0, 1, 63, 64, 65, 1000, 123456789 }) {
+    BOOST_TEST(Hist::upper(Hist::index(v)) >= v);
+    BOOST_TEST((v == 0 || Hist::upper(Hist::index(v) - 1) < v));
+  }
+  BOOST_TEST(Hist::index(UINT64_MAX) == Hist::kBuckets - 1);
+  BOOST_TEST(Hist::upper(Hist::kBuckets - 1) == UINT64_MAX);
+
+  Hist hist;
+  for (std::uint64_t i = 1; i <= 100000; ++i)
+    hist.record(i);
+  auto sum = hist.summary();
+  BOOST_TEST(sum.mCount == 100000);
+  BOOST_TEST(sum.mMin == 1);
+  BOOST_TEST(sum.mMax == 100000);
+  BOOST_TEST(sum.mMean == 50000.5);
+  BOOST_TEST(sum.mP50 >= 50000);
+  BOOST_TEST(sum.mP50 <= 50000 * 33 / 32);
+  BOOST_TEST(sum.mP99 >= 99000);
+  BOOST_TEST(sum.mP99 <= 100000);
+  BOOST_TEST(sum.mP999 == 100000);
+
+  Timing::Stats tim;
+  std::vector<std::thread> threads(4);
+  for (auto& t : threads)
+    t = std::thread([&] {
+      std::string inner = "inner"; // 内容相同的不同指针共用一个直方图
+      for (int i = 0; i < 1000; ++i) {
+        Timing::Scope outer(tim, "outer");
+        Timing::Scope scope(tim, inner.c_str());
+        tim("point");
+      }
+    });
+  for (auto& t : threads)
+    t.join();
+
+  auto sums = tim.summary();
+  BOOST_TEST(sums.size() == 2);
+  BOOST_TEST(sums["outer"].mCount == 4000);
+  BOOST_TEST(sums["inner"].mCount == 4000);
+  BOOST_TEST(sums["inner"].mMin <= sums["outer"].mMax);
+  BOOST_TEST(sums["outer"].mP50 <= sums["outer"].mP999);
+  BOOST_TEST(tim.to_jval().as_object().contains("outer"));
+
+  constexpr auto kLoops = 1000000;
+  Timing plain(1);
+  auto base = niming(kLoops, Timing::Scope(plain, "loop"));
+  auto cost = niming(kLoops, Timing::Scope(tim, "loop"));
+  std::cout << "scope: " << base / kLoops << " plain, " << cost / kLoops
+            << " with stats per time." << std::endl;
+}
+
+/**
+ * @brief 多个线程同时向同一个计时序列记录，每个线程平均每次记录的耗时。
+ */
+BOOST_AUTO_TEST_CASE(threads_performance)
+{
+  auto loopsEnv = std::getenv("LOOPS");
+  auto loops = loopsEnv ? std::atoi(loopsEnv) : 100000;
+  auto threadsEnv = std::getenv("THREADS");
+  std::size_t threadsNum =
+    threadsEnv ? std::atoi(threadsEnv) : std::thread::hardware_concurrency();
+
+  for (std::size_t n = 1; n <= threadsNum; n *= 2) {
+    Timing tim;
+    auto ns = timing({
+                std::vector<std::thread> threads(n);
+                for (auto& t : threads)
+                  t = std::thread([&] {
+                    for (int i = 0; i < loops; ++i)
+                      tim("");
+                  });
+                for (auto& t : threads)
+                  t.join();
+              }).count();
+    std::size_t cnt = 0;
+    for (auto it = tim.begin(); it != tim.end(); ++it)
+      ++cnt;
+    BOOST_TEST(cnt == n * loops);
+    std::cout << n << " threads record, ns per record: " << double(ns) / loops
+              << std::endl;
+  }
+}
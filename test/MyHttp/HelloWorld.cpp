@@ -118,3 +118,77 @@ BOOST_AUTO_TEST_CASE(stress)
    * 出现毁灭性的全面崩溃恶性循环。
    */
 }
+
+/**
+ * @brief 模拟的空闲连接，只带一个保活计时器。
+ */
+struct Idle : public Pooled<Idle>
+{
+  Idle(ba::io_context& ioc)
+    : mTimer(ioc)
+  {
+  }
+
+  ba::steady_timer mTimer;
+};
+
+BOOST_AUTO_TEST_CASE(idle_sweep)
+{
+  auto loopsEnv = std::getenv("LOOPS");
+  auto loops = loopsEnv ? std::atoi(loopsEnv) : 10;
+  constexpr int kIdle = 10000;
+  constexpr auto kTtl = 3s;
+
+  ba::io_context ioc;
+  Idle::BoundedPool pool;
+  std::vector<std::shared_ptr<Idle>> conns;
+  for (int i = 0; i < kIdle; ++i)
+    conns.emplace_back(pool.make(ioc));
+
+  // 每轮把所有连接取出再归还一遍，相当于一个保活周期里每个连接都用了一次
+  auto round = [&](auto&& onTake, auto&& onGive) {
+    for (auto& c : conns)
+      pool.give(c), onGive(c);
+    for (auto& c : conns) {
+      c = pool.take();
+      onTake(c);
+    }
+  };
+
+  // 每个空闲连接一个计时器：归还时武装，取出时取消，取消的回调也要执行
+  auto timerNs = timing({
+                   for (int i = 0; i < loops; ++i) {
+                     round([](auto& c) { c->mTimer.cancel(); },
+                           [&](auto& c) {
+                             c->mTimer.expires_after(kTtl);
+                             c->mTimer.async_wait([&pool, c](auto&& ec) {
+                               if (!ec)
+                                 pool.drop(*c);
+                             });
+                           });
+                     ioc.poll();
+                     ioc.restart(); // 没活时 poll 会停下 io_context
+                   }
+                 }).count();
+
+  // 一个清扫器：归还时只记下时刻，每轮清扫一趟
+  std::size_t evicts = 0;
+  auto sweepNs = timing({
+                   for (int i = 0; i < loops; ++i) {
+                     round([](auto&) {}, [](auto&) {});
+                     evicts += pool.sweep(kTtl);
+                   }
+                 }).count();
+  BOOST_TEST(evicts == 0);
+
+  for (auto& c : conns)
+    pool.give(std::move(c));
+  auto passNs = timing(pool.sweep(kTtl)).count();
+  BOOST_TEST(pool.sweep(0s) == std::size_t(kIdle));
+  BOOST_TEST(pool.stats().mTotal == 0);
+
+  auto cycles = double(loops) * kIdle;
+  std::cout << kIdle << " idle connections, ns per take/give cycle: timers "
+            << timerNs / cycles << ", sweeper " << sweepNs / cycles
+            << "; one sweep pass " << passNs / 1e6 << " ms" << std::endl;
+}